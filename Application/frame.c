@@ -0,0 +1,128 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Requests serial data from a Motech inverter via Serial, and
+					sends it via Wi-Fi/Socket connection.
+	Version		:	v0.8
+*/
+
+// Include files.
+#include "global.h"
+#include "protocol.h"
+
+#define RING_MASK		(FRAME_RING_SIZE - 1)
+
+/**
+	Resets the frame assembler, discarding any buffered bytes.
+
+	Inputs: The frame assembler, and the address and function code the next response is
+			expected with.
+*/
+void frame_reset(struct FRAME_ASSEMBLER *fa, char address, unsigned char function)
+{
+	fa->head = 0;
+	fa->count = 0;
+	fa->scanned = 0;
+	fa->crc = CRC16_INIT;
+	fa->address = address;
+	fa->function = function;
+}
+
+/**
+	Gets the free space in the ring buffer.
+
+	Returns: The number of bytes that can be pushed.
+*/
+int frame_space(struct FRAME_ASSEMBLER *fa)
+{
+	return FRAME_RING_SIZE - fa->count;
+}
+
+/**
+	Appends received bytes to the ring buffer.
+
+	Inputs: The frame assembler, the received bytes, and the number of bytes.
+	Returns: The number of bytes stored(limited by the free space).
+*/
+int frame_push(struct FRAME_ASSEMBLER *fa, unsigned char *data, int len)
+{
+	int i;
+
+	if (len > frame_space(fa)) len = frame_space(fa);
+	for (i=0; i<len; i++) fa->ring[(fa->head + fa->count + i) & RING_MASK] = data[i];
+	fa->count += len;
+
+	return len;
+}
+
+/**
+	Drops the first byte of the candidate frame, and restarts validation from the next byte.
+*/
+static void frame_slide(struct FRAME_ASSEMBLER *fa)
+{
+	fa->head = (fa->head + 1) & RING_MASK;
+	fa->count--;
+	fa->scanned = 0;
+	fa->crc = CRC16_INIT;
+}
+
+/**
+	Validates the buffered bytes against the response framing
+	(0x0A, address, 0x03, length, data, CRC16, 0x0D). A write response echoes the request
+	(0x0A, address, 0x06, register, value, CRC16, 0x0D), so it is framed as three bytes of
+	data following the function code. Bytes are validated once as they arrive, and a
+	mismatch slides the candidate start forward by one byte to resynchronise.
+
+	Inputs: The frame assembler, the buffer for the frame, and the buffer length.
+	Returns: 1 when a complete frame was copied(frame_len is set to its length), 0 otherwise.
+*/
+int frame_extract(struct FRAME_ASSEMBLER *fa, unsigned char *frame, int *frame_len)
+{
+	unsigned char val;
+	int data_len;
+	int valid;
+	int i;
+
+	while (fa->scanned < fa->count) {
+		val = fa->ring[(fa->head + fa->scanned) & RING_MASK];
+		if (fa->function == FUNC_WRITE_REGISTER) data_len = 3;
+		else data_len = (fa->scanned >= 3) ? fa->ring[(fa->head + 3) & RING_MASK] : 0;
+
+		// Check the byte against its expected position in the frame.
+		if (fa->scanned == 0) valid = (val == 0x0A);
+		else if (fa->scanned == 1) valid = (val == (unsigned char) fa->address);
+		else if (fa->scanned == 2) valid = (val == fa->function);
+		else if (fa->scanned == 3) valid = (fa->function == FUNC_WRITE_REGISTER) || ((val <= FRAME_MAX_DATA) && ((val + 7) <= *frame_len));
+		else if (fa->scanned < 4 + data_len) valid = 1;
+		else if (fa->scanned == 4 + data_len) valid = (val == ((fa->crc >> 8) & 0x00FF));
+		else if (fa->scanned == 5 + data_len) valid = (val == (fa->crc & 0x00FF));
+		else valid = (val == 0x0D);
+
+		if (!valid) {
+			if ((fa->scanned == 4 + data_len) || (fa->scanned == 5 + data_len)) fa->crc_errors++;
+			if ((fa->scanned > 3) && (verbose)) fprintf(stderr, "Discarding invalid frame(%d bytes validated), resynchronising.\n", fa->scanned);
+			frame_slide(fa);
+			continue;
+		}
+
+		// Update the CRC over the address, function, length and data bytes.
+		if ((fa->scanned >= 1) && (fa->scanned < 4 + data_len)) {
+			fa->crc = crc16_update(fa->crc, val);
+			if (fa->scanned == 3 + data_len) fa->crc = crc16_final(fa->crc);
+		}
+		fa->scanned++;
+
+		// Copy out a complete frame, leaving any following bytes in the ring.
+		if (fa->scanned == 7 + data_len) {
+			for (i=0; i<fa->scanned; i++) frame[i] = fa->ring[(fa->head + i) & RING_MASK];
+			*frame_len = fa->scanned;
+			fa->head = (fa->head + fa->scanned) & RING_MASK;
+			fa->count -= fa->scanned;
+			fa->scanned = 0;
+			fa->crc = CRC16_INIT;
+			return 1;
+		}
+	}
+
+	return 0;
+}
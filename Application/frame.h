@@ -0,0 +1,16 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Requests serial data from a Motech inverter via Serial, and
+					sends it via Wi-Fi/Socket connection.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "global.h"
+
+// External declarations.
+extern void frame_reset(struct FRAME_ASSEMBLER *, char, unsigned char);
+extern int frame_space(struct FRAME_ASSEMBLER *);
+extern int frame_push(struct FRAME_ASSEMBLER *, unsigned char *, int);
+extern int frame_extract(struct FRAME_ASSEMBLER *, unsigned char *, int *);
@@ -19,23 +19,46 @@ int verbose 			= 1;
 
 // Serial Port Settings
 int sp_baud_rate 		= SERIAL_BAUD_RATE;
-char *sp_dev_name 		= SERIAL_PORT_LOCATION;
+struct SERIAL_PORT sp_ports[SP_MAX_PORTS] = {{SERIAL_PORT_LOCATION}};
+int sp_count			= 1;
+int sp_named			= 0;
+int sp_timeout_msec		= READ_TIMEOUT_MSEC;
+int sp_auto_baud		= 0;
 
 // Inverter Settings
 int inv_address 		= INV_DEFAULT_ADDRESS;
+struct INVERTER inv_devices[INV_MAX_DEVICES];
+int inv_count			= 0;
+int inv_max_registers	= INV_MAX_REGISTERS;
 int inv_look_for_addr 	= 0;
+int inv_look_for_count	= 0;
 int inv_get_data		= 0;
 
+// Daemon Settings
+int dmn_flag			= 0;
+int dmn_interval		= DAEMON_POLL_INTERVAL;
+
 // PVOutput Settings
 int pvo_send_to 		= 0;
 char *pvo_api_key 		= PVOUTPUT_API_KEY;
 char *pvo_sys_id 		= PVOUTPUT_SYS_ID;
+struct HTTP_CONNECTION pvo_conn = {PVOUTPUT_HOST, PVOUTPUT_PORT, -1};
+char *pvo_spool_file		= SPOOL_FILE;
+int pvo_overflow			= UPLOAD_SPILL;
+
+// Publishing Settings
+struct SINK pub_sinks[PUBLISH_MAX_SINKS];
+int pub_sink_count		= 0;
+
+// Metrics Settings
+char *met_listen		= NULL;
 
 // Restart on failure Settings
 int rof_flag 			= 0;
 int rof_max_failures 	= FAILURE_COUNT_RESTART;
 int rof_start_hour 		= FAILURE_START_TIME;
 int rof_stop_hour 		= FAILURE_STOP_TIME;
+int rof_fail_count		= 0;
 
 /**
 	Gets the current hour.
@@ -148,46 +171,197 @@ char *convert_i2s(int valIn, int decimalPlaces)
 */
 void print_inverter_data(struct INVERTER_INFO *inv_info)
 {
-	int i;
-
-	printf("Brand Name: %s\n", inv_info->idv->Brand_Name);
-	printf("Type Name: %s\n", inv_info->idv->Type_Name);
-	printf("Serial Number: %s\n", inv_info->idv->Sn_Name);
+	if (inv_info->valid & INFO_IDV) print_fields(REG_FIELDS(reg_idv), &inv_info->idv);
 
 	printf("Time: %s\n", inv_info->dt.time);
 	printf("Date: %s\n", inv_info->dt.date);
 
-	for (i=0; i<3; i++) printf("Array Power(%d): %d W\n", i+1, inv_info->icv->Ppv[i]);
-	for (i=0; i<3; i++) printf("Array Voltage(%d): %d V\n", i+1, inv_info->icv->Vpv[i]);
-	
-	printf("AC Frequency: %.2f Hz\n", inv_info->icv->Fac);
-	printf("AC Voltage: %.2f V\n", inv_info->icv->Vac);
-	printf("AC Power: %.2f W\n", inv_info->icv->Pac);
-	printf("AC Current: %.2f A\n", inv_info->icv->Iac);
-	
-	printf("Heatsink Temp: %.2f degC\n", inv_info->icv->Heatsink_Temp);
-	printf("Total time hours: %d hr\n", inv_info->itv->Time_Hr_Cnt);
-	printf("Total time minutes: %d mins\n", inv_info->itv->Time_Min_Cnt);
-	printf("Total Power: %ld kWh\n", inv_info->itv->Eac);
-	printf("Time on today: %.2f hr\n", inv_info->icv->Ton_today);
+	// The fields are listed by the register map.
+	if (inv_info->valid & INFO_ICV) print_fields(REG_FIELDS(reg_icv), &inv_info->icv);
+	if (inv_info->valid & INFO_ICS) {
+		if (inv_info->stale & INFO_ICS) printf("Current State(from an earlier poll):\n");
+		print_fields(REG_FIELDS(reg_ics), &inv_info->ics);
+	}
+	if (inv_info->valid & INFO_ITV) {
+		if (inv_info->stale & INFO_ITV) printf("Total Values(from an earlier poll):\n");
+		print_fields(REG_FIELDS(reg_itv), &inv_info->itv);
+	}
 }
 
-/*
- * Cleans up a Read-Request item.
- */
-void cleanup_read_req(struct READ_REQ *rr)
+/**
+	Adds a serial port to the list of serial ports polled. The first port added replaces
+	the default port.
+
+	Inputs: The serial port device name.
+	Returns: The index of the serial port, or -1 if the list is full.
+*/
+int add_serial_port(char *dev_name)
+{
+	if (!sp_named) {
+		sp_ports[0].dev_name = dev_name;
+		sp_named = 1;
+		return 0;
+	}
+
+	if (sp_count >= SP_MAX_PORTS) {
+		fprintf(stderr, "Only %d serial ports can be polled.\n", SP_MAX_PORTS);
+		return -1;
+	}
+
+	sp_ports[sp_count].dev_name = dev_name;
+	return sp_count++;
+}
+
+/**
+	Adds an inverter to the list of inverters polled.
+
+	Inputs: The index of the serial port it is connected to, and the inverter address.
+	Returns: 1 on success, -1 if the address is invalid or the list is full.
+*/
+int add_inverter(int port, int address)
+{
+	int i;
+
+	if ((address < 1) || (address > 255)) return -1;
+
+	// Ignore duplicates.
+	for (i=0; i<inv_count; i++) {
+		if ((inv_devices[i].port == port) && (inv_devices[i].address == address)) return 1;
+	}
+
+	if (inv_count >= INV_MAX_DEVICES) {
+		fprintf(stderr, "Only %d inverters can be polled.\n", INV_MAX_DEVICES);
+		return -1;
+	}
+
+	memset(&inv_devices[inv_count], 0, sizeof(struct INVERTER));
+	inv_devices[inv_count].port = port;
+	inv_devices[inv_count].address = address;
+	inv_devices[inv_count].rto = READ_TIMEOUT_MSEC;
+	inv_count++;
+
+	return 1;
+}
+
+/**
+	Updates an inverter's turnaround estimate with a measured latency, and derives the
+	allowance for its next request from it(smoothed latency plus four times its variation,
+	as for TCP retransmission timeouts).
+
+	Inputs: The inverter, and the measured turnaround latency(in milliseconds).
+*/
+void update_inverter_latency(struct INVERTER *dev, long sample)
+{
+	long delta;
+
+	if (dev->latency_samples == 0) {
+		dev->srtt = sample * 8;
+		dev->rttvar = sample * 2;
+	} else {
+		delta = sample - (dev->srtt / 8);
+		dev->srtt += delta;
+		if (delta < 0) delta = -delta;
+		dev->rttvar += delta - (dev->rttvar / 4);
+	}
+	dev->latency = sample;
+	dev->latency_samples++;
+
+	dev->rto = (dev->srtt / 8) + dev->rttvar;
+	if (dev->rto < INV_RTO_MIN) dev->rto = INV_RTO_MIN;
+	if (dev->rto > INV_RTO_MAX) dev->rto = INV_RTO_MAX;
+}
+
+/**
+	Doubles an inverter's turnaround allowance after a request timed out.
+
+	Inputs: The inverter.
+*/
+void backoff_inverter_latency(struct INVERTER *dev)
 {
-	free(rr->data);
-	free(rr);
+	dev->rto = dev->rto * 2;
+	if (dev->rto > INV_RTO_MAX) dev->rto = INV_RTO_MAX;
 }
 
 /**
- * Cleans up a Read-Request-Response item.
+	Updates how often an inverter is polled, after a poll. An inverter that has failed
+	INV_DEAD_POLLS polls in a row is only probed every so often, with the gap doubling
+	after each failed probe, so dead addresses stop using up the polling time.
+
+	Inputs: The inverter, and 1 if the poll succeeded.
+*/
+void update_inverter_backoff(struct INVERTER *dev, int success)
+{
+	if ((success) || (dev->fail_count < INV_DEAD_POLLS)) {
+		dev->dead_backoff = 0;
+		dev->skip_polls = 0;
+		return;
+	}
+
+	dev->dead_backoff = (dev->dead_backoff == 0) ? 1 : dev->dead_backoff * 2;
+	if (dev->dead_backoff > INV_DEAD_BACKOFF_MAX) dev->dead_backoff = INV_DEAD_BACKOFF_MAX;
+	dev->skip_polls = dev->dead_backoff;
+}
+
+/**
+	Checks whether an inverter's latest poll produced a sample: its current values were
+	read this poll, and its total values have been read(possibly by an earlier poll, as
+	they are read less often, or kept when a read failed).
+
+	Inputs: The Inverter Info.
+	Returns: 1 if there is a sample, 0 otherwise.
+*/
+int has_current_sample(struct INVERTER_INFO *ii)
+{
+	if ((ii->valid & (INFO_ICV | INFO_ITV)) != (INFO_ICV | INFO_ITV)) return 0;
+	if (ii->stale & INFO_ICV) return 0;
+
+	return 1;
+}
+
+/**
+	Combines the latest values of several inverters, as if they were one system
+	(power and energy are summed, voltage and frequency are averaged).
+
+	Inputs: The inverters, the number of inverters, and the Inverter Info to fill.
+*/
+void aggregate_inverter_info(struct INVERTER *devices, int count, struct INVERTER_INFO *out)
+{
+	struct INVERTER_INFO *ii;
+	int valid;
+	int i;
+
+	memset(out, 0, sizeof(struct INVERTER_INFO));
+
+	valid = 0;
+	for (i=0; i<count; i++) {
+		ii = &devices[i].ii;
+		if (!has_current_sample(ii)) continue;
+
+		if (valid == 0) out->dt = ii->dt;
+		out->icv.Pac += ii->icv.Pac;
+		out->icv.Iac += ii->icv.Iac;
+		out->icv.Vac += ii->icv.Vac;
+		out->icv.Fac += ii->icv.Fac;
+		out->icv.Eac += ii->icv.Eac;
+		out->itv.Eac += ii->itv.Eac;
+		valid++;
+	}
+
+	if (valid > 0) {
+		out->icv.Vac = out->icv.Vac / valid;
+		out->icv.Fac = out->icv.Fac / valid;
+		out->valid = INFO_ICV | INFO_ITV;
+	}
+}
+
+/**
+ * Empties an Inverter-Info item(its structures are embedded, so nothing is freed).
  */
-void cleanup_read_req_response(struct READ_REQ_RESPONSE *rrr)
+void cleanup_inverter_info(struct INVERTER_INFO *inv_info)
 {
-	free(rrr->data);
-	free(rrr);
+	inv_info->valid = 0;
+	inv_info->stale = 0;
+	inv_info->stale_blocks = 0;
 }
 
 /**
@@ -203,3 +377,62 @@ void isleep(long lInterval) {
 
 	nanosleep(&ts, NULL);
 }
+
+/**
+	Gets a monotonic timestamp, unaffected by changes to the wall clock.
+
+	Returns: The current monotonic time (in milliseconds).
+*/
+long get_time_msec() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/**
+	Gets a monotonic timestamp, for timing individual transactions.
+
+	Returns: The current monotonic time (in microseconds).
+*/
+long get_time_usec() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000L) + (ts.tv_nsec / 1000);
+}
+
+/**
+	Gets the delay before trying again after consecutive failures: the base delay, doubled
+	for each earlier failure up to the longest delay, plus up to a quarter more at random,
+	so clients that failed together do not all try again together.
+
+	Inputs: The consecutive failures(before this one), the base delay, and the longest
+			delay(in milliseconds).
+	Returns: The delay (in milliseconds).
+*/
+long get_backoff_msec(int failures, long base_msec, long max_msec) {
+	long backoff;
+
+	backoff = base_msec << ((failures < 10) ? failures : 10);
+	if (backoff > max_msec) backoff = max_msec;
+
+	return backoff + (rand() % (backoff / 4 + 1));
+}
+
+/**
+	Blocks SIGTERM and SIGINT in the calling thread, so the threads it starts next leave
+	them to the polling thread. The old mask is restored with pthread_sigmask(SIG_SETMASK).
+
+	Inputs: The buffer for the old signal mask.
+*/
+void block_stop_signals(sigset_t *old) {
+	sigset_t block;
+
+	sigemptyset(&block);
+	sigaddset(&block, SIGTERM);
+	sigaddset(&block, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &block, old);
+}
@@ -16,34 +16,115 @@
 	 */
 
 	#include <arpa/inet.h>
+	#include <ctype.h>
+	#include <errno.h>
 	#include <fcntl.h>
+	#include <limits.h>
 	#include <math.h>
 	#include <netdb.h>
 	#include <netinet/in.h>
+	#include <poll.h>
+	#include <pthread.h>
+	#include <stdarg.h>
+	#include <stddef.h>
 	#include <stdio.h>
 	#include <stdlib.h>
 	#include <string.h>
+	#include <strings.h>
+	#include <sys/epoll.h>
 	#include <sys/socket.h>
+	#include <sys/timerfd.h>
 	#include <sys/types.h>
 	#include <time.h>
 	#include <termios.h>
 	#include <unistd.h>
 	#include <sys/reboot.h>
 	#include <getopt.h>
+	#include <signal.h>
+	#include "registers.h"
 
 	/*
 	* Definitions.
 	*/
 
-	#define	OPTLIST						"b:s:a:lgpi:k:rc:e:f:"						// Command Line Argument List
+	#define	OPTLIST						"b:us:a:ln:gm:pi:k:o:q:w:M:I:U:x:rc:e:f:dt:"	// Command Line Argument List
 
 	#define SERIAL_PORT_LOCATION		"/dev/ttyUSB0"								// Default Serial Port
 	#define SERIAL_BAUD_RATE			B9600										// Default Baud Rate
+	#define SP_MAX_PORTS				16											// Maximum number of serial ports polled
+	#define SP_BAUD_SETTLE_MSEC			100											// Time allowed for an inverter to change baud rate (in milliseconds)
+	#define SP_BAUD_VERIFY_TRIES		3											// Requests sent to check the inverters answer at a new baud rate
 
 	#define INV_DEFAULT_ADDRESS			0x2D										// Default Inverter Address
+	#define INV_MAX_DEVICES				64											// Maximum number of inverters polled
+	#define INV_MAX_REGISTERS			32											// Default largest register block requested in one read
+	#define INV_MAX_GAP					4											// Largest gap of unused registers merged into one read
+	#define INV_MAX_SPANS				16											// Maximum number of read requests per inverter poll
+	#define INV_MAX_BLOCKS				32											// Most register blocks in the register map (one bit each in a block mask)
+	#define INV_BLOCK_COUNT				10											// Register blocks in the register map (inv_blocks)
+	#define INV_MAX_REQUESTS			((INV_BLOCK_COUNT * (INV_BLOCK_COUNT + 1)) / 2)	// Request frames kept per inverter (one per run of blocks a read can span)
+	#define INV_PERIOD_CURRENT			10											// Time between reads of the current values and state (in seconds)
+	#define INV_PERIOD_TOTALS			60											// Time between reads of the total values (in seconds)
 
 	#define PVOUTPUT_API_KEY			""											// Default API Key for PVOutput
 	#define PVOUTPUT_SYS_ID				""											// Default System ID for PVOutput
+	#define PVOUTPUT_HOST				"www.pvoutput.org"							// Default PVOutput host
+	#define PVOUTPUT_PORT				80											// Default PVOutput port
+	#define PVOUTPUT_BATCH_PATH			"/service/r2/addbatchstatus.jsp"			// PVOutput Add Batch Status service
+	#define PVOUTPUT_BATCH_SIZE			30											// Most statuses per batch
+	#define SPOOL_FILE					"/tmp/motech_spool.txt"						// Default file to store the statuses not yet uploaded(see -q).
+	#define SPOOL_LINE_LENGTH			80											// Longest status line in the spool
+	#define SPOOL_MAX_BYTES				262144										// Largest spool, beyond which new statuses are not stored
+	#define SPOOL_MAX_BATCHES			10											// Most batches uploaded each time the spool is drained
+
+	#define UPLOAD_QUEUE_SIZE			64											// Statuses queued for the upload thread (power of two)
+	#define UPLOAD_RETRY_SEC			30											// Delay before uploading again after a failed upload, doubling for each further failure (in seconds)
+	#define UPLOAD_BACKOFF_MAX_SEC		900											// Longest delay after failed uploads (in seconds)
+	#define PVOUTPUT_RATE_LIMIT			60											// Requests PVOutput allows per hour, until its rate limit headers say otherwise
+	#define PVOUTPUT_RATE_WINDOW_SEC	3600										// Period the rate limit applies to (in seconds)
+	#define UPLOAD_DROP_OLDEST			1											// Upload Queue Overflow: drop the oldest queued status
+	#define UPLOAD_SPILL				2											// Upload Queue Overflow: store new statuses in a spill file, for the upload thread to add to the spool
+
+	#define PUBLISH_MAX_SINKS			4											// Most sinks samples are published to (besides PVOutput)
+	#define PUBLISH_RING_SIZE			64											// Samples kept for the sinks (a sink further behind loses its oldest)
+	#define PUBLISH_RECORD_SIZE			1024										// Longest sample, as an InfluxDB line
+	#define PUBLISH_BATCH_RECORDS		16											// Most samples a sink sends at once
+	#define PUBLISH_MEASUREMENT			"motech"									// InfluxDB measurement(and MQTT topic prefix) of the samples
+	#define PUBLISH_KEY_LENGTH			(NAME_MAX + 8)								// Longest key of a sample (the serial port's name, '/' and the address)
+	#define PUBLISH_RETRY_SEC			5											// Delay before a sink tries again after a failed send, doubling for each further failure (in seconds)
+	#define PUBLISH_BACKOFF_MAX_SEC		300											// Longest delay after failed sends (in seconds)
+	#define SINK_MQTT					1											// Sink Type: MQTT broker, one message per sample
+	#define SINK_INFLUXDB				2											// Sink Type: InfluxDB(v1 /write), samples posted as lines
+	#define SINK_UDP					3											// Sink Type: UDP datagrams of lines (eg InfluxDB or Telegraf UDP listener)
+	#define MQTT_PORT					1883										// Default MQTT broker port
+	#define MQTT_KEEPALIVE_SEC			(HTTP_IDLE_SEC * 2)							// Keep alive asked of the broker(idle connections are closed sooner)
+	#define MQTT_PREFIX_LENGTH			(LINE_LENGTH * 4)							// Longest MQTT topic prefix
+	#define MQTT_TOPIC_LENGTH			(MQTT_PREFIX_LENGTH + PUBLISH_KEY_LENGTH)	// Longest MQTT topic (the prefix, '/' and the key)
+	#define INFLUXDB_PORT				8086										// Default InfluxDB port
+	#define INFLUXDB_DATABASE			"motech"									// Default InfluxDB database
+	#define UDP_PORT					8089										// Default UDP port
+	#define UDP_MAX_DATAGRAM			1400										// Largest datagram sent (lines are not split)
+
+	#define METRICS_PORT				9464										// Default port of the metrics(Prometheus) endpoint
+	#define METRICS_MAX_CLIENTS			8											// Scrapers served at once (more wait to be accepted)
+	#define METRICS_PAGE_SIZE			262144										// Largest metrics page (memory is only touched as far as the page is filled)
+	#define METRICS_REQUEST_SIZE		1024										// Longest request (line and headers) read from a scraper
+	#define METRICS_HEADER_SIZE			256											// Longest response status line and headers
+	#define METRICS_TIMEOUT_SEC			10											// Time a scraper has to send its request and read the page (in seconds)
+	#define METRICS_LABEL_LENGTH		((NAME_MAX * 2) + 32)						// Longest labels of an inverter (its serial port's name, escaped, and address)
+
+	#define HTTP_DEFAULT_PORT			80											// Port a Host header leaves out
+	#define HTTP_TIMEOUT_SEC			10											// Time allowed to connect, send a request, or receive a response (in seconds)
+	#define HTTP_IDLE_SEC				60											// Idle time after which a keep-alive connection is not reused (in seconds)
+	#define HTTP_RESPONSE_SIZE			2048										// Largest HTTP response kept (status line, headers and body)
+
+	#define RESOLVE_MAX_HOSTS			8											// Host names kept in the resolver cache
+	#define RESOLVE_MAX_ADDRS			4											// Addresses kept per host name
+	#define RESOLVE_TTL_SEC				300											// Time a resolved address is used before it is looked up again (in seconds)
+	#define RESOLVE_RETRY_SEC			30											// Time before a failed lookup is tried again (in seconds)
+	#define RESOLVE_WAIT_MSEC			5000										// Longest wait for the first lookup of a host name, from when it started (in milliseconds)
+
+	#define DAEMON_POLL_INTERVAL		10											// Default polling interval in daemon mode (in seconds)
 
 	#define FAILURE_COUNT_RESTART		300											// Number of read failures before restarting device
 	#define FAILURE_START_TIME			8											// Hour to start monitoring read failures.
@@ -51,10 +132,51 @@
 	#define FAILURE_FILE				"/tmp/motech_log.txt"						// Log file to store read failures.
 
 	#define	STRING_SIZE					10											// Default String Size
+	#define STRING_REGISTERS			8											// Registers per inverter string (two characters each)
 	#define LINE_LENGTH					20											// Default Line Size
 
 	#define READ_SLEEP_USEC				20000										// Default Sleep time (in microseconds)
-	#define READ_COUNTER_MAX			10											// Number of Serial read timeouts before failure
+	#define READ_TIMEOUT_MSEC			200											// Inverter turnaround allowance per response (in milliseconds)
+	#define SCAN_TIMEOUT_MSEC			40											// Inverter turnaround allowance while scanning (in milliseconds)
+	#define READ_SLACK_MSEC				50											// Allowance for gaps within a response, after its first byte (in milliseconds)
+	#define INV_RTO_MIN					30											// Smallest adaptive turnaround allowance (in milliseconds)
+	#define INV_RTO_MAX					1000										// Largest adaptive turnaround allowance (in milliseconds)
+	#define INV_DEAD_POLLS				3											// Consecutive failed polls before an inverter is polled less often
+	#define INV_DEAD_BACKOFF_MAX		32											// Most polls skipped between probes of a silent inverter
+	#define INV_MAX_RETRIES				2											// Retries of a failed request within one poll
+	#define PORT_RETRY_BUDGET			8											// Most retries per serial port per poll
+	#define RETRY_BACKOFF_MSEC			10											// Delay before the first retry, doubling for each further retry (in milliseconds, plus up to as much again in jitter)
+	#define RETRY_BACKOFF_MAX_MSEC		200											// Longest delay before a retry (in milliseconds)
+	#define SCAN_CACHE_FILE				"/tmp/motech_inverters.txt"					// File to store the inverter addresses found by a scan.
+	#define STATIC_CACHE_FILE			"/tmp/motech_static.txt"					// File to store each inverter's settings and names between runs.
+	#define INV_STATIC_REFRESH_SEC		3600										// Time before an inverter's settings and names are read again (in seconds)
+	#define REQUEST_LENGTH				10											// Length of Motech requests.
+	#define FUNC_READ_REGISTERS			0x03										// Function code: read registers
+	#define FUNC_WRITE_REGISTER			0x06										// Function code: write one register (the response echoes the request)
+	#define INV_BAUD_REGISTER			0x14										// Device Settings register holding the inverter's baud rate (assumed 0=9600, 1=19200)
+	#define CRC16_INIT					0xFFFF										// Initial value of a running CRC16 checksum.
+
+	#define ENGINE_MAX_EVENTS			32											// Events handled per epoll_wait() call
+	#define SPAN_DESC_LENGTH			64											// Longest description of a read request, for messages
+	#define ENGINE_DURATION_BUCKETS		8											// Transaction duration histogram buckets
+	#define PORT_MAX_TRANSACTIONS		(INV_MAX_DEVICES * (INV_MAX_SPANS + 1))		// Transactions per serial port per poll
+
+	#define PORT_IDLE					0											// Serial Port State: no transaction in progress
+	#define PORT_WRITING				1											// Serial Port State: writing a request
+	#define PORT_READING				2											// Serial Port State: waiting for a response
+	#define PORT_BACKOFF				3											// Serial Port State: waiting to retry a failed transaction
+
+	#define FRAME_RING_SIZE				512											// Serial receive ring buffer size (power of two)
+	#define FRAME_MAX_DATA				250											// Largest data length accepted in a response frame
+
+	#define INFO_ITS1					0x01										// Inverter Info flag: Trip Settings #1 read
+	#define INFO_ITS2					0x02										// Inverter Info flag: Trip Settings #2 read
+	#define INFO_IDS					0x04										// Inverter Info flag: Device Settings read
+	#define INFO_ITV					0x08										// Inverter Info flag: Total Values read
+	#define INFO_IDV					0x10										// Inverter Info flag: Device Values(names) read
+	#define INFO_ICS					0x20										// Inverter Info flag: Current State read
+	#define INFO_ICV					0x40										// Inverter Info flag: Current Values read
+	#define INFO_STATIC					(INFO_ITS1 | INFO_ITS2 | INFO_IDS | INFO_IDV)	// Inverter Info flags of the cached settings and names
 
 	/*
 	 * Custom Structures
@@ -62,86 +184,263 @@
 
 	// Inverter Trip Settings #1
 	struct INV_TRIP_SETTINGS_1 {
-		int FacH_Trip;
-		int FacH_Cycle;
-		int FacL_Trip;
-		int FacL_Cycle;
-		int VacH_Trip;
-		int VacH_Cycle;
-		int VacL_Trip;
-		int VacL_Cycle;
-		int Delta_Zac_Trip;
-		int Zac_Trip;
+		REG_STRUCT_MEMBERS(INV_TRIP_SETTINGS_1_MAP)
 	};
 
 	// Inverter Trip Settings
 	struct INV_TRIP_SETTINGS_2 {
-		int FastIEarth_Trip;
-		int SlowIEarth_Trip;
-		int Riso_Trip;
-		int Vpv_Trip;
-		int OnGrid_Delay;
-		int VacH_Limit;
-		int VacH_Limit_Cycle;
+		REG_STRUCT_MEMBERS(INV_TRIP_SETTINGS_2_MAP)
 	};
 
 	// Inverter Device Settings
 	struct INV_DEVICE_SETTINGS {
-		int Type_No;
-		int Address;
-		int Baudrate;
-		int Language;
+		REG_STRUCT_MEMBERS(INV_DEVICE_SETTINGS_MAP)
 	};
 
 	// Inverter Total Values
 	struct INV_TOTAL_VALUES {
-		long BridgeRelay_On_Num;
-		int Time_Hr_Cnt;
-		int Time_Min_Cnt;
-		int Time_Sec_Cnt;
-		long Eac;
-		long Epv[3];
+		REG_STRUCT_MEMBERS(INV_TOTAL_VALUES_MAP)
 	};
 
 	// Inverter Device Values
 	struct INV_DEVICE_VALUES {
-		char *Brand_Name;
-		char *Type_Name;
-		char *Sn_Name;
+		REG_STRUCT_MEMBERS(INV_DEVICE_VALUES_MAP)
 	};
 
 	// Inverter Current State
 	struct INV_CUR_STATE {
-		int State;
-		int Error_Code[4];
+		REG_STRUCT_MEMBERS(INV_CUR_STATE_MAP)
 	};
 
+	// Inverter Current Values
 	struct INV_CUR_VALUES {
-		int Vpv[3];
-		int Ppv[3];
-		
-		double Vac;
-		double Pac;
-		double Iac;
-		double Fac;
-
-		double Eac;
-
-		double Ton_today;
-		double Heatsink_Temp;
+		REG_STRUCT_MEMBERS(INV_CUR_VALUES_MAP)
 	};
 
 	// Read Request Response
 	struct READ_REQ_RESPONSE {
 		char 	success;		// 0 on failure, 1 on success.
 		int 	data_length;	// Data length.
-		char 	*data;			// Pointer to the data.
+		char 	*data;			// Pointer to the data(within the response received).
+	};
+
+	// Request Frame (a read request built once for an inverter, CRC included)
+	struct REQUEST_FRAME {
+		int 			start;		// First register.
+		int 			length;		// Number of registers.
+		unsigned char 	data[REQUEST_LENGTH];
+	};
+
+	// Frame Assembler (ring buffer of received bytes, and the validation state of the candidate frame)
+	struct FRAME_ASSEMBLER {
+		unsigned char 	ring[FRAME_RING_SIZE];
+		int 			head;			// Position of the oldest byte(candidate frame start).
+		int 			count;			// Number of bytes in the ring.
+		int 			scanned;		// Number of candidate frame bytes validated so far.
+		unsigned short 	crc;			// Running CRC over the validated bytes.
+		char 			address;		// Address the response is expected from.
+		unsigned char 	function;		// Function code the response is expected to carry.
+		long 			crc_errors;		// Candidate frames discarded as their CRC did not match.
+	};
+
+	// Register Block (a contiguous register range, and the Inverter Info structure it is decoded into)
+	struct READ_BLOCK {
+		int 	start;				// First register.
+		int 	length;				// Number of registers.
+		char 	*name;				// Description of the block.
+		int 	info_offset;		// Offset of the block's structure in INVERTER_INFO.
+		int 	info_size;			// Size of the block's structure.
+		unsigned int 	info_flag;	// INFO_* flag set once the block's structure holds values.
+		char 	extends;			// 1 if the block only extends a structure filled by an earlier block.
+		char 	is_static;			// 1 if the block holds settings or names, which are cached between runs.
+		int 	period;				// Time between reads of the block (in seconds).
+		struct REG_FIELD 	*fields;	// Fields of the block's structure(from the register map).
+		int 	field_count;		// Number of fields.
+	};
+
+	// Register Span (one read request covering one or more register blocks)
+	struct READ_SPAN {
+		int 	start;				// First register.
+		int 	length;				// Number of registers.
+		int 	first;				// Index of the first block covered.
+		int 	count;				// Number of blocks covered.
+		unsigned int 	mask;		// Blocks covered (one bit per block index).
+	};
+
+	// Engine Handler (a file descriptor watched by the epoll engine, and its event handler)
+	struct ENGINE_HANDLER {
+		int 	fd;
+		void 	(*handle)(struct ENGINE_HANDLER *, unsigned int);
+		void 	*context;
+	};
+
+	// Transaction (one request/response exchange with an inverter)
+	struct TRANSACTION {
+		int 				device;			// Index of the inverter in inv_devices.
+		char 				wake;			// 1 for a wake request, whose response is not decoded.
+		int 				attempts;		// Retries made so far.
+		struct READ_SPAN 	span;			// Registers requested.
+	};
+
+	// Serial Port (a serial port, and the state of its transactions)
+	struct SERIAL_PORT {
+		char 					*dev_name;		// Serial Port Device Name.
+		int 					fd;				// Serial Port file descriptor.
+		int 					baud_rate;		// Baud rate the port is set to (termios, eg B9600; 0 until set, for sp_baud_rate).
+		struct ENGINE_HANDLER 	io;				// Handler for serial port events.
+		struct ENGINE_HANDLER 	timer;			// Handler for the transaction deadline(timerfd).
+		struct FRAME_ASSEMBLER 	fa;				// Receive frame assembler.
+		int 					state;			// PORT_IDLE, PORT_WRITING, PORT_READING or PORT_BACKOFF.
+		struct TRANSACTION 		txns[PORT_MAX_TRANSACTIONS];
+		int 					txn_count;		// Number of transactions this poll.
+		int 					txn;			// Index of the transaction in progress.
+		int 					retries;		// Retries made this poll.
+		unsigned char 			tx[REQUEST_LENGTH];
+		int 					tx_pos;			// Bytes of the request written.
+		unsigned char 			rx[FRAME_MAX_DATA+7];
+		int 					rx_len;			// Expected response length.
+		char 					waiting;		// 1 until the first response byte arrives.
+		long 					sent_at;		// Time the request was written (in milliseconds).
+		long 					start_usec;		// Time the transaction started (in microseconds).
+		long 					sent_usec;		// Time the request was written (in microseconds).
+		long 					first_usec;		// Time the first response byte arrived (in microseconds, 0 until then).
+	};
+
+	// Engine Statistics (counters kept by the epoll engine since it started)
+	struct ENGINE_STATS {
+		long 	wakeups;			// Calls to epoll_wait() that returned.
+		long 	transactions;		// Transactions completed.
+		long 	failures;			// Transactions without a valid response.
+		long 	retries;			// Failed transactions attempted again.
+		long 	bytes_tx;			// Bytes written to the serial ports.
+		long 	bytes_rx;			// Bytes read from the serial ports.
+		long 	durations[ENGINE_DURATION_BUCKETS+1];	// Transactions answered, by duration(see engine_duration_bounds, the last beyond every bound).
+		long 	duration_usec;		// Total duration of the transactions answered (in microseconds).
+	};
+
+	// Resolved Address (a socket address of a host)
+	struct HOST_ADDRESS {
+		struct sockaddr_storage addr;
+		socklen_t 				len;
+	};
+
+	// Resolver Cache Entry (the addresses of a host name, looked up in the background)
+	struct RESOLVER_ENTRY {
+		char 				*host;			// Host name, or NULL if the entry is unused.
+		int 				port;			// TCP port.
+		struct HOST_ADDRESS addrs[RESOLVE_MAX_ADDRS];
+		int 				addr_count;		// Addresses from the last successful lookup(kept after a failed one).
+		time_t 				expires_at;		// Time the addresses are looked up again.
+		int 				resolving;		// 1 while a lookup is running.
+		long 				started_at;		// Time the running lookup started (in milliseconds).
 	};
 
-	// Read Request
-	struct READ_REQ {
-		int 	data_length;	// Length of the request.
-		char 	*data;			// The read request.
+	// HTTP Connection (a keep-alive connection to one web server, reused by successive requests)
+	struct HTTP_CONNECTION {
+		char 	*host;				// Host name.
+		int 	port;				// TCP port.
+		int 	fd;					// Socket, or -1 while not connected.
+		time_t 	used_at;			// Time the last response was received.
+		int 	status;				// Status code of the last response.
+		char 	response[HTTP_RESPONSE_SIZE+1];	// Last response(status line and headers, then the body).
+		int 	header_len;			// Length of the status line and headers, including the blank line.
+		char 	*body;				// Body of the last response(within response, null-terminated).
+		int 	body_len;			// Length of the body kept.
+		long 	connects;			// Connections opened.
+		long 	requests;			// Requests answered.
+	};
+
+	// PVOutput Status (the values of one status, as queued for upload and stored in the spool)
+	struct PVO_STATUS {
+		char 	date[STRING_SIZE];	// Date(YYYYMMDD).
+		char 	time[STRING_SIZE];	// Time(HH:MM).
+		long 	energy;				// Lifetime energy(in Wh).
+		int 	power;				// AC power(in W).
+		double 	voltage;			// AC voltage(in V).
+	};
+
+	// Upload Queue (statuses passed from the polling thread to the upload thread). Only the polling
+	// thread moves tail, and only the upload thread moves head, except that the polling thread
+	// moves head past the oldest status to drop it, so each side claims head with compare-and-swap.
+	struct UPLOAD_QUEUE {
+		struct PVO_STATUS 		items[UPLOAD_QUEUE_SIZE];
+		volatile unsigned int 	head;			// Count of statuses taken(or dropped).
+		volatile unsigned int 	tail;			// Count of statuses queued.
+		volatile int 			spilling;		// 1 while new statuses go to the spill file.
+		pthread_mutex_t 		spill_lock;		// Guards the spill file.
+		int 					wake_fd[2];		// Pipe written to wake the upload thread.
+		long 					dropped;		// Statuses dropped as the queue was full.
+		long 					spilled;		// Statuses written to the spill file.
+	};
+
+	// Upload Schedule (when the upload thread may next send a request). Requests are taken from a
+	// token bucket refilled at PVOutput's rate limit, and corrected by the limit, remaining requests
+	// and reset time PVOutput reports with each response.
+	struct UPLOAD_SCHEDULE {
+		double 	tokens;				// Requests that may be sent now.
+		int 	limit;				// Requests allowed per PVOUTPUT_RATE_WINDOW_SEC.
+		int 	remaining;			// Requests left before the reset, as last reported(-1 if unknown).
+		long 	reset_at;			// Time the rate limit resets, as last reported (in milliseconds, 0 if unknown).
+		long 	refilled_at;		// Time the tokens were last topped up (in milliseconds).
+		long 	sent_at;			// Time the last request was sent (in milliseconds).
+		long 	retry_at;			// Time before which no request is sent after a failure (in milliseconds).
+		int 	failures;			// Consecutive failed requests.
+	};
+
+	// Published Sample (one sample, serialised once as an InfluxDB line for every sink). The polling
+	// thread makes seq odd while it writes the record, so a sink copying it can tell whether it was
+	// overwritten meanwhile.
+	struct PUBLISH_RECORD {
+		volatile unsigned int 	seq;			// Sample number times two(plus one while being written).
+		char 					key[PUBLISH_KEY_LENGTH];	// Serial port and address of the inverter(eg "ttyUSB0/45").
+		int 					len;			// Length of the line(including its newline).
+		char 					line[PUBLISH_RECORD_SIZE];
+	};
+
+	// Publish Ring (the latest samples, written by the polling thread and read by every sink at its own pace)
+	struct PUBLISH_RING {
+		struct PUBLISH_RECORD 	records[PUBLISH_RING_SIZE];
+		volatile unsigned int 	head;			// Count of samples published.
+	};
+
+	// Sink (a consumer of the published samples, with its own thread, batch and failure backoff)
+	struct SINK {
+		int 					type;			// SINK_*.
+		char 					*name;			// Name used in messages.
+		char 					*target;		// MQTT topic prefix, or InfluxDB database.
+		struct HTTP_CONNECTION 	conn;			// Host, port and socket(kept open between sends).
+		int 					(*send)(struct SINK *);		// Sends the batch(1 on success, 0 if it was rejected, -1 to try again).
+		pthread_t 				thread;
+		int 					wake_fd[2];		// Pipe written to wake the sink's thread.
+		unsigned int 			next;			// Next sample to read from the ring.
+		char 					batch[PUBLISH_RECORD_SIZE * PUBLISH_BATCH_RECORDS];	// Lines waiting to be sent.
+		int 					batch_len;
+		int 					batch_count;	// Samples in the batch.
+		int 					offsets[PUBLISH_BATCH_RECORDS];	// Start of each sample's line in the batch.
+		char 					keys[PUBLISH_BATCH_RECORDS][PUBLISH_KEY_LENGTH];	// Key of each sample in the batch.
+		long 					retry_at;		// Time before which the batch is not sent again (in milliseconds).
+		int 					failures;		// Consecutive failed sends.
+		long 					sent;			// Samples sent.
+		long 					dropped;		// Samples lost, as the sink fell too far behind(or rejected them).
+	};
+
+	// Metrics Page (the metrics as of the latest poll, rendered once and sent to every scraper)
+	struct METRICS_PAGE {
+		char 	text[METRICS_PAGE_SIZE];
+		int 	len;
+		int 	readers;			// Scrapers still being sent the page(it is not rendered over until they finish).
+	};
+
+	// Metrics Client (a scraper's connection, and how much of the response it was sent)
+	struct METRICS_CLIENT {
+		struct ENGINE_HANDLER 	h;				// Handler for the connection(fd is -1 while the slot is free).
+		char 					request[METRICS_REQUEST_SIZE];
+		int 					request_len;
+		char 					header[METRICS_HEADER_SIZE];	// Status line and headers(and the body of an error response).
+		int 					header_len;		// Length of the header, 0 until the request has been read.
+		struct METRICS_PAGE 	*page;			// Page sent after the header(NULL for an error response).
+		int 					sent;			// Bytes of the header and page sent.
+		long 					opened_at;		// Time the connection was accepted (in milliseconds).
 	};
 
 	// Date and Time
@@ -150,18 +449,49 @@
 		char date[STRING_SIZE];
 	};
 
-	// Inverter Info Structure
+	// Inverter Info Structure (each structure only holds values while its INFO_* flag is set in valid,
+	// and holds values of an earlier poll while its flag is also set in stale, that is while any of
+	// the register blocks it is read from is set in stale_blocks)
 	struct INVERTER_INFO {
-		struct INV_TRIP_SETTINGS_1 *its1;
-		struct INV_TRIP_SETTINGS_2 *its2;
-		struct INV_DEVICE_SETTINGS *ids;
-		struct INV_TOTAL_VALUES *itv;
-		struct INV_DEVICE_VALUES *idv;
-		struct INV_CUR_STATE *ics;
-		struct INV_CUR_VALUES *icv;
+		unsigned int valid;
+		unsigned int stale;
+		unsigned int stale_blocks;	// Blocks(one bit per block index) last read by an earlier poll, or not at all.
+		struct INV_TRIP_SETTINGS_1 its1;
+		struct INV_TRIP_SETTINGS_2 its2;
+		struct INV_DEVICE_SETTINGS ids;
+		struct INV_TOTAL_VALUES itv;
+		struct INV_DEVICE_VALUES idv;
+		struct INV_CUR_STATE ics;
+		struct INV_CUR_VALUES icv;
 		struct DATETIME dt;
 	};
 
+	// Inverter (a device on the serial bus, and its polling state)
+	struct INVERTER {
+		int 					port;			// Index of the serial port in sp_ports.
+		int 					address;		// Inverter Address.
+		char 					awake;			// 1 once the inverter's serial interface was woken.
+		struct INVERTER_INFO 	ii;				// Blocks read in the latest poll, and the cached static blocks.
+		int 					fail_count;		// Number of consecutive failed polls.
+		long 					polls;			// Number of polls.
+		long 					failures;		// Number of failed polls.
+		long 					srtt;			// Smoothed turnaround latency (in milliseconds, scaled by 8).
+		long 					rttvar;			// Turnaround latency variation (in milliseconds, scaled by 4).
+		long 					rto;			// Turnaround allowance for the next request (in milliseconds).
+		long 					latency;		// Latest turnaround latency (in milliseconds).
+		long 					latency_samples;	// Number of turnaround latencies measured.
+		int 					skip_polls;		// Polls left to skip before probing a silent inverter again.
+		int 					dead_backoff;	// Polls skipped between probes of a silent inverter.
+		char 					silent;			// 1 once a request timed out without a response this poll.
+		char 					skipped;		// 1 if the inverter was not polled this poll.
+		struct REQUEST_FRAME 	requests[INV_MAX_REQUESTS];	// Request frames built for the inverter.
+		int 					request_count;	// Number of request frames built.
+		unsigned int 			blocks;			// Blocks requested this poll (one bit per block index).
+		long 					read_at[INV_MAX_BLOCKS];	// Time each block was last read (in milliseconds).
+		time_t 					static_read_at;	// Time the static blocks were last read (0 if not cached).
+		char 					sn[LINE_LENGTH];	// Serial number the static blocks belong to.
+	};
+
 	// Required for "check for failures".
 	extern int 		get_current_hour();
 	extern void 	reboot_device();
@@ -174,11 +504,21 @@
 
 	// General function.
 	extern void 	print_inverter_data(struct INVERTER_INFO *);
+	extern int 		add_serial_port(char *);
+	extern int 		add_inverter(int, int);
+	extern void 	update_inverter_latency(struct INVERTER *, long);
+	extern void 	backoff_inverter_latency(struct INVERTER *);
+	extern void 	update_inverter_backoff(struct INVERTER *, int);
+	extern int 		has_current_sample(struct INVERTER_INFO *);
+	extern void 	aggregate_inverter_info(struct INVERTER *, int, struct INVERTER_INFO *);
 	extern void		isleep(long);
+	extern long		get_time_msec();
+	extern long		get_time_usec();
+	extern long		get_backoff_msec(int, long, long);
+	extern void		block_stop_signals(sigset_t *);
 
 	// Cleanup functions.
-	extern void cleanup_read_req(struct READ_REQ *);
-	extern void cleanup_read_req_response(struct READ_REQ_RESPONSE *);
+	extern void cleanup_inverter_info(struct INVERTER_INFO *);
 
 	/*
 	 * Global Variables
@@ -189,22 +529,44 @@
 
 	// Serial Port Settings
 	extern int sp_baud_rate;		// Serial Port Baud Rate
-	extern char *sp_dev_name;		// Serial Port Device Name
+	extern struct SERIAL_PORT sp_ports[];	// Serial ports polled
+	extern int sp_count;			// Number of serial ports
+	extern int sp_timeout_msec;		// Time allowed for the first response byte (in milliseconds)
+	extern int sp_auto_baud;		// Switch the serial ports and inverters to the fastest baud rate
 
 	// Inverter Settings
 	extern int inv_address;			// Inverter Address
+	extern struct INVERTER inv_devices[];	// Inverters polled, on all serial ports
+	extern int inv_count;			// Number of inverters polled
+	extern int inv_max_registers;	// Largest register block requested in one read
 	extern int inv_look_for_addr;	// Look for Inverter Address
+	extern int inv_look_for_count;	// Stop looking after this many inverters are found (0 = scan all)
 	extern int inv_get_data;		// Get data from inverter.
 
+	// Daemon Settings
+	extern int dmn_flag;			// Run as a long-running poller
+	extern int dmn_interval;		// Polling interval (in seconds)
+
 	// PVOutput Settings
 	extern int pvo_send_to;			// Send To PVOutput flag
 	extern char *pvo_api_key;		// PVOutput API Key
 	extern char *pvo_sys_id;		// PVOutput System ID
+	extern struct HTTP_CONNECTION pvo_conn;	// Connection to PVOutput(host and port may be overridden)
+	extern char *pvo_spool_file;	// File to store the statuses not yet uploaded
+	extern int pvo_overflow;		// What happens to statuses while the upload queue is full(UPLOAD_DROP_OLDEST or UPLOAD_SPILL)
+
+	// Publishing Settings
+	extern struct SINK pub_sinks[];	// Sinks the samples are published to
+	extern int pub_sink_count;		// Number of sinks
+
+	// Metrics Settings
+	extern char *met_listen;		// Address and port the metrics are served on([address:]port, NULL when off)
 
 	// Restart on failure Settings
 	extern int rof_flag;			// Restart on failure flag
 	extern int rof_max_failures;	// Maximum failures for restart
 	extern int rof_start_hour;		// Start hour for monitoring failures
 	extern int rof_stop_hour;		// Stop hour for monitoring failures
+	extern int rof_fail_count;		// Communication failure count, as last read or written
 
 #endif
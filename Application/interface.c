@@ -13,430 +13,590 @@
 
 /**
 	Performs a serial read/write request.
+
+	Returns: 1 if a response frame was received, -1 otherwise.
 */
-void perform_request(int sp, char *strAction, struct READ_REQ *rr, char *response, int *response_length)
+int perform_request(int sp, char *strAction, unsigned char *request, char *response, int *response_length)
 {
 	if (verbose) printf("Performing %s.\n", strAction);
-	write_sp_command(sp, rr->data, rr->data_length, strAction);
-	read_sp_response(sp, response, response_length, strAction);
+	flush_sp_input(sp, request[1], request[2]);
+	write_sp_command(sp, (char *) request, REQUEST_LENGTH, strAction);
+	return read_sp_response(sp, response, response_length, strAction);
 }
 
 /**
 	Interprets the serial read request.
+
+	Inputs: The inverter address, the response, its length, and the result to fill.
+	Returns: 1 if the response is valid, -1 otherwise.
 */
-struct READ_REQ_RESPONSE *process_response(char address, struct READ_REQ *rr, char *response, int response_len)
+int process_response(char address, char *response, int response_len, struct READ_REQ_RESPONSE *rrr)
 {
-	struct READ_REQ_RESPONSE *rrr;
-
-	// Free request.
-	cleanup_read_req(rr);
-
-	// Process response.
-	rrr = read_response_header(address, response, response_len);
-	if (rrr->success != 1) {
+	if (read_response_header(address, (unsigned char *) response, response_len, rrr) != 1) {
 		if (verbose) fprintf(stderr, "The header was invalid(%d)\n", rrr->success);
-		cleanup_read_req_response(rrr);
-		return NULL;
+		return -1;
 	}
 
-	return rrr;
+	return 1;
 }
 
 /**
-	Reads the Trip Settings #1.
+	Checks whether an inverter answers on an address, using the short scan request.
+
+	Returns: 1 if a valid response was received, -1 otherwise.
 */
-struct INV_TRIP_SETTINGS_1 *read_trip_settings1(char address, int sp)
+int scan_inverter(char address, int sp)
 {
-	struct INV_TRIP_SETTINGS_1 	*its1;
-	struct READ_REQ 			*rr;
-	struct READ_REQ_RESPONSE 	*rrr;
-
-	char response[10*2+7];
-	int response_len = 10*2+7;
+	struct READ_REQ_RESPONSE rrr;
+	unsigned char request[REQUEST_LENGTH];
+	char response[2*2+7];
+	int response_len = 2*2+7;
 
-	its1 = malloc(sizeof(struct INV_TRIP_SETTINGS_1));
-	if (its1 == NULL) return NULL;
+	// Perform Scan Request.
+	build_scan_request(request, address);
+	if (perform_request(sp, "Scan", request, response, &response_len) != 1) return -1;
 
-	// Generate Inverter Trip Settings Request.
-	rr = generate_read_request(address, 0x01, 10);
-	if (rr == NULL) {
-		free(its1);
-		return NULL;
-	}
+	// Process the read request response.
+	return process_response(address, response, response_len, &rrr);
+}
 
-	// Perform Serial Port Initialisation.
-	perform_request(sp, "Serial Port Initialisation", rr, (char *) &response, &response_len);
-	perform_request(sp, "Inverter Trip Settings", rr, (char *) &response, &response_len);
+/**
+	Writes one register of an inverter, and checks the inverter acknowledged it.
 
-	// Process the read request response.
-	rrr = process_response(address, rr, response, response_len);
-	if (rrr == NULL) {
-		free(its1);
-		return NULL;
+	Inputs: The inverter address, the serial port, the register, and the value.
+	Returns: 1 if the write was acknowledged, -1 otherwise.
+*/
+int write_register(char address, int sp, int reg, int value)
+{
+	unsigned char request[REQUEST_LENGTH];
+	char response[REQUEST_LENGTH];
+	int response_len = REQUEST_LENGTH;
+	char strDesc[BUFSIZ];
+
+	sprintf(strDesc, "Write Register 0x%02X", reg);
+	build_write_request(request, address, reg, value);
+	if (perform_request(sp, strDesc, request, response, &response_len) != 1) return -1;
+
+	// The framing and CRC were validated as the bytes arrived, and the echo must match the request.
+	if ((response_len != REQUEST_LENGTH) || (memcmp(response, request, REQUEST_LENGTH) != 0)) {
+		if (verbose) fprintf(stderr, "The inverter at address %d did not acknowledge the write.\n", address);
+		return -1;
 	}
 
-	// Designate data into its variable.
-	its1->FacH_Trip = convert_c2v(rrr->data[0], rrr->data[1]);
-	its1->FacH_Cycle = convert_c2v(rrr->data[2], rrr->data[3]);
-	its1->FacL_Trip = convert_c2v(rrr->data[4], rrr->data[5]);
-	its1->FacL_Cycle = convert_c2v(rrr->data[6], rrr->data[7]);
-	its1->VacH_Trip = convert_c2v(rrr->data[8], rrr->data[9]);
-	its1->VacH_Cycle = convert_c2v(rrr->data[10], rrr->data[11]);
-	its1->VacL_Trip = convert_c2v(rrr->data[12], rrr->data[13]);
-	its1->VacL_Cycle = convert_c2v(rrr->data[14], rrr->data[15]);
-	its1->Delta_Zac_Trip = convert_c2v(rrr->data[16], rrr->data[17]);
-	its1->Zac_Trip = convert_c2v(rrr->data[18], rrr->data[19]);
-
-	// Free memory.
-	cleanup_read_req_response(rrr);
-
-	return its1;
+	return 1;
 }
 
+/*
+ * Baud rates the inverters support, slowest first, indexed by the value of their Baudrate
+ * register(INV_BAUD_REGISTER). The values are assumed: the register reads 0 at the 9600bps
+ * default, and 19200bps is the only other rate the application drives the line at.
+ */
+int inv_baud_rates[] = {B9600, B19200};
+
+#define INV_BAUD_COUNT		((int) (sizeof(inv_baud_rates) / sizeof(int)))
+
 /**
-	Reads the Trip Settings #2.
+	Gets the Baudrate register value for a baud rate.
+
+	Inputs: The termios baud rate.
+	Returns: The register value, or -1 if the inverters do not support the rate.
 */
-struct INV_TRIP_SETTINGS_2 *read_trip_settings2(char address, int sp)
+int get_baud_code(int baud_rate)
 {
-	struct INV_TRIP_SETTINGS_2 	*its2;
-	struct READ_REQ 		*rr;
-	struct READ_REQ_RESPONSE 	*rrr;
-
-	char response[7*2+7];
-	int response_len = 7*2+7;
-
-	its2 = malloc(sizeof(struct INV_TRIP_SETTINGS_2));
-	if (its2 == NULL) return NULL;
+	int i;
 
-	// Generate Inverter Trip Settings Request.
-	rr = generate_read_request(address, 0x0B, 7);
-	if (rr == NULL) {
-		free(its2);
-		return NULL;
+	for (i=0; i<INV_BAUD_COUNT; i++) {
+		if (inv_baud_rates[i] == baud_rate) return i;
 	}
 
-	// Perform Request for ITS#2.
-	perform_request(sp, "Inverter Trip Settings #2", rr, (char *) &response, &response_len);
+	return -1;
+}
 
-	// Process the read request response.
-	rrr = process_response(address, rr, response, response_len);
-	if (rrr == NULL) {
-		free(its2);
-		return NULL;
-	}
+/**
+	Counts the inverters on a serial port answering at the port's baud rate. Each inverter
+	is sent up to SP_BAUD_VERIFY_TRIES scan requests, as the first request after the line
+	changes is not reliably answered.
 
-	// Designate data into its variable.
-	its2->FastIEarth_Trip = convert_c2v(rrr->data[0], rrr->data[1]);
-	its2->SlowIEarth_Trip = convert_c2v(rrr->data[2], rrr->data[3]);
-	its2->Riso_Trip = convert_c2v(rrr->data[4], rrr->data[5]);
-	its2->Vpv_Trip = convert_c2v(rrr->data[6], rrr->data[7]);
-	its2->OnGrid_Delay = convert_c2v(rrr->data[8], rrr->data[9]);
-	its2->VacH_Limit = convert_c2v(rrr->data[10], rrr->data[11]);
-	its2->VacH_Limit_Cycle = convert_c2v(rrr->data[12], rrr->data[13]);
+	Inputs: The index of the serial port.
+	Returns: The number of inverters that answered.
+*/
+int count_port_answers(int port)
+{
+	int answered;
+	int i, j;
 
-	// Free memory.
-	cleanup_read_req_response(rrr);
+	answered = 0;
+	for (i=0; i<inv_count; i++) {
+		if (inv_devices[i].port != port) continue;
+		for (j=0; j<SP_BAUD_VERIFY_TRIES; j++) {
+			if (scan_inverter(inv_devices[i].address, sp_ports[port].fd) == 1) {
+				answered++;
+				break;
+			}
+		}
+	}
 
-	return its2;
+	return answered;
 }
 
 /**
-	Reads the device settings.
+	Switches a serial port to a baud rate, and has its inverters woken again before their
+	next poll.
+
+	Inputs: The index of the serial port, and the termios baud rate.
+	Returns: 1 on success, -1 otherwise.
 */
-struct INV_DEVICE_SETTINGS *read_device_settings(char address, int sp)
+int switch_port_baud(int port, int baud_rate)
 {
-	struct INV_DEVICE_SETTINGS 	*ids;
-	struct READ_REQ 		*rr;
-	struct READ_REQ_RESPONSE 	*rrr;
-
-	char response[4*2+7];
-	int response_len = 4*2+7;
-
-	ids = malloc(sizeof(struct INV_DEVICE_SETTINGS));
-	if (ids == NULL) return NULL;
+	int i;
 
-	// Generate Inverter Device Settings Request.
-	rr = generate_read_request(address, 0x12, 4);
-	if (rr == NULL) {
-		free(ids);
-		return NULL;
+	for (i=0; i<inv_count; i++) {
+		if (inv_devices[i].port == port) inv_devices[i].awake = 0;
 	}
 
-	// Perform Request for IDS.
-	perform_request(sp, "Inverter Device Settings", rr, (char *) &response, &response_len);
+	return set_port_baud(port, baud_rate);
+}
 
-	// Process the read request response.
-	rrr = process_response(address, rr, response, response_len);
-	if (rrr == NULL) {
-		free(ids);
-		return NULL;
-	}
+/**
+	Finds the baud rate the inverters on a serial port answer at, starting with the port's
+	current rate.
 
-	// Designate data into its variable.
-	ids->Type_No = convert_c2v(rrr->data[0], rrr->data[1]);
-	ids->Address = convert_c2v(rrr->data[2], rrr->data[3]);
-	ids->Baudrate = convert_c2v(rrr->data[4], rrr->data[5]);
-	ids->Language = convert_c2v(rrr->data[6], rrr->data[7]);
+	Inputs: The index of the serial port.
+	Returns: The termios baud rate, or -1 if no inverter answered at any rate(the port is
+			left at its current rate).
+*/
+int probe_port_baud(int port)
+{
+	int current;
+	int i;
+
+	current = get_port_baud(sp_ports[port].fd);
+	if (count_port_answers(port) > 0) return current;
 
-	// Free memory.
-	cleanup_read_req_response(rrr);
+	for (i=INV_BAUD_COUNT-1; i>=0; i--) {
+		if (inv_baud_rates[i] == current) continue;
+		if (switch_port_baud(port, inv_baud_rates[i]) != 1) break;
+		if (count_port_answers(port) > 0) {
+			printf("The inverters on %s answer at %dbps.\n", sp_ports[port].dev_name, get_baud_bps(inv_baud_rates[i]));
+			return inv_baud_rates[i];
+		}
+	}
 
-	return ids;
+	switch_port_baud(port, current);
+	return -1;
 }
 
 /**
-	Reads the Total Values.
+	Switches a serial port, and the inverters on it, to the fastest baud rate they support.
+	The rate the inverters answer at is probed first. As the inverters share the line, each
+	must answer before any is told to change rate. The port then follows, and the inverters
+	are checked at the new rate. If any does not answer, the ones that do are switched back
+	and the port returns to the old rate(probing again if they have all gone silent).
+
+	Inputs: The index of the serial port.
+	Returns: The termios baud rate the port is left at, or -1 if no inverter answered.
 */
-struct INV_TOTAL_VALUES *read_total_values(char address, int sp)
+int negotiate_port_baud(int port)
 {
-	struct INV_TOTAL_VALUES 	*itv;
-	struct READ_REQ 			*rr;
-	struct READ_REQ_RESPONSE 	*rrr;
-
-	char response[15*2+7];
-	int response_len = 15*2+7;
+	int sp = sp_ports[port].fd;
+	int old_rate, new_rate;
+	int total;
 	int i;
 
-	itv = malloc(sizeof(struct INV_TOTAL_VALUES));
-	if (itv == NULL) return NULL;
+	old_rate = probe_port_baud(port);
+	if (old_rate < 0) {
+		fprintf(stderr, "No inverter answered on %s at any baud rate.\n", sp_ports[port].dev_name);
+		return -1;
+	}
 
-	// Generate Inverter Total Values Request.
-	rr = generate_read_request(address, 0x19, 15);
-	if (rr == NULL) {
-		free(itv);
-		return NULL;
+	new_rate = inv_baud_rates[INV_BAUD_COUNT-1];
+	if ((old_rate == new_rate) || (get_baud_code(old_rate) < 0)) return old_rate;
+
+	total = 0;
+	for (i=0; i<inv_count; i++) {
+		if (inv_devices[i].port == port) total++;
+	}
+	if (count_port_answers(port) != total) {
+		fprintf(stderr, "Not every inverter on %s answers at %dbps, so the baud rate is left unchanged.\n", sp_ports[port].dev_name, get_baud_bps(old_rate));
+		return old_rate;
 	}
 
-	// Perform Inverter Total Values request.
-	perform_request(sp, "Inverter Total Values", rr, (char *) &response, &response_len);
+	// Tell each inverter to change rate, then follow them. An acknowledgement(sent at the old
+	// rate) may be lost even though the inverter changed, so answering at the new rate decides.
+	for (i=0; i<inv_count; i++) {
+		if (inv_devices[i].port != port) continue;
+		if ((write_register(inv_devices[i].address, sp, INV_BAUD_REGISTER, get_baud_code(new_rate)) != 1) && (verbose)) {
+			fprintf(stderr, "The inverter at address %d did not acknowledge the new baud rate.\n", inv_devices[i].address);
+		}
+	}
+	isleep(SP_BAUD_SETTLE_MSEC * 1000L);
 
-	// Process the read request response.
-	rrr = process_response(address, rr, response, response_len);
-	if (rrr == NULL) {
-		free(itv);
-		return NULL;
+	if ((switch_port_baud(port, new_rate) == 1) && (count_port_answers(port) == total)) {
+		printf("Switched %s and its %d inverter(s) from %dbps to %dbps.\n", sp_ports[port].dev_name, total, get_baud_bps(old_rate), get_baud_bps(new_rate));
+		return new_rate;
 	}
 
-	// Designate data into its variable.
-	itv->BridgeRelay_On_Num = convert_c2v(rrr->data[0], rrr->data[1]);
-	itv->BridgeRelay_On_Num = (itv->BridgeRelay_On_Num << 8) + convert_c2v(rrr->data[2], rrr->data[3]);
-	itv->Time_Hr_Cnt = convert_c2v(rrr->data[4], rrr->data[5]);
-	itv->Time_Min_Cnt = convert_c2v(rrr->data[6], rrr->data[7]);
-	itv->Time_Sec_Cnt = convert_c2v(rrr->data[8], rrr->data[9]);
-	itv->Eac = convert_c2v(rrr->data[10], rrr->data[11]);
-	itv->Eac = (((double) itv->Eac) * 1000) + (((double)convert_c2v(rrr->data[12], rrr->data[13])) * 0.1);
-	for (i=0; i<3; i++) {
-		itv->Epv[i] = convert_c2v(rrr->data[16+i*6], rrr->data[17+i*6]);
-		itv->Epv[i] = (((double) itv->Epv[i])*1000) + (((double) convert_c2v(rrr->data[18+i*6], rrr->data[19+i*6]))*0.1);
+	// Fall back: switch back the inverters that did change, and return to the old rate.
+	fprintf(stderr, "Not every inverter on %s answered at %dbps, returning to %dbps.\n", sp_ports[port].dev_name, get_baud_bps(new_rate), get_baud_bps(old_rate));
+	for (i=0; i<inv_count; i++) {
+		if (inv_devices[i].port == port) write_register(inv_devices[i].address, sp, INV_BAUD_REGISTER, get_baud_code(old_rate));
 	}
+	isleep(SP_BAUD_SETTLE_MSEC * 1000L);
+	switch_port_baud(port, old_rate);
+	if (count_port_answers(port) > 0) return old_rate;
+
+	return probe_port_baud(port);
+}
+
+/*
+ * Register blocks read for the Inverter Info, in register order. Adjacent blocks are
+ * coalesced into as few read requests as the inverter accepts.
+ */
+struct READ_BLOCK inv_blocks[INV_BLOCK_COUNT] = {
+	{0x01, 10, "Inverter Trip Settings", offsetof(struct INVERTER_INFO, its1), sizeof(struct INV_TRIP_SETTINGS_1), INFO_ITS1, 0, 1, INV_STATIC_REFRESH_SEC, REG_FIELDS(reg_its1)},
+	{0x0B, 7, "Inverter Trip Settings #2", offsetof(struct INVERTER_INFO, its2), sizeof(struct INV_TRIP_SETTINGS_2), INFO_ITS2, 0, 1, INV_STATIC_REFRESH_SEC, REG_FIELDS(reg_its2)},
+	{0x12, 4, "Inverter Device Settings", offsetof(struct INVERTER_INFO, ids), sizeof(struct INV_DEVICE_SETTINGS), INFO_IDS, 0, 1, INV_STATIC_REFRESH_SEC, REG_FIELDS(reg_ids)},
+	{0x19, 16, "Inverter Total Values", offsetof(struct INVERTER_INFO, itv), sizeof(struct INV_TOTAL_VALUES), INFO_ITV, 0, 0, INV_PERIOD_TOTALS, REG_FIELDS(reg_itv)},
+	{0x67, STRING_REGISTERS, "Brand Name", offsetof(struct INVERTER_INFO, idv), sizeof(struct INV_DEVICE_VALUES), INFO_IDV, 0, 1, INV_STATIC_REFRESH_SEC, REG_FIELDS(reg_idv)},
+	{0x6F, STRING_REGISTERS, "Type Name", offsetof(struct INVERTER_INFO, idv), sizeof(struct INV_DEVICE_VALUES), INFO_IDV, 0, 1, INV_STATIC_REFRESH_SEC, REG_FIELDS(reg_idv)},
+	{0x77, STRING_REGISTERS, "SN Name", offsetof(struct INVERTER_INFO, idv), sizeof(struct INV_DEVICE_VALUES), INFO_IDV, 0, 1, INV_STATIC_REFRESH_SEC, REG_FIELDS(reg_idv)},
+	{0xB5, 5, "Inverter Current State", offsetof(struct INVERTER_INFO, ics), sizeof(struct INV_CUR_STATE), INFO_ICS, 0, 0, INV_PERIOD_CURRENT, REG_FIELDS(reg_ics)},
+	{0xBA, 15, "Current Inverter Values", offsetof(struct INVERTER_INFO, icv), sizeof(struct INV_CUR_VALUES), INFO_ICV, 0, 0, INV_PERIOD_CURRENT, REG_FIELDS(reg_icv)},
+	{0xCC, 3, "Current Inverter Values (Extended)", offsetof(struct INVERTER_INFO, icv), sizeof(struct INV_CUR_VALUES), INFO_ICV, 1, 0, INV_PERIOD_CURRENT, REG_FIELDS(reg_icv)}
+};
+
+/**
+	Finds the register block starting at a register.
+
+	Inputs: The first register.
+	Returns: The block, or NULL if there is none.
+*/
+struct READ_BLOCK *get_block(int start)
+{
+	int i;
 
-	// Free memory.
-	cleanup_read_req_response(rrr);
+	for (i=0; i<INV_BLOCK_COUNT; i++) {
+		if (inv_blocks[i].start == start) return &inv_blocks[i];
+	}
 
-	return itv;
+	return NULL;
 }
 
 /**
-	Reads a string value.
+	Reads a register block, and decodes it into the caller's structure. The request and
+	response are built and received on the stack.
+
+	Inputs: The inverter address, the serial port, the block, and the structure to decode into.
+	Returns: 1 on success, -1 otherwise.
 */
-char *read_string(char address, int sp, char ser_address, char ser_len, char *strDesc)
+int read_block(char address, int sp, struct READ_BLOCK *blk, void *out)
 {
-	char *strOut;
-	struct READ_REQ 			*rr;
-	struct READ_REQ_RESPONSE 	*rrr;
-	int i, j;
+	struct READ_REQ_RESPONSE rrr;
+	unsigned char request[REQUEST_LENGTH];
+	char response[FRAME_MAX_DATA+7];
+	int response_len;
 
-	// Check that the string length is less than 15.
-	if (ser_len > 15) ser_len = 15;
-	else if (ser_len < 0) return NULL;
+	if ((blk == NULL) || (blk->length * 2 > FRAME_MAX_DATA)) return -1;
+	response_len = (blk->length * 2) + 7;
 
-	char response[37];
-	int response_len = (ser_len * 2) + 7;
+	// Perform the request, and decode the response in place.
+	build_read_request(request, address, blk->start, blk->length);
+	if (perform_request(sp, blk->name, request, response, &response_len) != 1) return -1;
+	if (process_response(address, response, response_len, &rrr) != 1) return -1;
+	if (rrr.data_length != blk->length * 2) return -1;
+	decode_fields(blk->fields, blk->field_count, blk->start, blk->length, rrr.data, out);
 
-	strOut = malloc(37);
-	if (strOut == NULL) return NULL;
-	for (i=0; i<37; i++) strOut[i] = 0;
+	return 1;
+}
 
-	// Generate String Request.
-	rr = generate_read_request(address, ser_address, ser_len);
-	if (rr == NULL) {
-		free(strOut);
-		return NULL;
-	}
+/**
+	Reads the Trip Settings #1.
 
-	// Perform String Read.
-	perform_request(sp, strDesc, rr, (char *) &response, &response_len);
+	Returns: 1 on success, -1 otherwise.
+*/
+int read_trip_settings1(char address, int sp, struct INV_TRIP_SETTINGS_1 *its1)
+{
+	return read_block(address, sp, get_block(0x01), its1);
+}
 
-	// Process the read request response.
-	rrr = process_response(address, rr, response, response_len);
-	if (rrr == NULL) {
-		return NULL;
-	}
+/**
+	Reads the Trip Settings #2.
 
-	// Designate data into its variable.
-	j = 0;
-	for (i=0; i<ser_len; i++) {
-		// Filter ASCII alphanumerics.
-		if (((response[i] >= 65) && (response[i] <= 90)) || ((response[i] >= 97) && (response[i] <= 122)) || ((response[i] >= 48) && (response[i] <= 57))) {
-			strOut[j] = response[i];
-			j++;
-		}
-	}
+	Returns: 1 on success, -1 otherwise.
+*/
+int read_trip_settings2(char address, int sp, struct INV_TRIP_SETTINGS_2 *its2)
+{
+	return read_block(address, sp, get_block(0x0B), its2);
+}
 
-	// Free memory.
-	cleanup_read_req_response(rrr);
+/**
+	Reads the Device Settings.
 
-	return strOut;
+	Returns: 1 on success, -1 otherwise.
+*/
+int read_device_settings(char address, int sp, struct INV_DEVICE_SETTINGS *ids)
+{
+	return read_block(address, sp, get_block(0x12), ids);
 }
 
 /**
-	Reads the Device Values.
+	Reads the Total Values.
+
+	Returns: 1 on success, -1 otherwise.
 */
-struct INV_DEVICE_VALUES *read_device_values(char address, int sp)
+int read_total_values(char address, int sp, struct INV_TOTAL_VALUES *itv)
 {
-	struct INV_DEVICE_VALUES *idv;
+	return read_block(address, sp, get_block(0x19), itv);
+}
 
-	// Initialise memory.
-	idv = malloc(sizeof(struct INV_DEVICE_VALUES));
-	if (idv == NULL) return NULL;
+/**
+	Reads the Device Values. A string that could not be read is left empty.
+
+	Returns: 1 if all strings were read, -1 otherwise.
+*/
+int read_device_values(char address, int sp, struct INV_DEVICE_VALUES *idv)
+{
+	int err;
+
+	memset(idv, 0, sizeof(struct INV_DEVICE_VALUES));
 
 	// Read the strings in from memory.
-	idv->Brand_Name = read_string(address, sp, 0x67, 0x0F, "Brand Name");
-	idv->Type_Name = read_string(address, sp, 0x6F, 0x0F, "Type Name");
-	idv->Sn_Name = read_string(address, sp, 0x77, 0x0F, "SN Name");
+	err = 1;
+	if (read_block(address, sp, get_block(0x67), idv) != 1) err = -1;
+	if (read_block(address, sp, get_block(0x6F), idv) != 1) err = -1;
+	if (read_block(address, sp, get_block(0x77), idv) != 1) err = -1;
 
-	return idv;
+	return err;
 }
 
 /**
 	Reads the current state.
+
+	Returns: 1 on success, -1 otherwise.
+*/
+int read_current_state(char address, int sp, struct INV_CUR_STATE *ics)
+{
+	return read_block(address, sp, get_block(0xB5), ics);
+}
+
+/**
+	Reads the current values of the Inverter, and the extended values.
+
+	Returns: 1 on success, -1 otherwise.
 */
-struct INV_CUR_STATE *read_current_state(char address, int sp)
+int read_current_values(char address, int sp, struct INV_CUR_VALUES *icv)
 {
-	struct INV_CUR_STATE 		*ics;
-	struct READ_REQ 			*rr;
-	struct READ_REQ_RESPONSE 	*rrr;
+	if (read_block(address, sp, get_block(0xBA), icv) != 1) return -1;
 
-	char response[5*2+7];
-	int response_len = 5*2+7;
+	// Get the extended values.
+	read_block(address, sp, get_block(0xCC), icv);
+
+	return 1;
+}
+
+
+/**
+	Plans the read requests for a list of register blocks(sorted by start register).
+	Blocks are merged into one span while the gap of unused registers is at most
+	INV_MAX_GAP, and the span stays within the largest block the inverter accepts.
+
+	Inputs: The blocks, the number of blocks, the blocks to read(one bit per block index),
+			and the spans to fill(one per block at most).
+	Returns: The number of spans.
+*/
+int plan_reads(struct READ_BLOCK *blocks, int block_count, unsigned int mask, struct READ_SPAN *spans)
+{
+	struct READ_SPAN *span;
+	int span_count;
+	int end;
 	int i;
 
-	ics = malloc(sizeof(struct INV_CUR_STATE));
-	if (ics == NULL) return NULL;
+	span_count = 0;
+	for (i=0; i<block_count; i++) {
+		if ((mask & (1u << i)) == 0) continue;
+
+		// Extend the current span if the block is close enough, and the span stays small enough.
+		if (span_count > 0) {
+			span = &spans[span_count-1];
+			end = blocks[i].start + blocks[i].length;
+			if (end < span->start + span->length) end = span->start + span->length;
+
+			if (((blocks[i].start - (span->start + span->length)) <= INV_MAX_GAP) && ((end - span->start) <= inv_max_registers)) {
+				span->length = end - span->start;
+				span->count++;
+				span->mask |= (1u << i);
+				continue;
+			}
+		}
 
-	// Generate Inverter Current State Request.
-	rr = generate_read_request(address, 0xB5, 5);
-	if (rr == NULL) {
-		free(ics);
-		return NULL;
+		// Otherwise, start a new span.
+		span = &spans[span_count++];
+		span->start = blocks[i].start;
+		span->length = blocks[i].length;
+		span->first = i;
+		span->count = 1;
+		span->mask = (1u << i);
 	}
 
-	// Perform Request for ICS.
-	perform_request(sp, "Inverter Current State", rr, (char *) &response, &response_len);
+	return span_count;
+}
 
-	// Process the read request response.
-	rrr = process_response(address, rr, response, response_len);
-	if (rrr == NULL) {
-		free(ics);
-		return NULL;
-	}
+/**
+	Selects the register blocks an inverter needs this poll: each block whose period has
+	passed since it was last read, or that is missing. The static blocks(settings and
+	names) are refreshed together, timed from when the cache was filled, so that a cache
+	read by an earlier run is honoured. A block is due up to half a polling interval early,
+	so that a period which is a multiple of the interval does not slip to the next poll.
+
+	Inputs: The inverter.
+	Returns: The blocks to read(one bit per block index).
+*/
+unsigned int get_due_blocks(struct INVERTER *dev)
+{
+	struct READ_BLOCK *blk;
+	unsigned int mask;
+	long now;
+	long slack;
+	int fresh;
+	int i;
 
-	// Designate data into its variable.
-	ics->State = convert_c2v(rrr->data[0], rrr->data[1]);
-	for (i=0; i<4; i++) {
-		ics->Error_Code[i] = convert_c2v(rrr->data[2+(2*i)], rrr->data[3+(2*i)]);
-	}
+	now = get_time_msec();
+	slack = dmn_interval * 500L;
+	fresh = (dev->static_read_at != 0) && ((dev->ii.valid & INFO_STATIC) == INFO_STATIC);
 
-	// Free memory.
-	cleanup_read_req_response(rrr);
+	mask = 0;
+	for (i=0; i<INV_BLOCK_COUNT; i++) {
+		blk = &inv_blocks[i];
+		if (blk->is_static) {
+			if ((!fresh) || (((time(NULL) - dev->static_read_at) * 1000L) >= (blk->period * 1000L - slack))) mask |= (1u << i);
+			continue;
+		}
 
-	return ics;
+		if (((dev->ii.valid & blk->info_flag) == 0) || (dev->read_at[i] == 0) || ((now - dev->read_at[i]) >= (blk->period * 1000L - slack))) mask |= (1u << i);
+	}
+
+	return mask;
 }
 
 /**
-	Reads the extended current values of the Inverter.
+	Records the time the blocks of a span were read.
+
+	Inputs: The inverter, and the span.
 */
-int read_current_values_ext(char address, int sp, struct INV_CUR_VALUES *icv)
+void mark_span_read(struct INVERTER *dev, struct READ_SPAN *span)
 {
-	struct READ_REQ 			*rr;
-	struct READ_REQ_RESPONSE 	*rrr;
+	long now;
+	int i;
 
-	char response[3*2+7];
-	int response_len = 3*2+7;
+	now = get_time_msec();
+	for (i=span->first; i<INV_BLOCK_COUNT; i++) {
+		if (span->mask & (1u << i)) dev->read_at[i] = now;
+	}
+}
 
-	if (icv == NULL) return -1;
+/**
+	Plans the read requests for the register blocks an inverter needs this poll.
 
-	// Generate current values Request.
-	rr = generate_read_request(address, 0xCC, 3);
-	if (rr == NULL) return -2;
+	Inputs: The inverter, and the spans to fill(INV_MAX_SPANS).
+	Returns: The number of spans.
+*/
+int plan_inverter_reads(struct INVERTER *dev, struct READ_SPAN *spans)
+{
+	dev->blocks = get_due_blocks(dev);
+	return plan_reads(inv_blocks, INV_BLOCK_COUNT, dev->blocks, spans);
+}
 
-	// Perform current inverter values readings.
-	perform_request(sp, "Current Inverter Values (Extended)", rr, (char *) &response, &response_len);
+/**
+	Sets the stale flag of each structure that any of its blocks is stale in, so a
+	structure filled by several blocks is only current once every one of them was read.
 
-	// Process the read request response.
-	rrr = process_response(address, rr, response, response_len);
-	if (rrr == NULL) return -3;
+	Inputs: The Inverter Info.
+*/
+void update_stale_flags(struct INVERTER_INFO *ii)
+{
+	int i;
 
-	// Assign data into its variable.
-	icv->Ton_today = ((double)convert_c2v(rrr->data[0], rrr->data[1]) / 2048);
-	icv->Heatsink_Temp = ((double)convert_c2v(rrr->data[4], rrr->data[5])) / 10;
+	ii->stale = 0;
+	for (i=0; i<INV_BLOCK_COUNT; i++) {
+		if (ii->stale_blocks & (1u << i)) ii->stale |= inv_blocks[i].info_flag;
+	}
+}
 
-	// Free memory.
-	cleanup_read_req_response(rrr);
+/**
+	Marks the blocks about to be read again as stale. Their values from the earlier poll
+	are kept, so a block that cannot be read this poll still has its last good values,
+	marked as stale, rather than losing the rest of the sample.
 
-	return 1;
+	Inputs: The Inverter Info, and the blocks(one bit per block index).
+*/
+void mark_blocks_stale(struct INVERTER_INFO *ii, unsigned int mask)
+{
+	ii->stale_blocks |= mask;
+	update_stale_flags(ii);
 }
 
 /**
-	Reads the current values of the Inverter.
+	Records the static blocks read by the latest poll. A new serial number at the
+	inverter's address is reported, as the cached settings belonged to another device.
+
+	Inputs: The inverter.
+	Returns: 1 if the static blocks were refreshed, 0 otherwise.
 */
-struct INV_CUR_VALUES *read_current_values(char address, int sp)
+int update_static_blocks(struct INVERTER *dev)
 {
-	struct INV_CUR_VALUES 		*icv;
-	struct READ_REQ 			*rr;
-	struct READ_REQ_RESPONSE 	*rrr;
-
-	char response[15*2+7];
-	int response_len = 15*2+7;
+	struct INVERTER_INFO *ii = &dev->ii;
 	int i;
 
-	icv = malloc(sizeof(struct INV_CUR_VALUES));
-	if (icv == NULL) return NULL;
+	// Nothing to record unless the static blocks were requested, and all of them arrived.
+	for (i=0; i<INV_BLOCK_COUNT; i++) {
+		if ((inv_blocks[i].is_static) && ((dev->blocks & (1u << i)) == 0)) return 0;
+	}
+	if (((ii->valid & INFO_STATIC) != INFO_STATIC) || (ii->stale & INFO_STATIC)) return 0;
 
-	// Generate current values Request.
-	rr = generate_read_request(address, 0xBA, 15);
-	if (rr == NULL) {
-		free(icv);
-		return NULL;
+	if ((dev->sn[0] != 0) && (strcmp(dev->sn, ii->idv.Sn_Name) != 0)) {
+		printf("The inverter at address %d changed from serial number %s to %s.\n", dev->address, dev->sn, ii->idv.Sn_Name);
 	}
+	snprintf(dev->sn, sizeof(dev->sn), "%s", ii->idv.Sn_Name);
+	dev->static_read_at = time(NULL);
 
-	// Perform current inverter values readings.
-	perform_request(sp, "Current Inverter Values", rr, (char *) &response, &response_len);
+	return 1;
+}
 
-	// Process the read request response.
-	rrr = process_response(address, rr, response, response_len);
-	if (rrr == NULL) {
-		free(icv);
-		return NULL;
-	}
+/**
+	Slices the data read for a span back into each block's structure in the Inverter Info.
 
-	// Assign data into its variable.
-	for (i=0; i<3; i++) {
-		icv->Vpv[i] = ((double) convert_c2v(rrr->data[i*2], rrr->data[1+(i*2)])) / 10;
-		icv->Ppv[i] = convert_c2v(rrr->data[6+i*2], rrr->data[7+(i*2)]);
-	}
-	icv->Vac = ((double)convert_c2v(rrr->data[12], rrr->data[13])) / 10;
-	icv->Pac = convert_c2v(rrr->data[14], rrr->data[15]);
-	icv->Iac = ((double)convert_c2v(rrr->data[16], rrr->data[17])) / 10;
-	icv->Fac = ((double)convert_c2v(rrr->data[18], rrr->data[19])) / 100;
-	icv->Eac = convert_c2v(rrr->data[20], rrr->data[21]);
-	icv->Eac = ((double)(icv->Eac * 1000)) + (((double)convert_c2v(rrr->data[22], rrr->data[23])) * 0.1);
+	Inputs: The span, the data read, and the Inverter Info.
+*/
+void decode_span(struct READ_SPAN *span, char *data, struct INVERTER_INFO *ii)
+{
+	struct READ_BLOCK *blk;
+	void *info;
+	int i;
 
-	// Free memory.
-	cleanup_read_req_response(rrr);
+	for (i=span->first; i<INV_BLOCK_COUNT; i++) {
+		if ((span->mask & (1u << i)) == 0) continue;
+		blk = &inv_blocks[i];
+		info = ((char *) ii) + blk->info_offset;
 
-	// Get the extended values.
-	read_current_values_ext(address, sp, icv);
+		// A structure is emptied before its first block is decoded, and extended by the rest.
+		if ((ii->valid & blk->info_flag) == 0) {
+			if (blk->extends) continue;
+			memset(info, 0, blk->info_size);
+			ii->valid |= blk->info_flag;
+		}
+		decode_fields(blk->fields, blk->field_count, blk->start, blk->length, data + ((blk->start - span->start) * 2), info);
+		ii->stale_blocks &= ~(1u << i);
+	}
+	update_stale_flags(ii);
+}
+
+/**
+	Describes a span for logging.
 
-	return icv;
+	Inputs: The span, the buffer for the description, and its size.
+*/
+void describe_span(struct READ_SPAN *span, char *strDesc, int size)
+{
+	if (span->count > 1) snprintf(strDesc, size, "%s (+%d blocks)", inv_blocks[span->first].name, span->count-1);
+	else snprintf(strDesc, size, "%s", inv_blocks[span->first].name);
 }
@@ -10,10 +10,27 @@
 #include "global.h"
 
 // External declarations.
-extern struct INV_TRIP_SETTINGS_1 *read_trip_settings1(char, int);
-extern struct INV_TRIP_SETTINGS_2 *read_trip_settings2(char, int);
-extern struct INV_DEVICE_SETTINGS *read_device_settings(char, int);
-extern struct INV_TOTAL_VALUES *read_total_values(char, int);
-extern struct INV_DEVICE_VALUES *read_device_values(char, int);
-extern struct INV_CUR_STATE *read_current_state(char, int);
-extern struct INV_CUR_VALUES *read_current_values(char, int);
+extern int scan_inverter(char, int);
+extern int write_register(char, int, int, int);
+extern int get_baud_code(int);
+extern int count_port_answers(int);
+extern int switch_port_baud(int, int);
+extern int probe_port_baud(int);
+extern int negotiate_port_baud(int);
+extern struct READ_BLOCK *get_block(int);
+extern int read_block(char, int, struct READ_BLOCK *, void *);
+extern int read_trip_settings1(char, int, struct INV_TRIP_SETTINGS_1 *);
+extern int read_trip_settings2(char, int, struct INV_TRIP_SETTINGS_2 *);
+extern int read_device_settings(char, int, struct INV_DEVICE_SETTINGS *);
+extern int read_total_values(char, int, struct INV_TOTAL_VALUES *);
+extern int read_device_values(char, int, struct INV_DEVICE_VALUES *);
+extern int read_current_state(char, int, struct INV_CUR_STATE *);
+extern int read_current_values(char, int, struct INV_CUR_VALUES *);
+extern int plan_reads(struct READ_BLOCK *, int, unsigned int, struct READ_SPAN *);
+extern unsigned int get_due_blocks(struct INVERTER *);
+extern void mark_span_read(struct INVERTER *, struct READ_SPAN *);
+extern int plan_inverter_reads(struct INVERTER *, struct READ_SPAN *);
+extern void mark_blocks_stale(struct INVERTER_INFO *, unsigned int);
+extern int update_static_blocks(struct INVERTER *);
+extern void decode_span(struct READ_SPAN *, char *, struct INVERTER_INFO *);
+extern void describe_span(struct READ_SPAN *, char *, int);
@@ -8,10 +8,80 @@
 
 #include "global.h"
 
-#define REQUEST_LENGTH		10	// Length of Motech requests.
-
 char default_request[REQUEST_LENGTH] = {0x0A, 0x00, 0x03, 0x00, 0x17, 0x00, 0x02, 0x00, 0x00, 0x0D};
 
+// CRC16 of each byte value(polynomial 0xA001, reflected), so that a byte is folded in with one lookup.
+static const unsigned short crc16_table[256] = {
+	0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+	0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+	0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+	0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+	0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+	0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+	0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+	0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+	0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+	0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+	0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+	0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+	0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+	0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+	0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+	0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+	0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+	0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+	0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+	0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+	0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+	0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+	0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+	0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+	0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+	0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+	0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+	0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+	0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+	0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+	0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+	0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+/**
+	Updates a running CRC16 checksum with one byte.
+
+	Inputs: The running checksum(CRC16_INIT initially), and the byte.
+	Returns: The updated checksum(before byte reversal).
+*/
+unsigned short crc16_update(unsigned short crcIn, unsigned char val)
+{
+	return (crcIn >> 8) ^ crc16_table[(crcIn ^ val) & 0x00FF];
+}
+
+/**
+	Updates a running CRC16 checksum with a run of bytes, so that a frame can be checked
+	as it arrives rather than once it is complete.
+
+	Inputs: The running checksum(CRC16_INIT initially), the bytes, and the number of bytes.
+	Returns: The updated checksum(before byte reversal).
+*/
+unsigned short crc16_update_block(unsigned short crcIn, const unsigned char *data, int len)
+{
+	while (len-- > 0) crcIn = (crcIn >> 8) ^ crc16_table[(crcIn ^ *data++) & 0x00FF];
+
+	return crcIn;
+}
+
+/**
+	Completes a running CRC16 checksum.
+
+	Inputs: The running checksum.
+	Returns: The checksum with its two bytes reversed, as sent on the wire(high byte first).
+*/
+unsigned short crc16_final(unsigned short crcIn)
+{
+	return (crcIn >> 8) | (crcIn << 8);
+}
+
 /**
 	Calculates the CRC16 checksum required for all messages.
 
@@ -21,59 +91,19 @@ char default_request[REQUEST_LENGTH] = {0x0A, 0x00, 0x03, 0x00, 0x17, 0x00, 0x02
 */
 unsigned short calculate_crc16(unsigned char *message, unsigned char numChars, unsigned char offset)
 {
-	unsigned short crcOut;
-	unsigned char bitPos;
-	unsigned char flag;
-
-	message += offset;
-	crcOut = 0xFFFF;
-	while (numChars > 0)
-	{
-		crcOut = crcOut ^ ((unsigned char)*message);
-		bitPos = 0;
-		while (bitPos <= 7)
-		{
-			flag = crcOut & 0x0001;
-
-			crcOut = crcOut >> 1;
-			crcOut = crcOut & 0x7FFF;
-
-			if (flag != 0) crcOut = crcOut ^ 0xA001;
-
-			bitPos++;
-		}
-		message++;
-		numChars--;
-	}
-
-	// Reverse the two CRC bytes.
-	crcOut = (crcOut >> 8) | (crcOut << 8);
-
-	return (crcOut);
+	return crc16_final(crc16_update_block(CRC16_INIT, message + offset, numChars));
 }
 
 /**
-	Generates a read request for the Motech protocol.
+	Builds a read request for the Motech protocol.
 	
-	Inputs: Generates the serial command for read registers.
-	Returns: The serial sequence for a read request.
+	Inputs: The buffer for the request(REQUEST_LENGTH), the inverter address, the first
+			register, and the number of registers.
 */
-struct READ_REQ *generate_read_request(char address, int start, int length)
+void build_read_request(unsigned char *request_out, char address, int start, int length)
 {
-	struct READ_REQ *read_req_out;
-	char *request_out;
 	unsigned short calcCRC;
 
-	// Allocate memory for request.
-	read_req_out = malloc(sizeof(struct READ_REQ));
-	if (read_req_out == NULL) return NULL;
-	
-	request_out = malloc(REQUEST_LENGTH);
-	if (request_out==NULL) {
-		free(read_req_out);
-		return NULL;
-	}
-	
 	// Prepare request.
 	memcpy(request_out, default_request, REQUEST_LENGTH);
 	request_out[1] = address;
@@ -85,97 +115,148 @@ struct READ_REQ *generate_read_request(char address, int start, int length)
 	request_out[6] = (length & 0x00FF);
 	
 	// Calculate checksum and include.
-	calcCRC = calculate_crc16((unsigned char *)request_out, 6, 1);
+	calcCRC = calculate_crc16(request_out, 6, 1);
 	request_out[REQUEST_LENGTH-3] = ((calcCRC >> 8) & 0x00FF);
 	request_out[REQUEST_LENGTH-2] = (calcCRC & 0x00FF);
-	
-	// Place inside structure.
-	read_req_out->data_length = REQUEST_LENGTH;
-	read_req_out->data = request_out;
+}
+
+/**
+	Builds a request writing one register(0x0A, address, 0x06, register, value, CRC16, 0x0D).
+	The inverter is assumed to acknowledge by echoing the request, as for Modbus.
 
-	return read_req_out;
+	Inputs: The buffer for the request(REQUEST_LENGTH), the inverter address, the register,
+			and the value.
+*/
+void build_write_request(unsigned char *request_out, char address, int reg, int value)
+{
+	unsigned short calcCRC;
+
+	build_read_request(request_out, address, reg, value);
+	request_out[2] = FUNC_WRITE_REGISTER;
+
+	// The checksum covers the function code, so calculate it again.
+	calcCRC = calculate_crc16(request_out, 6, 1);
+	request_out[REQUEST_LENGTH-3] = ((calcCRC >> 8) & 0x00FF);
+	request_out[REQUEST_LENGTH-2] = (calcCRC & 0x00FF);
 }
 
 /**
-	Generates a scan request for the Motech protocol.
+	Builds a scan request for the Motech protocol.
 	
-	Inputs: Generates the serial command for search.
-	Returns: The serial sequence for a search request.
+	Inputs: The buffer for the request, and the inverter address.
 */
-struct READ_REQ *generate_scan_request(char address)
+void build_scan_request(unsigned char *request_out, char address)
 {
-	return generate_read_request(address, 0x17, 0x02);
+	build_read_request(request_out, address, 0x17, 0x02);
 }
 
 /**
-	Reads and validates a read request for the Motech protocol.
-	
-	Inputs: Validates the read request.
-	Returns: The read request response.
+	Builds the serial port initialisation request. The first request after the port is
+	opened(or after the link has gone quiet) is not reliably answered, so this throwaway
+	request is sent once per serial session rather than ahead of every poll.
+
+	Inputs: The buffer for the request, and the inverter address.
 */
-struct READ_REQ_RESPONSE *read_response_header(char address, unsigned char *response, int length)
+void build_wake_request(unsigned char *request_out, char address)
 {
-	struct READ_REQ_RESPONSE *rrr;
-	char data_len;
-	unsigned short calc_CRC;
+	build_read_request(request_out, address, 0x01, 10);
+}
 
-	// Error checking.
-	if (response == NULL) return NULL;
+/**
+	Gets the request frame for a read from an inverter, building it the first time the
+	read is made. A frame is kept for every run of blocks a read can span, so the frames
+	only run out if the reads no longer match the register map.
+
+	Inputs: The inverter, the first register, and the number of registers.
+	Returns: The request frame(REQUEST_LENGTH), or NULL if the inverter's frames are all
+			used(the caller builds the request itself).
+*/
+unsigned char *get_request_frame(struct INVERTER *dev, int start, int length)
+{
+	struct REQUEST_FRAME *rf;
+	int i;
+
+	for (i=0; i<dev->request_count; i++) {
+		rf = &dev->requests[i];
+		if ((rf->start == start) && (rf->length == length)) return rf->data;
+	}
+
+	if (dev->request_count >= INV_MAX_REQUESTS) {
+		fprintf(stderr, "The %d request frames of inverter %d are all used, so the read of %d registers from 0x%02X is not kept.\n",
+				INV_MAX_REQUESTS, dev->address, length, start);
+		return NULL;
+	}
+
+	rf = &dev->requests[dev->request_count++];
+	rf->start = start;
+	rf->length = length;
+	build_read_request(rf->data, dev->address, start, length);
 
-	// Allocate memory space.
-	rrr = malloc(sizeof(struct READ_REQ_RESPONSE));
-	if (rrr == NULL) return NULL;
+	return rf->data;
+}
+
+/**
+	Reads and validates a read request for the Motech protocol. The data is left in the
+	response buffer, and referred to by the result.
+	
+	Inputs: The inverter address, the response, its length, and the result to fill.
+	Returns: 1 if the response is valid, or a negative error code.
+*/
+int read_response_header(char address, unsigned char *response, int length, struct READ_REQ_RESPONSE *rrr)
+{
+	unsigned char data_len;
+	unsigned short calc_CRC;
 
 	// Initialise structure values.
 	rrr->success = 0;
 	rrr->data_length = 0;
 	rrr->data = NULL;
 
+	// Error checking.
+	if ((response == NULL) || (length < 7)) return rrr->success;
+
 	// Check for a valid header.
 	if (response[0] != 0x0A) {
 		if (verbose) fprintf(stderr, "The prefix(-1) was not found in the data returned.\n");
 		rrr->success = -1;
-		return rrr;
+		return rrr->success;
 	}
-	if (response[1] != address) {
+	if (response[1] != (unsigned char) address) {
 		if (verbose) fprintf(stderr, "The response was not from the address queried.\n");
 		rrr->success = -2;
-		return rrr;
+		return rrr->success;
 	}
 	if (response[2] != 0x03) {
 		if (verbose) fprintf(stderr, "The prefix(-3) was not found in the data returned.\n");
 		rrr->success = -3;
-		return rrr;
+		return rrr->success;
 	}
 
 	// Calculate length and CRC from header info.
 	data_len = response[3];
-	calc_CRC = calculate_crc16((unsigned char *)response, data_len+3, 1);
+	if (data_len + 7 > length) {
+		if (verbose) fprintf(stderr, "The data returned was shorter than its header states.\n");
+		rrr->success = -6;
+		return rrr->success;
+	}
+	calc_CRC = calculate_crc16(response, data_len+3, 1);
 
 	// Verify length and CRC from header info.
 	if (response[4+data_len+2] != 0x0D) {
 		if (verbose) fprintf(stderr, "The end byte was not found in the data returned.\n");
 		rrr->success = -4;
-		return rrr;
+		return rrr->success;
 	}
 	if ( (((calc_CRC >> 8) & 0x00FF) != response[4+data_len]) || ((calc_CRC & 0x00FF) != response[5+data_len]) ) {
 		if (verbose) fprintf(stderr, "The CRC received was invalid: %x != %x, %x != %x\n", ((calc_CRC >> 8) & 0x00FF), response[4+data_len], (calc_CRC & 0x00FF), response[5+data_len]);
 		rrr->success = -5;
-		return rrr;
+		return rrr->success;
 	}
 
 	// Set response, and return outcome.
 	rrr->success = 1;
 	rrr->data_length = data_len;
+	rrr->data = (char *) response + 4;
 
-	rrr->data = malloc(data_len);
-	if (rrr->data == NULL) {
-		fprintf(stderr, "The memory could not be allocated for the response.\n");
-		rrr->success = -6;
-		return rrr;
-	}
-	memcpy(rrr->data, response+4, data_len);
-
-	return rrr;
+	return rrr->success;
 }
-
@@ -10,8 +10,14 @@
 #include "global.h"
 
 // External declarations.
-extern unsigned short calculate_crc16(char *, unsigned char);
-extern struct READ_REQ *generate_read_request(char, int, int);
-extern char *generate_scan_request(char);
-extern struct READ_REQ_RESPONSE *read_response_header(char, char *, int);
+extern unsigned short crc16_update(unsigned short, unsigned char);
+extern unsigned short crc16_update_block(unsigned short, const unsigned char *, int);
+extern unsigned short crc16_final(unsigned short);
+extern unsigned short calculate_crc16(unsigned char *, unsigned char, unsigned char);
+extern void build_read_request(unsigned char *, char, int, int);
+extern void build_write_request(unsigned char *, char, int, int);
+extern void build_scan_request(unsigned char *, char);
+extern void build_wake_request(unsigned char *, char);
+extern unsigned char *get_request_frame(struct INVERTER *, int, int);
+extern int read_response_header(char, unsigned char *, int, struct READ_REQ_RESPONSE *);
 
@@ -0,0 +1,265 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Decodes, prints and stores the Inverter Info structures by walking the
+					field tables generated from the register map.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "global.h"
+
+/*
+ * Field tables, generated from the register map.
+ */
+
+#define REG_STRUCT INV_TRIP_SETTINGS_1
+struct REG_FIELD reg_its1[] = {REG_TABLE_ENTRIES(INV_TRIP_SETTINGS_1_MAP)};
+#undef REG_STRUCT
+
+#define REG_STRUCT INV_TRIP_SETTINGS_2
+struct REG_FIELD reg_its2[] = {REG_TABLE_ENTRIES(INV_TRIP_SETTINGS_2_MAP)};
+#undef REG_STRUCT
+
+#define REG_STRUCT INV_DEVICE_SETTINGS
+struct REG_FIELD reg_ids[] = {REG_TABLE_ENTRIES(INV_DEVICE_SETTINGS_MAP)};
+#undef REG_STRUCT
+
+#define REG_STRUCT INV_TOTAL_VALUES
+struct REG_FIELD reg_itv[] = {REG_TABLE_ENTRIES(INV_TOTAL_VALUES_MAP)};
+#undef REG_STRUCT
+
+#define REG_STRUCT INV_DEVICE_VALUES
+struct REG_FIELD reg_idv[] = {REG_TABLE_ENTRIES(INV_DEVICE_VALUES_MAP)};
+#undef REG_STRUCT
+
+#define REG_STRUCT INV_CUR_STATE
+struct REG_FIELD reg_ics[] = {REG_TABLE_ENTRIES(INV_CUR_STATE_MAP)};
+#undef REG_STRUCT
+
+#define REG_STRUCT INV_CUR_VALUES
+struct REG_FIELD reg_icv[] = {REG_TABLE_ENTRIES(INV_CUR_VALUES_MAP)};
+#undef REG_STRUCT
+
+/**
+	Decodes a string from registers(two characters per register), keeping ASCII alphanumerics.
+
+	Inputs: The register data, the number of characters, and the buffer for the string
+			(num_chars + 1).
+*/
+void decode_string(char *data, int num_chars, char *strOut)
+{
+	int i, j;
+
+	j = 0;
+	for (i=0; i<num_chars; i++) {
+		// Filter ASCII alphanumerics.
+		if (((data[i] >= 65) && (data[i] <= 90)) || ((data[i] >= 97) && (data[i] <= 122)) || ((data[i] >= 48) && (data[i] <= 57))) {
+			strOut[j] = data[i];
+			j++;
+		}
+	}
+	strOut[j] = 0;
+}
+
+/**
+	Decodes the fields covered by a register range into a structure. Fields(or array
+	values) outside the range are left as they are, so a structure can be filled by
+	several reads.
+
+	Inputs: The field table, its number of entries, the first register and number of
+			registers read, the data read, and the structure to decode into.
+*/
+void decode_fields(struct REG_FIELD *fields, int field_count, int start, int length, char *data, void *out)
+{
+	struct REG_FIELD *f;
+	unsigned char *p;
+	unsigned long raw;
+	double value;
+	int reg;
+	int i, k;
+
+	for (i=0; i<field_count; i++) {
+		f = &fields[i];
+		for (k=0; k<f->count; k++) {
+			reg = f->reg + (k * f->stride);
+			if ((reg < start) || (reg + f->registers > start + length)) continue;
+			p = (unsigned char *) data + ((reg - start) * 2);
+
+			if (f->format == REG_FORMAT_STRING) {
+				decode_string((char *) p, f->registers * 2, ((char *) out) + f->offset);
+				continue;
+			}
+
+			raw = (p[0] << 8) | p[1];
+			if (f->format == REG_FORMAT_U32) value = (double) ((raw << 16) | (p[2] << 8) | p[3]);
+			else if (f->format == REG_FORMAT_KWH) value = (((double) raw) * 1000) + (((double) ((p[2] << 8) | p[3])) * 0.1);
+			else if (f->format == REG_FORMAT_S16) value = (raw & 0x8000) ? ((double) raw) - 65536 : (double) raw;
+			else value = (double) raw;
+
+			set_field_value(f, out, k, value / f->divisor);
+		}
+	}
+}
+
+/**
+	Gets a value of a numeric field.
+
+	Inputs: The field, the structure, and the array index(0 for single values).
+	Returns: The value.
+*/
+double get_field_value(struct REG_FIELD *f, void *base, int index)
+{
+	char *p = ((char *) base) + f->offset + (index * f->size);
+
+	switch (f->type) {
+		case REG_TYPE_INT: return *((int *) p);
+		case REG_TYPE_LONG: return *((long *) p);
+		case REG_TYPE_DOUBLE: return *((double *) p);
+	}
+
+	return 0;
+}
+
+/**
+	Sets a value of a numeric field, converting it to the field's type.
+
+	Inputs: The field, the structure, the array index(0 for single values), and the value.
+*/
+void set_field_value(struct REG_FIELD *f, void *base, int index, double value)
+{
+	char *p = ((char *) base) + f->offset + (index * f->size);
+
+	switch (f->type) {
+		case REG_TYPE_INT: *((int *) p) = (int) value; break;
+		case REG_TYPE_LONG: *((long *) p) = (long) value; break;
+		case REG_TYPE_DOUBLE: *((double *) p) = value; break;
+	}
+}
+
+/**
+	Formats a value of a field(integers in full, decimals to two places).
+
+	Inputs: The field, the structure, the array index, the buffer, and its size.
+	Returns: The length of the text.
+*/
+int format_field(struct REG_FIELD *f, void *base, int index, char *strOut, int size)
+{
+	char *p = ((char *) base) + f->offset + (index * f->size);
+
+	switch (f->type) {
+		case REG_TYPE_INT: return snprintf(strOut, size, "%d", *((int *) p));
+		case REG_TYPE_LONG: return snprintf(strOut, size, "%ld", *((long *) p));
+		case REG_TYPE_DOUBLE: return snprintf(strOut, size, "%.2f", *((double *) p));
+	}
+
+	return snprintf(strOut, size, "%s", p);
+}
+
+/**
+	Prints every field of a structure to console, one value per line.
+
+	Inputs: The field table, its number of entries, and the structure.
+*/
+void print_fields(struct REG_FIELD *fields, int field_count, void *base)
+{
+	char strValue[BUFSIZ];
+	int i, k;
+
+	for (i=0; i<field_count; i++) {
+		for (k=0; k<fields[i].count; k++) {
+			format_field(&fields[i], base, k, strValue, sizeof(strValue));
+			if (fields[i].count > 1) printf("%s(%d): %s", fields[i].label, k+1, strValue);
+			else printf("%s: %s", fields[i].label, strValue);
+
+			if (fields[i].unit[0] != 0) printf(" %s\n", fields[i].unit);
+			else printf("\n");
+		}
+	}
+}
+
+/**
+	Formats the numeric fields of a structure as one space-separated list, in register
+	map order(strings are skipped).
+
+	Inputs: The field table, its number of entries, the structure, the buffer, and its size.
+	Returns: The length of the text, or -1 if the buffer is too small.
+*/
+int format_fields(struct REG_FIELD *fields, int field_count, void *base, char *strOut, int size)
+{
+	int len;
+	int i, k;
+
+	len = 0;
+	strOut[0] = 0;
+	for (i=0; i<field_count; i++) {
+		if (fields[i].type == REG_TYPE_CHAR) continue;
+		for (k=0; k<fields[i].count; k++) {
+			if (len > 0) {
+				if (len + 1 >= size) return -1;
+				strOut[len++] = ' ';
+			}
+			len += format_field(&fields[i], base, k, strOut + len, size - len);
+			if (len >= size) return -1;
+		}
+	}
+
+	return len;
+}
+
+/**
+	Parses a list written by format_fields() back into a structure.
+
+	Inputs: The field table, its number of entries, the structure, and the text.
+	Returns: The number of characters parsed, or -1 if a value is missing.
+*/
+int parse_fields(struct REG_FIELD *fields, int field_count, void *base, char *strIn)
+{
+	char *pos;
+	char *end;
+	double value;
+	int i, k;
+
+	pos = strIn;
+	for (i=0; i<field_count; i++) {
+		if (fields[i].type == REG_TYPE_CHAR) continue;
+		for (k=0; k<fields[i].count; k++) {
+			value = strtod(pos, &end);
+			if (end == pos) return -1;
+			set_field_value(&fields[i], base, k, value);
+			pos = end;
+		}
+	}
+
+	return pos - strIn;
+}
+
+/**
+	Formats the numeric fields of a structure as comma-separated "key=value" pairs(as the
+	fields of an InfluxDB line), keyed by the member names and the values of an array as
+	name_1, name_2 and so on.
+
+	Inputs: The field table, its number of entries, the structure, the prefix for each key,
+			the buffer, and its size.
+	Returns: The length of the text, or -1 if the buffer is too small.
+*/
+int format_keyed_fields(struct REG_FIELD *fields, int field_count, void *base, char *prefix, char *strOut, int size)
+{
+	int len;
+	int i, k;
+
+	len = 0;
+	strOut[0] = 0;
+	for (i=0; i<field_count; i++) {
+		if (fields[i].type == REG_TYPE_CHAR) continue;
+		for (k=0; k<fields[i].count; k++) {
+			if (fields[i].count > 1) len += snprintf(strOut + len, size - len, "%s%s%s_%d=", (len > 0) ? "," : "", prefix, fields[i].name, k+1);
+			else len += snprintf(strOut + len, size - len, "%s%s%s=", (len > 0) ? "," : "", prefix, fields[i].name);
+			if (len >= size) return -1;
+			len += format_field(&fields[i], base, k, strOut + len, size - len);
+			if (len >= size) return -1;
+		}
+	}
+
+	return len;
+}
@@ -0,0 +1,174 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Register map of the Motech inverter. Each structure of the Inverter
+					Info is declared once here, with the register, format and scale of
+					every field, and the structures, decoder tables and output field
+					lists are all generated from it.
+	Version		:	v0.8
+*/
+
+#ifndef REGISTERS_H
+
+	// Header Guard.
+	#define REGISTERS_H
+
+	/*
+	* Definitions.
+	*/
+
+	#define REG_FORMAT_U16				0											// Register Format: one unsigned register
+	#define REG_FORMAT_U32				1											// Register Format: two registers, high word first
+	#define REG_FORMAT_KWH				2											// Register Format: kWh, then tenths of a Wh (read as Wh)
+	#define REG_FORMAT_STRING			3											// Register Format: two characters per register
+	#define REG_FORMAT_S16				4											// Register Format: one signed(two's complement) register
+
+	#define REG_WIDTH_U16				1											// Registers per value, by format
+	#define REG_WIDTH_U32				2
+	#define REG_WIDTH_KWH				2
+	#define REG_WIDTH_S16				1
+
+	#define REG_TYPE_INT				0											// Field Type: int
+	#define REG_TYPE_LONG				1											// Field Type: long
+	#define REG_TYPE_DOUBLE				2											// Field Type: double
+	#define REG_TYPE_CHAR				3											// Field Type: string
+
+	#define REG_CTYPE_INT				int											// C type of each field type
+	#define REG_CTYPE_LONG				long
+	#define REG_CTYPE_DOUBLE			double
+
+	/*
+	 * Register Map. The fields of each structure are listed in structure order, as
+	 *
+	 *	F(type, name, register, format, divisor, label, unit)							a single value
+	 *	A(type, name, count, register, stride, format, divisor, label, unit)			an array of values, stride registers apart
+	 *	S(name, register, registers, label)												a string
+	 *
+	 * with registers given as absolute addresses, so a field is decoded by whichever read
+	 * covers it. A value is the raw register value(signed for S16, unsigned otherwise) divided
+	 * by the divisor, stored in the field's type(truncated for INT and LONG).
+	 */
+
+	// Inverter Trip Settings #1 (0x01, 10 registers)
+	#define INV_TRIP_SETTINGS_1_MAP(F, A, S) \
+		F(INT, FacH_Trip,			0x01, U16, 1, "AC Frequency High Trip", "") \
+		F(INT, FacH_Cycle,			0x02, U16, 1, "AC Frequency High Cycles", "") \
+		F(INT, FacL_Trip,			0x03, U16, 1, "AC Frequency Low Trip", "") \
+		F(INT, FacL_Cycle,			0x04, U16, 1, "AC Frequency Low Cycles", "") \
+		F(INT, VacH_Trip,			0x05, U16, 1, "AC Voltage High Trip", "") \
+		F(INT, VacH_Cycle,			0x06, U16, 1, "AC Voltage High Cycles", "") \
+		F(INT, VacL_Trip,			0x07, U16, 1, "AC Voltage Low Trip", "") \
+		F(INT, VacL_Cycle,			0x08, U16, 1, "AC Voltage Low Cycles", "") \
+		F(INT, Delta_Zac_Trip,		0x09, U16, 1, "Grid Impedance Change Trip", "") \
+		F(INT, Zac_Trip,			0x0A, U16, 1, "Grid Impedance Trip", "")
+
+	// Inverter Trip Settings #2 (0x0B, 7 registers)
+	#define INV_TRIP_SETTINGS_2_MAP(F, A, S) \
+		F(INT, FastIEarth_Trip,		0x0B, U16, 1, "Fast Earth Current Trip", "") \
+		F(INT, SlowIEarth_Trip,		0x0C, U16, 1, "Slow Earth Current Trip", "") \
+		F(INT, Riso_Trip,			0x0D, U16, 1, "Insulation Resistance Trip", "") \
+		F(INT, Vpv_Trip,			0x0E, U16, 1, "Array Voltage Trip", "") \
+		F(INT, OnGrid_Delay,		0x0F, U16, 1, "On Grid Delay", "") \
+		F(INT, VacH_Limit,			0x10, U16, 1, "AC Voltage High Limit", "") \
+		F(INT, VacH_Limit_Cycle,	0x11, U16, 1, "AC Voltage High Limit Cycles", "")
+
+	// Inverter Device Settings (0x12, 4 registers)
+	#define INV_DEVICE_SETTINGS_MAP(F, A, S) \
+		F(INT, Type_No,				0x12, U16, 1, "Type Number", "") \
+		F(INT, Address,				0x13, U16, 1, "Address", "") \
+		F(INT, Baudrate,			0x14, U16, 1, "Baud Rate", "") \
+		F(INT, Language,			0x15, U16, 1, "Language", "")
+
+	// Inverter Total Values (0x19, 16 registers)
+	#define INV_TOTAL_VALUES_MAP(F, A, S) \
+		F(LONG, BridgeRelay_On_Num,	0x19, U32, 1, "Bridge Relay Operations", "") \
+		F(INT, Time_Hr_Cnt,			0x1B, U16, 1, "Total time hours", "hr") \
+		F(INT, Time_Min_Cnt,		0x1C, U16, 1, "Total time minutes", "mins") \
+		F(INT, Time_Sec_Cnt,		0x1D, U16, 1, "Total time seconds", "secs") \
+		F(LONG, Eac,				0x1E, KWH, 1, "Total Energy", "Wh") \
+		A(LONG, Epv, 3,				0x21, 3, KWH, 1, "Array Total Energy", "Wh")
+
+	// Inverter Device Values (0x67, 0x6F and 0x77, 8 registers each)
+	#define INV_DEVICE_VALUES_MAP(F, A, S) \
+		S(Brand_Name,				0x67, STRING_REGISTERS, "Brand Name") \
+		S(Type_Name,				0x6F, STRING_REGISTERS, "Type Name") \
+		S(Sn_Name,					0x77, STRING_REGISTERS, "Serial Number")
+
+	// Inverter Current State (0xB5, 5 registers)
+	#define INV_CUR_STATE_MAP(F, A, S) \
+		F(INT, State,				0xB5, U16, 1, "State", "") \
+		A(INT, Error_Code, 4,		0xB6, 1, U16, 1, "Error Code", "")
+
+	// Inverter Current Values (0xBA, 15 registers, and 0xCC, 3 registers)
+	#define INV_CUR_VALUES_MAP(F, A, S) \
+		A(INT, Vpv, 3,				0xBA, 1, U16, 10, "Array Voltage", "V") \
+		A(INT, Ppv, 3,				0xBD, 1, U16, 1, "Array Power", "W") \
+		F(DOUBLE, Vac,				0xC0, U16, 10, "AC Voltage", "V") \
+		F(DOUBLE, Pac,				0xC1, U16, 1, "AC Power", "W") \
+		F(DOUBLE, Iac,				0xC2, U16, 10, "AC Current", "A") \
+		F(DOUBLE, Fac,				0xC3, U16, 100, "AC Frequency", "Hz") \
+		F(DOUBLE, Eac,				0xC4, KWH, 1, "Energy today", "Wh") \
+		F(DOUBLE, Ton_today,		0xCC, U16, 2048, "Time on today", "hr") \
+		F(DOUBLE, Heatsink_Temp,	0xCE, S16, 10, "Heatsink Temp", "degC")
+
+	// Structure members of a map entry.
+	#define REG_STRUCT_FIELD(type, name, reg, format, divisor, label, unit)					REG_CTYPE_##type name;
+	#define REG_STRUCT_ARRAY(type, name, count, reg, stride, format, divisor, label, unit)		REG_CTYPE_##type name[count];
+	#define REG_STRUCT_STRING(name, reg, registers, label)										char name[(registers)*2+1];
+	#define REG_STRUCT_MEMBERS(MAP)			MAP(REG_STRUCT_FIELD, REG_STRUCT_ARRAY, REG_STRUCT_STRING)
+
+	// Field table entries of a map entry(REG_STRUCT names the structure being tabled).
+	#define REG_TABLE_FIELD(type, name, reg, format, divisor, label, unit) \
+		{label, unit, #name, offsetof(struct REG_STRUCT, name), sizeof(REG_CTYPE_##type), reg, REG_WIDTH_##format, 1, 0, REG_FORMAT_##format, REG_TYPE_##type, divisor},
+	#define REG_TABLE_ARRAY(type, name, count, reg, stride, format, divisor, label, unit) \
+		{label, unit, #name, offsetof(struct REG_STRUCT, name), sizeof(REG_CTYPE_##type), reg, REG_WIDTH_##format, count, stride, REG_FORMAT_##format, REG_TYPE_##type, divisor},
+	#define REG_TABLE_STRING(name, reg, registers, label) \
+		{label, "", #name, offsetof(struct REG_STRUCT, name), (registers)*2+1, reg, registers, 1, 0, REG_FORMAT_STRING, REG_TYPE_CHAR, 1},
+	#define REG_TABLE_ENTRIES(MAP)			MAP(REG_TABLE_FIELD, REG_TABLE_ARRAY, REG_TABLE_STRING)
+
+	// Number of field table entries of a map.
+	#define REG_COUNT_FIELD(...)			+1
+	#define REG_FIELD_COUNT(MAP)			(0 MAP(REG_COUNT_FIELD, REG_COUNT_FIELD, REG_COUNT_FIELD))
+
+	// A field table, and its number of entries.
+	#define REG_FIELDS(table)				table, (sizeof(table) / sizeof(struct REG_FIELD))
+
+	/*
+	 * Custom Structures
+	 */
+
+	// Register Field (where a field is read from, and how it is decoded and printed)
+	struct REG_FIELD {
+		char 	*label;				// Description printed with the value.
+		char 	*unit;				// Unit printed after the value.
+		char 	*name;				// Member name, used as the key of published values.
+		int 	offset;				// Offset of the field in its structure.
+		int 	size;				// Size of one value in the structure.
+		int 	reg;				// Register of the(first) value.
+		int 	registers;			// Registers per value.
+		int 	count;				// Number of values(1 unless the field is an array).
+		int 	stride;				// Registers between the values of an array.
+		char 	format;				// REG_FORMAT_*.
+		char 	type;				// REG_TYPE_*.
+		int 	divisor;			// Divisor applied to the raw value.
+	};
+
+	// External declarations.
+	extern struct REG_FIELD reg_its1[REG_FIELD_COUNT(INV_TRIP_SETTINGS_1_MAP)];
+	extern struct REG_FIELD reg_its2[REG_FIELD_COUNT(INV_TRIP_SETTINGS_2_MAP)];
+	extern struct REG_FIELD reg_ids[REG_FIELD_COUNT(INV_DEVICE_SETTINGS_MAP)];
+	extern struct REG_FIELD reg_itv[REG_FIELD_COUNT(INV_TOTAL_VALUES_MAP)];
+	extern struct REG_FIELD reg_idv[REG_FIELD_COUNT(INV_DEVICE_VALUES_MAP)];
+	extern struct REG_FIELD reg_ics[REG_FIELD_COUNT(INV_CUR_STATE_MAP)];
+	extern struct REG_FIELD reg_icv[REG_FIELD_COUNT(INV_CUR_VALUES_MAP)];
+	extern void 	decode_string(char *, int, char *);
+	extern void 	decode_fields(struct REG_FIELD *, int, int, int, char *, void *);
+	extern double 	get_field_value(struct REG_FIELD *, void *, int);
+	extern void 	set_field_value(struct REG_FIELD *, void *, int, double);
+	extern int 		format_field(struct REG_FIELD *, void *, int, char *, int);
+	extern void 	print_fields(struct REG_FIELD *, int, void *);
+	extern int 		format_fields(struct REG_FIELD *, int, void *, char *, int);
+	extern int 		parse_fields(struct REG_FIELD *, int, void *, char *);
+	extern int 		format_keyed_fields(struct REG_FIELD *, int, void *, char *, char *, int);
+
+#endif
@@ -35,9 +35,197 @@ int read_fail_count()
 	}
 
 	// Return the failure count.
+	rof_fail_count = failCount;
 	return failCount;
 }
 
+/**
+	Reads the inverter addresses found by the last scan of a serial port.
+
+	Inputs: The serial port device name, the array to fill, and its size.
+	Returns: The number of addresses read.
+*/
+int read_scan_cache(char *dev_name, int *addresses, int max_count)
+{
+	FILE *file;
+	char line[BUFSIZ];
+	char dev[BUFSIZ];
+	int count;
+
+	count = 0;
+
+	// Open the file, and read the addresses for the serial port(one "device address" per line).
+	file = fopen(SCAN_CACHE_FILE, "r");
+	if (file != NULL)
+	{
+		while ((count < max_count) && (fgets (line, sizeof(line), file) != NULL))
+		{
+			if ((sscanf(line, "%s %d", dev, &addresses[count]) == 2) && (strcmp(dev, dev_name) == 0)) count++;
+		}
+		fclose (file);
+	}
+
+	return count;
+}
+
+/**
+	Writes the inverter addresses found by a scan of a serial port, keeping the addresses
+	cached for other serial ports.
+
+	Inputs: The serial port device name, the addresses, and the number of addresses.
+*/
+void write_scan_cache(char *dev_name, int *addresses, int count)
+{
+	FILE *file;
+	char lines[BUFSIZ];
+	char line[BUFSIZ];
+	char dev[BUFSIZ];
+	int i;
+
+	// Keep the lines for other serial ports.
+	lines[0] = 0;
+	file = fopen(SCAN_CACHE_FILE, "r");
+	if (file != NULL)
+	{
+		while (fgets (line, sizeof(line), file) != NULL)
+		{
+			if ((sscanf(line, "%s", dev) == 1) && (strcmp(dev, dev_name) != 0) && (strlen(lines) + strlen(line) < sizeof(lines))) strcat(lines, line);
+		}
+		fclose (file);
+	}
+
+	// Open the file and write one "device address" per line.
+	file = fopen(SCAN_CACHE_FILE, "w");
+	if (file != NULL)
+	{
+		fputs(lines, file);
+		for (i=0; i<count; i++) fprintf(file, "%s %d\n", dev_name, addresses[i]);
+		fclose (file);
+	}
+}
+
+/**
+	Reads an inverter's settings and names cached by an earlier run, so that they need
+	not be read from the inverter again until INV_STATIC_REFRESH_SEC has passed.
+
+	Inputs: The inverter.
+	Returns: 1 if the inverter was found in the cache, 0 otherwise.
+*/
+int read_static_cache(struct INVERTER *dev)
+{
+	FILE *file;
+	char line[BUFSIZ];
+	char dev_name[BUFSIZ];
+	char sn[BUFSIZ], brand[BUFSIZ], type[BUFSIZ];
+	struct INV_TRIP_SETTINGS_1 its1;
+	struct INV_TRIP_SETTINGS_2 its2;
+	struct INV_DEVICE_SETTINGS ids;
+	char *pos;
+	long read_at;
+	int address;
+	int found;
+	int len;
+
+	found = 0;
+
+	// Open the file, and find the line for the inverter's serial port and address.
+	file = fopen(STATIC_CACHE_FILE, "r");
+	if (file == NULL) return 0;
+
+	while ((!found) && (fgets (line, sizeof(line), file) != NULL))
+	{
+		// The settings follow the names, in register map order.
+		if (sscanf(line, "%s %d %ld %s %s %s%n", dev_name, &address, &read_at, sn, brand, type, &len) != 6) continue;
+		pos = line + len;
+		if ((len = parse_fields(REG_FIELDS(reg_its1), &its1, pos)) < 0) continue;
+		pos += len;
+		if ((len = parse_fields(REG_FIELDS(reg_its2), &its2, pos)) < 0) continue;
+		pos += len;
+		if (parse_fields(REG_FIELDS(reg_ids), &ids, pos) < 0) continue;
+		if ((strcmp(dev_name, sp_ports[dev->port].dev_name) != 0) || (address != dev->address)) continue;
+
+		// Names that were empty are stored as "-".
+		if (strcmp(sn, "-") == 0) sn[0] = 0;
+		if (strcmp(brand, "-") == 0) brand[0] = 0;
+		if (strcmp(type, "-") == 0) type[0] = 0;
+
+		dev->ii.its1 = its1;
+		dev->ii.its2 = its2;
+		dev->ii.ids = ids;
+		snprintf(dev->ii.idv.Brand_Name, sizeof(dev->ii.idv.Brand_Name), "%.*s", (int) sizeof(dev->ii.idv.Brand_Name) - 1, brand);
+		snprintf(dev->ii.idv.Type_Name, sizeof(dev->ii.idv.Type_Name), "%.*s", (int) sizeof(dev->ii.idv.Type_Name) - 1, type);
+		snprintf(dev->ii.idv.Sn_Name, sizeof(dev->ii.idv.Sn_Name), "%.*s", (int) sizeof(dev->ii.idv.Sn_Name) - 1, sn);
+		dev->ii.valid |= INFO_STATIC;
+
+		snprintf(dev->sn, sizeof(dev->sn), "%.*s", (int) sizeof(dev->sn) - 1, sn);
+		dev->static_read_at = (time_t) read_at;
+		found = 1;
+	}
+	fclose (file);
+
+	return found;
+}
+
+/**
+	Writes the settings and names of every inverter to the cache, one line per inverter
+	keyed by serial port, address and serial number. Inverters whose static blocks are
+	not cached are written with a read time of 0, so the next run reads them again.
+	Lines for inverters polled by other runs are kept.
+
+	Inputs: The inverters, and the number of inverters.
+*/
+void write_static_cache(struct INVERTER *devices, int count)
+{
+	FILE *file;
+	struct INVERTER_INFO *ii;
+	char lines[BUFSIZ*4];
+	char line[BUFSIZ];
+	char dev_name[BUFSIZ];
+	char its1[BUFSIZ], its2[BUFSIZ], ids[BUFSIZ];
+	int address;
+	int keep;
+	int i;
+
+	// Keep the lines for other inverters.
+	lines[0] = 0;
+	file = fopen(STATIC_CACHE_FILE, "r");
+	if (file != NULL)
+	{
+		while (fgets (line, sizeof(line), file) != NULL)
+		{
+			if (sscanf(line, "%s %d", dev_name, &address) != 2) continue;
+			keep = 1;
+			for (i=0; i<count; i++) {
+				if ((strcmp(dev_name, sp_ports[devices[i].port].dev_name) == 0) && (address == devices[i].address)) keep = 0;
+			}
+			if ((keep) && (strlen(lines) + strlen(line) < sizeof(lines))) strcat(lines, line);
+		}
+		fclose (file);
+	}
+
+	file = fopen(STATIC_CACHE_FILE, "w");
+	if (file == NULL) return;
+
+	fputs(lines, file);
+	for (i=0; i<count; i++)
+	{
+		ii = &devices[i].ii;
+		if ((ii->valid & INFO_STATIC) != INFO_STATIC) continue;
+
+		if (format_fields(REG_FIELDS(reg_its1), &ii->its1, its1, sizeof(its1)) < 0) continue;
+		if (format_fields(REG_FIELDS(reg_its2), &ii->its2, its2, sizeof(its2)) < 0) continue;
+		if (format_fields(REG_FIELDS(reg_ids), &ii->ids, ids, sizeof(ids)) < 0) continue;
+
+		fprintf(file, "%s %d %ld %s %s %s %s %s %s\n",
+				sp_ports[devices[i].port].dev_name, devices[i].address, (long) devices[i].static_read_at,
+				((devices[i].sn[0] != 0) ? devices[i].sn : "-"),
+				((ii->idv.Brand_Name[0] != 0) ? ii->idv.Brand_Name : "-"),
+				((ii->idv.Type_Name[0] != 0) ? ii->idv.Type_Name : "-"),
+				its1, its2, ids);
+	}
+	fclose (file);
+}
+
 /**
 	Writes the failure count to the log file.
 	
@@ -58,5 +246,6 @@ void write_fail_count(int failCount)
 		fputs((char *)&line, file);
 		fclose (file);
 	}
+	rof_fail_count = failCount;
 }
 
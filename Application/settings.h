@@ -12,3 +12,7 @@
 // External declarations.
 extern int read_fail_count();
 extern void write_fail_count(int);
+extern int read_scan_cache(char *, int *, int);
+extern void write_scan_cache(char *, int *, int);
+extern int read_static_cache(struct INVERTER *);
+extern void write_static_cache(struct INVERTER *, int);
@@ -0,0 +1,582 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Requests serial data from a Motech inverter via Serial, and
+					sends it via Wi-Fi/Socket connection.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../Application/global.h"
+#include "../Application/frame.h"
+#include "../Application/interface.h"
+#include "../Application/protocol.h"
+#include "serial.h"
+
+int engine_fd = -1;			// epoll file descriptor.
+int engine_pending = 0;		// Number of serial ports with transactions outstanding this poll.
+struct ENGINE_STATS engine_stats;	// Counters since the engine started.
+long engine_duration_bounds[ENGINE_DURATION_BUCKETS] = {10, 25, 50, 100, 150, 250, 500, 1000};	// Upper bounds of the transaction duration buckets (in milliseconds).
+void (*engine_observer)(struct SERIAL_PORT *, struct TRANSACTION *, int) = NULL;	// Called as each transaction completes(eg by the benchmark).
+
+void port_start_transaction(struct SERIAL_PORT *);
+
+/**
+	Creates the epoll instance that all serial ports(and other sockets) are multiplexed on.
+
+	Returns: 1 on success, -1 otherwise.
+*/
+int engine_init()
+{
+	engine_fd = epoll_create(SP_MAX_PORTS * 2);
+	if (engine_fd < 0) {
+		perror("Unable to create epoll instance.");
+		return -1;
+	}
+
+	return 1;
+}
+
+/**
+	Adds a file descriptor to the engine.
+
+	Inputs: The handler, and the epoll events to watch for.
+	Returns: 1 on success, -1 otherwise.
+*/
+int engine_add_handler(struct ENGINE_HANDLER *h, unsigned int events)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.events = events;
+	ev.data.ptr = h;
+	if (epoll_ctl(engine_fd, EPOLL_CTL_ADD, h->fd, &ev) < 0) {
+		perror("Unable to add file descriptor to epoll instance.");
+		return -1;
+	}
+
+	return 1;
+}
+
+/**
+	Changes the events watched for a file descriptor.
+
+	Inputs: The handler, and the epoll events to watch for.
+	Returns: 1 on success, -1 otherwise.
+*/
+int engine_modify_handler(struct ENGINE_HANDLER *h, unsigned int events)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.events = events;
+	ev.data.ptr = h;
+	if (epoll_ctl(engine_fd, EPOLL_CTL_MOD, h->fd, &ev) < 0) return -1;
+
+	return 1;
+}
+
+/**
+	Removes a file descriptor from the engine.
+
+	Inputs: The handler.
+*/
+void engine_remove_handler(struct ENGINE_HANDLER *h)
+{
+	struct epoll_event ev;
+
+	epoll_ctl(engine_fd, EPOLL_CTL_DEL, h->fd, &ev);
+}
+
+/**
+	Waits for events, and passes each to its handler.
+
+	Inputs: The maximum time to wait(in milliseconds, -1 to wait indefinitely).
+	Returns: 1 once the events are handled, -1 if the wait failed(with errno as epoll_wait
+			left it, eg EINTR if a signal arrived).
+*/
+int engine_dispatch(int timeout_msec)
+{
+	struct epoll_event events[ENGINE_MAX_EVENTS];
+	struct ENGINE_HANDLER *h;
+	int count;
+	int err;
+	int i;
+
+	count = epoll_wait(engine_fd, events, ENGINE_MAX_EVENTS, timeout_msec);
+	engine_stats.wakeups++;
+	if (count < 0) {
+		err = errno;
+		if (err != EINTR) perror("Unable to wait for events.");
+		errno = err;
+		return -1;
+	}
+
+	for (i=0; i<count; i++) {
+		h = events[i].data.ptr;
+		h->handle(h, events[i].events);
+	}
+
+	return 1;
+}
+
+/**
+	Arms the deadline of the transaction in progress.
+
+	Inputs: The serial port, and the time from now(in milliseconds, 0 to disarm).
+*/
+void port_arm_timer(struct SERIAL_PORT *port, long msec)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(struct itimerspec));
+	its.it_value.tv_sec = msec / 1000;
+	its.it_value.tv_nsec = (msec % 1000) * 1000000;
+	timerfd_settime(port->timer.fd, 0, &its, NULL);
+}
+
+/**
+	Schedules the failed transaction in progress to be attempted again, after a delay that
+	doubles with each retry(plus random jitter, so the bus has time to settle and retries
+	do not fall into step with a periodic disturbance). Each transaction is retried at most
+	INV_MAX_RETRIES times, and each serial port at most PORT_RETRY_BUDGET times per poll,
+	so a failing bus cannot stretch the poll far beyond its schedule.
+
+	Inputs: The serial port.
+	Returns: 1 if the transaction will be retried, 0 otherwise.
+*/
+int port_retry_transaction(struct SERIAL_PORT *port)
+{
+	struct TRANSACTION *txn;
+	char strDesc[SPAN_DESC_LENGTH];
+	long delay;
+
+	txn = &port->txns[port->txn];
+	if ((txn->attempts >= INV_MAX_RETRIES) || (port->retries >= PORT_RETRY_BUDGET) || (port->io.fd < 0)) return 0;
+
+	delay = RETRY_BACKOFF_MSEC << txn->attempts;
+	if (delay > RETRY_BACKOFF_MAX_MSEC) delay = RETRY_BACKOFF_MAX_MSEC;
+	delay += rand() % (delay + 1);
+
+	txn->attempts++;
+	port->retries++;
+	engine_stats.retries++;
+	if (verbose) {
+		describe_span(&txn->span, strDesc, sizeof(strDesc));
+		printf("Retrying %s from address %d in %ld ms(retry %d of %d).\n", strDesc, inv_devices[txn->device].address, delay, txn->attempts, INV_MAX_RETRIES);
+	}
+
+	port->state = PORT_BACKOFF;
+	port_arm_timer(port, delay);
+
+	return 1;
+}
+
+/**
+	Completes the transaction in progress, decoding the response if one was received. A
+	failed request is retried instead, while the transaction and the serial port have
+	retries left.
+
+	Inputs: The serial port, and 1 if a response frame was received.
+	Returns: 1 if the port moves on to its next transaction, 0 if the transaction will be retried.
+*/
+int port_end_transaction(struct SERIAL_PORT *port, int received)
+{
+	struct TRANSACTION *txn;
+	struct INVERTER *dev;
+	char strDesc[SPAN_DESC_LENGTH];
+	long duration;
+	int i;
+
+	txn = &port->txns[port->txn];
+	dev = &inv_devices[txn->device];
+	port_arm_timer(port, 0);
+	port->state = PORT_IDLE;
+
+	engine_stats.transactions++;
+	if (!received) {
+		engine_stats.failures++;
+	} else {
+		// Count the request and response time of the attempt in the duration histogram.
+		duration = get_time_usec() - port->start_usec;
+		for (i=0; (i < ENGINE_DURATION_BUCKETS) && (duration > engine_duration_bounds[i] * 1000L); i++);
+		engine_stats.durations[i]++;
+		engine_stats.duration_usec += duration;
+	}
+	if (engine_observer != NULL) engine_observer(port, txn, received);
+
+	if (txn->wake) {
+		dev->awake = 1;
+	} else if ((received) && (port->rx[3] == txn->span.length * 2)) {
+		// The framing and CRC were validated as the bytes arrived, so the data is decoded in place.
+		decode_span(&txn->span, (char *) port->rx + 4, &dev->ii);
+		mark_span_read(dev, &txn->span);
+	} else if (received) {
+		if (verbose) fprintf(stderr, "The response from address %d held %d bytes, not %d.\n", dev->address, port->rx[3], txn->span.length * 2);
+		if (port_retry_transaction(port)) return 0;
+	} else if (!dev->silent) {
+		if (verbose) {
+			describe_span(&txn->span, strDesc, sizeof(strDesc));
+			fprintf(stderr, "Did not receive expected response via %s for '%s' from address %d\n", port->dev_name, strDesc, dev->address);
+		}
+
+		// A garbled response is retried. So is silence from an inverter that answered its last poll,
+		// but an inverter that is already failing is not held up further.
+		if (port->waiting) backoff_inverter_latency(dev);
+		if (((!port->waiting) || (dev->fail_count == 0)) && (port_retry_transaction(port))) return 0;
+
+		// An inverter that did not answer at all is not sent its remaining requests this poll.
+		if (port->waiting) dev->silent = 1;
+	}
+
+	port->txn++;
+	return 1;
+}
+
+/**
+	Completes the transaction in progress(see port_end_transaction()), and starts the next
+	transaction.
+
+	Inputs: The serial port, and 1 if a response frame was received.
+*/
+void port_finish_transaction(struct SERIAL_PORT *port, int received)
+{
+	if (port_end_transaction(port, received)) port_start_transaction(port);
+}
+
+/**
+	Writes as much of the request as the serial port accepts. Once the whole request is
+	written, waits for the response with the first-byte deadline armed.
+
+	Inputs: The serial port.
+	Returns: 1 on success, -1 if the request could not be written.
+*/
+int port_write(struct SERIAL_PORT *port)
+{
+	int written;
+
+	written = write(port->fd, port->tx + port->tx_pos, REQUEST_LENGTH - port->tx_pos);
+	if (written > 0) {
+		port->tx_pos += written;
+		engine_stats.bytes_tx += written;
+	} else if ((written < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+		fprintf(stderr, "Error writing command to serial port %s.\n", port->dev_name);
+		return -1;
+	}
+
+	if (port->tx_pos < REQUEST_LENGTH) {
+		// Wait for the serial port to accept the rest of the request.
+		engine_modify_handler(&port->io, EPOLLIN | EPOLLOUT);
+	} else {
+		engine_modify_handler(&port->io, EPOLLIN);
+		port->state = PORT_READING;
+		port->waiting = 1;
+		port->sent_at = get_time_msec();
+		port->sent_usec = get_time_usec();
+		port_arm_timer(port, get_wire_time_msec(port->fd, REQUEST_LENGTH) + inv_devices[port->txns[port->txn].device].rto);
+	}
+
+	return 1;
+}
+
+/**
+	Starts the next transaction on the serial port, or completes the port's poll if none
+	are left. Transactions that fail straight away(the serial port has gone away, the
+	inverter is not answering, or the request cannot be written) are completed in turn
+	here, rather than each starting the next.
+
+	Inputs: The serial port.
+*/
+void port_start_transaction(struct SERIAL_PORT *port)
+{
+	struct TRANSACTION *txn;
+	struct INVERTER *dev;
+	char strDesc[SPAN_DESC_LENGTH];
+	unsigned char *frame;
+	int start;
+	int length;
+
+	while (1) {
+		// Complete the port's poll once all transactions are done.
+		if (port->txn >= port->txn_count) {
+			port->txn_count = 0;
+			engine_pending--;
+			return;
+		}
+
+		txn = &port->txns[port->txn];
+		dev = &inv_devices[txn->device];
+		port->waiting = 0;
+
+		// Fail straight away if the serial port has gone away, or the inverter is not answering.
+		if ((port->io.fd >= 0) && ((!dev->silent) || (txn->wake))) {
+			// Use the inverter's request frame, built the first time it was needed(or build it, if none is left).
+			start = (txn->wake) ? 0x01 : txn->span.start;
+			length = (txn->wake) ? 10 : txn->span.length;
+			frame = get_request_frame(dev, start, length);
+			if (frame != NULL) memcpy(port->tx, frame, REQUEST_LENGTH);
+			else build_read_request(port->tx, dev->address, start, length);
+			port->rx_len = length*2+7;
+
+			if (verbose) {
+				if (txn->wake) snprintf(strDesc, sizeof(strDesc), "Serial Port Initialisation");
+				else describe_span(&txn->span, strDesc, sizeof(strDesc));
+				printf("Performing %s on %s(address %d).\n", strDesc, port->dev_name, dev->address);
+			}
+
+			// Discard stale input, and write the request.
+			tcflush(port->fd, TCIFLUSH);
+			frame_reset(&port->fa, dev->address, FUNC_READ_REGISTERS);
+			port->tx_pos = 0;
+			port->start_usec = get_time_usec();
+			port->first_usec = 0;
+			port->state = PORT_WRITING;
+			port_arm_timer(port, get_wire_time_msec(port->fd, REQUEST_LENGTH) + dev->rto);
+			if (port_write(port) == 1) return;
+		}
+
+		// A transaction that is retried resumes from its backoff timer.
+		if (!port_end_transaction(port, 0)) return;
+	}
+}
+
+/**
+	Handles serial port events: writes the rest of a request, or assembles the response.
+*/
+void port_handle_io(struct ENGINE_HANDLER *h, unsigned int events)
+{
+	struct SERIAL_PORT *port = h->context;
+	unsigned char rxBuf[FRAME_RING_SIZE];
+	long latency;
+	int bufRead;
+	int frame_len;
+
+	if ((events & EPOLLOUT) && (port->state == PORT_WRITING) && (port_write(port) != 1)) port_finish_transaction(port, 0);
+
+	if (events & EPOLLIN) {
+		bufRead = read(port->fd, rxBuf, frame_space(&port->fa));
+		if (bufRead > 0) engine_stats.bytes_rx += bufRead;
+		if ((bufRead > 0) && (port->state == PORT_READING)) {
+			frame_push(&port->fa, rxBuf, bufRead);
+
+			// The inverter is answering: measure its turnaround, and allow time for the rest of the response.
+			if (port->waiting) {
+				port->waiting = 0;
+				port->first_usec = get_time_usec();
+				latency = get_time_msec() - port->sent_at - get_wire_time_msec(port->fd, REQUEST_LENGTH);
+				update_inverter_latency(&inv_devices[port->txns[port->txn].device], (latency > 0) ? latency : 0);
+				port_arm_timer(port, get_wire_time_msec(port->fd, port->rx_len) + READ_SLACK_MSEC);
+			}
+
+			frame_len = port->rx_len;
+			if (frame_extract(&port->fa, port->rx, &frame_len) == 1) {
+				port->rx_len = frame_len;
+				port_finish_transaction(port, 1);
+			}
+		}
+	}
+
+	// Close a serial port that has gone away(it is opened again by a later poll), and fail its transactions.
+	if ((events & (EPOLLERR | EPOLLHUP)) && (port->io.fd >= 0)) {
+		fprintf(stderr, "Serial port %s has gone away.\n", port->dev_name);
+		engine_remove_handler(&port->io);
+		close_port(port->fd);
+		port->fd = -1;
+		port->io.fd = -1;
+		if ((port->state == PORT_WRITING) || (port->state == PORT_READING)) port_finish_transaction(port, 0);
+	}
+}
+
+/**
+	Handles the transaction deadline passing.
+*/
+void port_handle_timer(struct ENGINE_HANDLER *h, unsigned int events)
+{
+	struct SERIAL_PORT *port = h->context;
+	unsigned long long expirations;
+
+	(void) events;
+	if (read(port->timer.fd, &expirations, sizeof(expirations)) < 0) return;
+	if (port->state == PORT_BACKOFF) {
+		port->state = PORT_IDLE;
+		port_start_transaction(port);
+	} else if (port->state != PORT_IDLE) {
+		port_finish_transaction(port, 0);
+	}
+}
+
+/**
+	Adds the open serial ports, and a deadline timer for each, to the engine.
+
+	Returns: 1 on success, -1 otherwise.
+*/
+int engine_add_ports()
+{
+	struct SERIAL_PORT *port;
+	int i;
+
+	for (i=0; i<sp_count; i++) {
+		port = &sp_ports[i];
+		port->state = PORT_IDLE;
+		port->txn_count = 0;
+
+		port->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (port->timer.fd < 0) {
+			perror("Unable to create transaction timer.");
+			return -1;
+		}
+		port->timer.handle = port_handle_timer;
+		port->timer.context = port;
+
+		port->io.fd = port->fd;
+		port->io.handle = port_handle_io;
+		port->io.context = port;
+
+		if (engine_add_handler(&port->timer, EPOLLIN) != 1) return -1;
+		if (engine_add_handler(&port->io, EPOLLIN) != 1) return -1;
+	}
+
+	return 1;
+}
+
+/**
+	Opens a serial port again after it went away(eg a USB-serial adapter that was unplugged,
+	or re-enumerated), at the baud rate it was last switched to, and adds it back to the
+	engine. Its inverters are woken again, and polled from this poll.
+
+	Inputs: The index of the serial port.
+	Returns: 1 on success, -1 if the serial port is still unavailable.
+*/
+int port_reopen(int i)
+{
+	struct SERIAL_PORT *port = &sp_ports[i];
+	int baud_rate;
+	int j;
+
+	// Only try devices that are back, rather than report the missing device every poll.
+	if (access(port->dev_name, R_OK | W_OK) != 0) return -1;
+
+	port->fd = open_port(port->dev_name);
+	if (port->fd < 0) return -1;
+	baud_rate = port->baud_rate;
+	port->baud_rate = 0;
+	if ((baud_rate != 0) && (baud_rate != sp_baud_rate)) set_port_baud(i, baud_rate);
+
+	port->io.fd = port->fd;
+	if (engine_add_handler(&port->io, EPOLLIN) != 1) {
+		close_port(port->fd);
+		port->fd = -1;
+		port->io.fd = -1;
+		return -1;
+	}
+
+	for (j=0; j<inv_count; j++) {
+		if (inv_devices[j].port != i) continue;
+		inv_devices[j].awake = 0;
+		inv_devices[j].skip_polls = 0;
+	}
+	printf("Serial port %s is back, and was opened again.\n", port->dev_name);
+
+	return 1;
+}
+
+/**
+	Removes the serial ports, and their deadline timers, from the engine.
+*/
+void engine_remove_ports()
+{
+	int i;
+
+	for (i=0; i<sp_count; i++) {
+		if (sp_ports[i].io.fd >= 0) engine_remove_handler(&sp_ports[i].io);
+		engine_remove_handler(&sp_ports[i].timer);
+		close(sp_ports[i].timer.fd);
+		sp_ports[i].io.fd = -1;
+		sp_ports[i].timer.fd = -1;
+	}
+}
+
+/**
+	Polls every inverter on every serial port. Each serial port runs its own sequence of
+	transactions(interleaved across its inverters, one at a time on the bus), and all serial
+	ports run concurrently from this thread. Returns once every transaction has completed
+	or timed out.
+*/
+void engine_poll_cycle()
+{
+	static struct READ_SPAN spans[INV_MAX_DEVICES][INV_MAX_SPANS];
+	static int span_counts[INV_MAX_DEVICES];
+	struct SERIAL_PORT *port;
+	struct TRANSACTION *txn;
+	int max_spans;
+	int i, j, k;
+
+	// Open the serial ports that went away again, if they are back.
+	for (i=0; i<sp_count; i++) {
+		if (sp_ports[i].io.fd < 0) port_reopen(i);
+	}
+
+	// Plan each inverter's reads, mark the blocks about to be read again as stale, and skip inverters that are waiting to be probed again.
+	max_spans = 0;
+	for (j=0; j<inv_count; j++) {
+		span_counts[j] = plan_inverter_reads(&inv_devices[j], spans[j]);
+		if (span_counts[j] > max_spans) max_spans = span_counts[j];
+		mark_blocks_stale(&inv_devices[j].ii, inv_devices[j].blocks);
+		inv_devices[j].silent = 0;
+		inv_devices[j].skipped = (inv_devices[j].skip_polls > 0);
+		if (inv_devices[j].skipped) inv_devices[j].skip_polls--;
+	}
+
+	// Queue the transactions for each serial port: wake requests first, then each span across its inverters.
+	for (i=0; i<sp_count; i++) {
+		port = &sp_ports[i];
+		port->txn_count = 0;
+		port->txn = 0;
+		port->retries = 0;
+
+		for (j=0; j<inv_count; j++) {
+			if ((inv_devices[j].port != i) || (inv_devices[j].awake) || (inv_devices[j].skipped)) continue;
+			txn = &port->txns[port->txn_count++];
+			txn->device = j;
+			txn->wake = 1;
+			txn->attempts = 0;
+		}
+		for (k=0; k<max_spans; k++) {
+			for (j=0; j<inv_count; j++) {
+				if ((inv_devices[j].port != i) || (inv_devices[j].skipped) || (k >= span_counts[j])) continue;
+				txn = &port->txns[port->txn_count++];
+				txn->device = j;
+				txn->wake = 0;
+				txn->attempts = 0;
+				txn->span = spans[j][k];
+			}
+		}
+	}
+
+	// Start every serial port, and run until all have finished.
+	engine_pending = 0;
+	for (i=0; i<sp_count; i++) {
+		if (sp_ports[i].txn_count > 0) engine_pending++;
+	}
+	for (i=0; i<sp_count; i++) {
+		if (sp_ports[i].txn_count > 0) port_start_transaction(&sp_ports[i]);
+	}
+	while (engine_pending > 0) engine_dispatch(-1);
+}
+
+/**
+	Handles events(eg late or stray serial bytes) while no poll is running.
+
+	Inputs: The time to wait(in milliseconds). Returns early if a signal arrives.
+*/
+void engine_wait(long msec)
+{
+	long deadline;
+	long remaining;
+
+	deadline = get_time_msec() + msec;
+	while ((remaining = deadline - get_time_msec()) > 0) {
+		// errno is only tested when the wait itself failed, as the handlers' calls may change it.
+		if ((engine_dispatch((int) remaining) != 1) && (errno == EINTR)) return;
+	}
+}
@@ -0,0 +1,24 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Requests serial data from a Motech inverter via Serial, and
+					sends it via Wi-Fi/Socket connection.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../Application/global.h"
+
+// External declarations.
+extern struct ENGINE_STATS engine_stats;
+extern long 	engine_duration_bounds[];
+extern void 	(*engine_observer)(struct SERIAL_PORT *, struct TRANSACTION *, int);
+extern int 		engine_init();
+extern int 		engine_add_handler(struct ENGINE_HANDLER *, unsigned int);
+extern int 		engine_modify_handler(struct ENGINE_HANDLER *, unsigned int);
+extern void 	engine_remove_handler(struct ENGINE_HANDLER *);
+extern int 		engine_dispatch(int);
+extern int 		engine_add_ports();
+extern void 	engine_remove_ports();
+extern void 	engine_poll_cycle();
+extern void 	engine_wait(long);
@@ -7,119 +7,382 @@
 */
 
 #include "../Application/global.h"
+#include "resolver.h"
 
 /**
-	Resolves IP Address for a hostname.
-	
-	Inputs	: Hostname to connect to.
-	Returns : An IP address.
+	Closes a connection(it is opened again by the next request).
+
+	Inputs: The connection.
+*/
+void http_close(struct HTTP_CONNECTION *conn)
+{
+	if (conn->fd < 0) return;
+
+	shutdown(conn->fd, SHUT_RDWR);
+	close(conn->fd);
+	conn->fd = -1;
+
+	if (verbose) printf("Connection to %s closed.\n", conn->host);
+}
+
+/**
+	Opens a connection to the connection's host, trying each of its addresses in turn.
+	Sending, receiving and connecting are each limited to HTTP_TIMEOUT_SEC.
+
+	Inputs: The connection.
+	Returns: 1 on success, -1 otherwise.
 */
-char *get_ip_for_hostname(char *hostname)
+int http_connect(struct HTTP_CONNECTION *conn)
 {
-	struct hostent *hent;
-	char *ip_addr;
-
-	// Memory allocations.
-	ip_addr = (char *)malloc(16);
-	memset(ip_addr, 0, 16);
-
-	// Get the IP address by the hostname.
-	if((hent = gethostbyname(hostname)) == NULL)
-	{
-		fprintf(stderr, "Cannot resolve IP address for: %s\n", hostname);
-		free(ip_addr);
-		return NULL;
+	struct HOST_ADDRESS addrs[RESOLVE_MAX_ADDRS];
+	struct timeval tv;
+	char strAddr[NI_MAXHOST];
+	int count;
+	int i;
+
+	// Get the addresses for the hostname(from the resolver cache, without waiting on DNS once known).
+	count = resolve_host(conn->host, conn->port, addrs, RESOLVE_MAX_ADDRS);
+
+	for (i=0; i<count; i++) {
+		if (getnameinfo((struct sockaddr *) &addrs[i].addr, addrs[i].len, strAddr, sizeof(strAddr), NULL, 0, NI_NUMERICHOST) != 0) strcpy(strAddr, "?");
+		if (verbose) printf("Connecting to %s(%s).\n", conn->host, strAddr);
+
+		// Create the socket, and limit the time a slow network can hold up each step.
+		conn->fd = socket(addrs[i].addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+		if (conn->fd == -1)
+		{
+			fprintf(stderr, "Cannot connect to Internet socket.\n");
+			continue;
+		}
+		tv.tv_sec = HTTP_TIMEOUT_SEC;
+		tv.tv_usec = 0;
+		setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		// Connect to the socket.
+		if (connect(conn->fd, (struct sockaddr *) &addrs[i].addr, addrs[i].len) == 0)
+		{
+			conn->connects++;
+			conn->used_at = time(NULL);
+			if (verbose) printf("Connection opened successfully.\n");
+			return 1;
+		}
+
+		fprintf(stderr, "Cannot connect to %s(%s): %s\n", conn->host, strAddr, strerror(errno));
+		close(conn->fd);
+		conn->fd = -1;
 	}
 
-	// Check the IP Address for the website.
-	if(inet_ntop(AF_INET, (void *)hent->h_addr_list[0], ip_addr, 15) == NULL)
-	{
-		fprintf(stderr, "Invalid IP Address for %s.\n", hostname);
+	// The host may have moved, so look it up again(still using these addresses until the lookup completes).
+	if (count > 0) resolver_invalidate(conn->host, conn->port);
+
+	return -1;
+}
+
+/**
+	Checks whether an open connection can still be used. A connection that has been idle
+	too long is closed, as is one the server has closed(or sent unexpected data on).
+
+	Inputs: The connection.
+	Returns: 1 if the connection can be reused, 0 otherwise.
+*/
+int http_is_reusable(struct HTTP_CONNECTION *conn)
+{
+	char c;
+
+	if (conn->fd < 0) return 0;
+
+	if ((time(NULL) - conn->used_at < HTTP_IDLE_SEC) &&
+		(recv(conn->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) return 1;
+
+	http_close(conn);
+	return 0;
+}
+
+/**
+	Writes all of a buffer to a socket(a closed connection returns an error, rather than
+	raising SIGPIPE).
+
+	Inputs: The socket, the buffer, and its length.
+	Returns: 1 on success, -1 otherwise.
+*/
+int http_send_all(int fd, char *buf, int len)
+{
+	int sent;
+	int n;
+
+	for (sent = 0; sent < len; sent += n) {
+		n = send(fd, buf + sent, len - sent, MSG_NOSIGNAL);
+		if (n <= 0) return -1;
 	}
 
-	return ip_addr;
+	return 1;
 }
 
 /**
-	Send response via GET for HTTP.
-	
-	Inputs: The hostname and the HTTP request.
+	Finds a header of the last response.
+
+	Inputs: The connection, the header name, and the buffer for the value(and its size).
+	Returns: 1 if the header was found, 0 otherwise.
 */
-void send_response_http(char *hostname, char *http_request)
+int http_get_header(struct HTTP_CONNECTION *conn, char *name, char *strOut, int size)
 {
-	int retVal;
-	int fd;
-	int tmpip;
-	char *ip_addr;
-	struct sockaddr_in *sckaddr;
-
-	printf("Connecting to %s.\n", hostname);
-	
-	// Create socket.
-	fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (fd == -1)
-	{
-		fprintf(stderr, "Cannot connect to Internet socket.\n");
-		return;
+	char *line;
+	char *end;
+	int name_len;
+	int len;
+
+	name_len = strlen(name);
+	line = strstr(conn->response, "\r\n");
+	while ((line != NULL) && (line + 2 < conn->response + conn->header_len)) {
+		line += 2;
+		end = strstr(line, "\r\n");
+		if (end == NULL) break;
+
+		if ((strncasecmp(line, name, name_len) == 0) && (line[name_len] == ':')) {
+			line += name_len + 1;
+			while ((*line == ' ') || (*line == '\t')) line++;
+			len = end - line;
+			if (len >= size) len = size - 1;
+			memcpy(strOut, line, len);
+			strOut[len] = 0;
+			return 1;
+		}
+		line = end;
 	}
 
-	// Get the IP address for the hostname.
-	ip_addr = get_ip_for_hostname(hostname);
-	if (ip_addr == NULL)
-	{
-		close(fd);
-		return;
+	return 0;
+}
+
+/**
+	Decodes a chunked body in place, once all of it has been received.
+
+	Inputs: The body(null-terminated), and its length.
+	Returns: The length of the decoded body, or -1 if the body is not yet complete.
+*/
+int http_decode_chunks(char *body, int len)
+{
+	char *in;
+	char *end;
+	long chunk;
+	int decode;
+	int out;
+
+	// The chunks are checked before any are moved, so an incomplete body is left as it is.
+	for (decode=0; decode<2; decode++) {
+		in = body;
+		out = 0;
+		for (;;) {
+			chunk = strtol(in, &end, 16);
+			if ((end == in) || (chunk < 0)) return -1;
+			end = strstr(end, "\r\n");
+			if (end == NULL) return -1;
+			in = end + 2;
+
+			// The last chunk is followed by(optional trailers and) a blank line.
+			if (chunk == 0) {
+				while ((end = strstr(in, "\r\n")) != in) {
+					if (end == NULL) return -1;
+					in = end + 2;
+				}
+				break;
+			}
+			if ((in + chunk + 2) - body > len) return -1;
+			if (decode) memmove(body + out, in, chunk);
+			out += chunk;
+			in += chunk + 2;
+		}
 	}
 
-	// Initialise the socket address structure.
-	sckaddr = (struct sockaddr_in *) malloc(sizeof(struct sockaddr_in *));
-	sckaddr->sin_family = AF_INET;
-
-	// Confirm the IP address is good, and set the destination port to port 80.
-  	tmpip = inet_pton(AF_INET, ip_addr, (void *)(&(sckaddr->sin_addr.s_addr)));
-	if(tmpip <= 0)  
-	{
-		fprintf(stderr, "Invalid IP address resolved.\n");
-		close(fd);
-		free(ip_addr);
-		return;
+	body[out] = 0;
+	return out;
+}
+
+/**
+	Receives the response to a request, keeping it in the connection. A body larger than
+	the response buffer is discarded beyond what fits.
+
+	Inputs: The connection.
+	Returns: 1 if the whole response was received, 0 if the connection was closed before
+			any of it arrived, -1 otherwise(in either case the connection must be closed,
+			as it is no longer in step with the server).
+*/
+int http_read_response(struct HTTP_CONNECTION *conn)
+{
+	char discard[BUFSIZ];
+	char strValue[LINE_LENGTH * 2];
+	char *end;
+	long content_length;
+	long remaining;
+	int chunked;
+	int len;
+	int n;
+
+	conn->status = 0;
+	conn->header_len = 0;
+	conn->body = conn->response;
+	conn->body_len = 0;
+
+	// Receive the status line and headers.
+	len = 0;
+	end = NULL;
+	while (end == NULL) {
+		if (len >= HTTP_RESPONSE_SIZE) return -1;
+		n = recv(conn->fd, conn->response + len, HTTP_RESPONSE_SIZE - len, 0);
+		if (n <= 0) {
+			// A server that had given up on the connection closes it without answering.
+			if ((len == 0) && ((n == 0) || (errno == ECONNRESET))) return 0;
+			return -1;
+		}
+		len += n;
+		conn->response[len] = 0;
+		end = strstr(conn->response, "\r\n\r\n");
 	}
-	sckaddr->sin_port = htons(80);
-
-	// Connect to the socket.
-	if (connect(fd, (struct sockaddr *)sckaddr, sizeof(struct sockaddr)) < 0)
-	{
-		perror("Cannot connect to Internet socket correctly.");
-		close(fd);
-		free(ip_addr);
-		return;
+	conn->header_len = (end + 4) - conn->response;
+
+	if ((sscanf(conn->response, "HTTP/%*d.%*d %d", &conn->status) != 1) || (conn->status < 100)) return -1;
+
+	// Receive the body, as described by the headers.
+	conn->body = conn->response + conn->header_len;
+	chunked = (http_get_header(conn, "Transfer-Encoding", strValue, sizeof(strValue))) && (strcasecmp(strValue, "chunked") == 0);
+	content_length = -1;
+	if (http_get_header(conn, "Content-Length", strValue, sizeof(strValue))) content_length = atol(strValue);
+	if ((conn->status == 204) || (conn->status == 304) || (conn->status < 200)) content_length = 0;
+
+	if (chunked) {
+		while ((conn->body_len = http_decode_chunks(conn->body, len - conn->header_len)) < 0) {
+			if (len >= HTTP_RESPONSE_SIZE) return -1;
+			n = recv(conn->fd, conn->response + len, HTTP_RESPONSE_SIZE - len, 0);
+			if (n <= 0) return -1;
+			len += n;
+			conn->response[len] = 0;
+		}
+	} else if (content_length >= 0) {
+		// Keep what fits, and discard the rest so the next response is read from its start.
+		remaining = content_length - (len - conn->header_len);
+		while ((remaining > 0) && (len < HTTP_RESPONSE_SIZE)) {
+			n = recv(conn->fd, conn->response + len, ((remaining < HTTP_RESPONSE_SIZE - len) ? remaining : HTTP_RESPONSE_SIZE - len), 0);
+			if (n <= 0) return -1;
+			len += n;
+			remaining -= n;
+		}
+		while (remaining > 0) {
+			n = recv(conn->fd, discard, ((remaining < (long) sizeof(discard)) ? remaining : (long) sizeof(discard)), 0);
+			if (n <= 0) return -1;
+			remaining -= n;
+		}
+		if (remaining < 0) return -1;
+		conn->body_len = len - conn->header_len;
+		conn->body[conn->body_len] = 0;
+	} else {
+		// Without a length, the body ends when the server closes the connection.
+		while ((n = recv(conn->fd, conn->response + len, HTTP_RESPONSE_SIZE - len, 0)) > 0) {
+			len += n;
+			if (len >= HTTP_RESPONSE_SIZE) break;
+		}
+		conn->body_len = len - conn->header_len;
+		conn->body[conn->body_len] = 0;
+		http_close(conn);
 	}
 
-	printf("Connection opened successfully.\n");
+	return 1;
+}
 
-	// Write the HTTP request to the socket.
-	retVal = write(fd, http_request, strlen(http_request));
+/**
+	Formats the value of a connection's Host header: the host, followed by the port unless
+	it is HTTP's default(virtual hosts and proxies route on the whole value).
 
-	// Close the connection.
-	shutdown(fd, SHUT_RDWR);
-	close(fd);
-	free(ip_addr);
+	Inputs: The connection, and the buffer for the value(and its size).
+*/
+void http_host_value(struct HTTP_CONNECTION *conn, char *strOut, int size)
+{
+	if (conn->port == HTTP_DEFAULT_PORT) snprintf(strOut, size, "%s", conn->host);
+	else snprintf(strOut, size, "%s:%d", conn->host, conn->port);
+}
+
+/**
+	Sends a request on a keep-alive connection, and receives its response. The connection
+	is opened if needed, and kept open for the next request unless the server closes it.
+	If a reused connection turns out to have been closed by the server(or the network),
+	the request is sent again on a new connection. A request the server may have acted
+	on(eg one whose response timed out) is not sent again, as it may not be idempotent.
+
+	Inputs: The connection, and the HTTP request.
+	Returns: The response's status code, or -1 if no response was received.
+*/
+int http_send_request(struct HTTP_CONNECTION *conn, char *http_request)
+{
+	char strValue[LINE_LENGTH];
+	int reused;
+	int result;
+	int len;
+
+	len = strlen(http_request);
+	for (;;) {
+		reused = http_is_reusable(conn);
+		if ((!reused) && (http_connect(conn) != 1)) return -1;
+		if ((reused) && (verbose)) printf("Reusing the connection to %s.\n", conn->host);
+
+		// Write the HTTP request to the socket, and read the response.
+		result = (http_send_all(conn->fd, http_request, len) == 1) ? http_read_response(conn) : 0;
+		if (result == 1) break;
+
+		// Only a reused connection the request could not be sent on, or that was closed unanswered, is retried.
+		http_close(conn);
+		if ((!reused) || (result < 0)) {
+			fprintf(stderr, "No response was received from %s.\n", conn->host);
+			return -1;
+		}
+	}
+
+	conn->requests++;
+	conn->used_at = time(NULL);
+
+	// Close the connection if the server will not keep it open.
+	if ((conn->fd >= 0) && (((http_get_header(conn, "Connection", strValue, sizeof(strValue))) && (strcasecmp(strValue, "close") == 0)) ||
+		(strncmp(conn->response, "HTTP/1.0", 8) == 0))) http_close(conn);
 
-	printf("Connection closed successfully.\n");
+	return conn->status;
 }
 
 /**
-	Send the HTTP response to the pvoutput website.
-	
-	Inputs: The inverter info.
+	Sends a batch of statuses to the pvoutput website, asking for its rate limit headers.
+
+	Inputs: The statuses(in the Add Batch Status format, separated by ';'), and the
+			number of statuses.
+	Returns: The response's status code(200 if PVOutput processed the batch), or -1 if
+			no response was received.
 */
-void send_response_http_pvoutput(struct INVERTER_INFO *inv_info)
+int send_batch_http_pvoutput(char *data, int count)
 {
 	char strRequest[BUFSIZ];
+	char strHost[NI_MAXHOST + 8];
+	char *flag;
+	int status;
+	int added;
+
+	// Prepare the GET request for pvoutput(v1 is the lifetime energy, as c1 is set).
+	http_host_value(&pvo_conn, strHost, sizeof(strHost));
+	if (snprintf(strRequest, sizeof(strRequest), "GET %s?key=%s&sid=%s&c1=1&data=%s HTTP/1.1\r\nHost: %s\r\nX-Rate-Limit: 1\r\nConnection: keep-alive\r\n\r\n",
+			PVOUTPUT_BATCH_PATH, pvo_api_key, pvo_sys_id, data, strHost) >= (int) sizeof(strRequest)) return 400;
+
+	// Send the statuses to pvoutput, and check they were processed.
+	status = http_send_request(&pvo_conn, strRequest);
+	if (status < 0) return -1;
+	if (status != 200) {
+		fprintf(stderr, "PVOutput did not accept the statuses(HTTP %d): %.100s\n", status, pvo_conn.body);
+		return status;
+	}
+
+	// Each status is reported as "date,time,1" if it was added(or "...,0" if it was not, eg too old).
+	added = 0;
+	for (flag = strchr(pvo_conn.body, ','); flag != NULL; flag = strchr(flag + 1, ',')) {
+		flag = strchr(flag + 1, ',');
+		if (flag == NULL) break;
+		if (flag[1] == '1') added++;
+	}
+	if (verbose) printf("PVOutput added %d of %d status(es).\n", added, count);
+	if (added < count) fprintf(stderr, "PVOutput did not add %d of %d status(es).\n", count - added, count);
 
-	// Prepare the GET request for pvoutput.
-	sprintf(strRequest, "GET http://pvoutput.org/service/r2/addstatus.jsp?key=%s&sid=%s&d=%s&t=%s&v2=%d&v6=%f&c1=%ld HTTP/1.1\r\nHost: www.pvoutput.org\r\n\r\n", pvo_api_key, pvo_sys_id, inv_info->dt.date, inv_info->dt.time, (int) inv_info->icv->Pac, inv_info->icv->Vac, (long) inv_info->itv->Eac);
-	
-	// Send the response to pvoutput.
-	send_response_http("www.pvoutput.org", strRequest);
+	return status;
 }
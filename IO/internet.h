@@ -10,6 +10,12 @@
 #include "../Application/global.h"
 
 // External Declarations.
-extern char *get_ip_for_hostname(char *);
-extern void send_response_http(char *, char *);
-extern void send_response_http_pvoutput(struct INVERTER_INFO *);
+extern void http_close(struct HTTP_CONNECTION *);
+extern int http_connect(struct HTTP_CONNECTION *);
+extern int http_is_reusable(struct HTTP_CONNECTION *);
+extern int http_send_all(int, char *, int);
+extern int http_get_header(struct HTTP_CONNECTION *, char *, char *, int);
+extern int http_decode_chunks(char *, int);
+extern void http_host_value(struct HTTP_CONNECTION *, char *, int);
+extern int http_send_request(struct HTTP_CONNECTION *, char *);
+extern int send_batch_http_pvoutput(char *, int);
@@ -0,0 +1,524 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Serves the latest sample and the poller's counters to Prometheus
+					scrapers, from the epoll engine between serial port events. The page
+					is rendered once per poll from the Inverter Info structures, so a
+					scrape never waits for, or adds to, the traffic on the serial bus.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../Application/global.h"
+#include "../Application/settings.h"
+#include "engine.h"
+
+struct METRICS_PAGE metrics_pages[2];		// The page scrapers are sent, and the page rendered next.
+int metrics_current = -1;					// Index of the page scrapers are sent(-1 until rendered).
+int metrics_full = 0;						// 1 once the page being rendered has no room left.
+struct METRICS_CLIENT metrics_clients[METRICS_MAX_CLIENTS];
+struct ENGINE_HANDLER metrics_listener = {.fd = -1};
+int metrics_waiting = 0;					// 1 while scrapers wait in the listen backlog for a free slot.
+
+void metrics_close_client(struct METRICS_CLIENT *);
+
+/**
+	Appends a line to the page being rendered. A line that does not fit is left out, as is
+	every line after it, so the page only holds whole lines.
+
+	Inputs: The page, and the format and values of the line.
+	Returns: 1 on success, -1 if the page is full.
+*/
+int metrics_add(struct METRICS_PAGE *page, const char *format, ...)
+{
+	va_list args;
+	int len;
+
+	if (metrics_full) return -1;
+
+	va_start(args, format);
+	len = vsnprintf(page->text + page->len, METRICS_PAGE_SIZE - page->len, format, args);
+	va_end(args);
+
+	if ((len < 0) || (page->len + len >= METRICS_PAGE_SIZE)) {
+		page->text[page->len] = 0;
+		metrics_full = 1;
+		fprintf(stderr, "The metrics do not fit in %d bytes, and were cut short.\n", METRICS_PAGE_SIZE);
+		return -1;
+	}
+	page->len += len;
+
+	return 1;
+}
+
+/**
+	Appends the help and type lines of a metric.
+
+	Inputs: The page, the metric name, its type(gauge, counter or histogram), and its help text.
+*/
+void metrics_add_family(struct METRICS_PAGE *page, char *name, char *type, char *help)
+{
+	metrics_add(page, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+	Gets the name a serial port is labelled with(its device name, without the directory).
+
+	Inputs: The index of the serial port.
+	Returns: The name.
+*/
+char *metrics_port_name(int port)
+{
+	char *name;
+
+	name = strrchr(sp_ports[port].dev_name, '/');
+	return (name != NULL) ? name + 1 : sp_ports[port].dev_name;
+}
+
+/**
+	Escapes a label value, putting a backslash before each backslash and double quote, and
+	writing each newline as \n.
+
+	Inputs: The value, the buffer, and its size.
+	Returns: 1 on success, -1 if the escaped value does not fit.
+*/
+int metrics_escape(char *value, char *strOut, int size)
+{
+	int len;
+	char *p;
+
+	len = 0;
+	for (p=value; *p; p++) {
+		if (len + 3 > size) return -1;
+		if ((*p == '\\') || (*p == '"')) strOut[len++] = '\\';
+		if (*p == '\n') {
+			strOut[len++] = '\\';
+			strOut[len++] = 'n';
+		} else strOut[len++] = *p;
+	}
+	if (len >= size) return -1;
+	strOut[len] = 0;
+
+	return 1;
+}
+
+/**
+	Formats the labels identifying an inverter, as port="ttyUSB0",address="45".
+
+	Inputs: The inverter, the buffer, and its size.
+	Returns: 1 on success, -1 if the labels do not fit.
+*/
+int metrics_labels(struct INVERTER *dev, char *strOut, int size)
+{
+	char strPort[METRICS_LABEL_LENGTH];
+	int len;
+
+	if (metrics_escape(metrics_port_name(dev->port), strPort, sizeof(strPort)) != 1) return -1;
+	len = snprintf(strOut, size, "port=\"%s\",address=\"%d\"", strPort, dev->address);
+	if ((len < 0) || (len >= size)) return -1;
+
+	return 1;
+}
+
+/**
+	Appends the numeric fields of one Inverter Info structure, as a gauge per field named
+	after its member(eg motech_vac), with a sample per inverter holding values from the
+	latest poll, and the values of an array told apart by an index label.
+
+	Inputs: The page, the field table, its number of entries, the offset of the structure in
+			INVERTER_INFO, its INFO_* flag, the prefix of the metric names, and the labels
+			of each inverter(empty for an inverter that is left out).
+*/
+void metrics_add_fields(struct METRICS_PAGE *page, struct REG_FIELD *fields, int field_count, int offset, unsigned int flag, char *prefix, char labels[][METRICS_LABEL_LENGTH])
+{
+	struct INVERTER_INFO *ii;
+	char strName[LINE_LENGTH * 2];
+	char strHelp[LINE_LENGTH * 3];
+	char strValue[LINE_LENGTH];
+	int i, j, k;
+	char *p;
+
+	for (i=0; i<field_count; i++) {
+		if (fields[i].type == REG_TYPE_CHAR) continue;
+
+		snprintf(strName, sizeof(strName), "motech_%s%s", prefix, fields[i].name);
+		for (p=strName; *p; p++) *p = tolower((unsigned char) *p);
+		if (fields[i].unit[0] != 0) snprintf(strHelp, sizeof(strHelp), "%s(%s)", fields[i].label, fields[i].unit);
+		else snprintf(strHelp, sizeof(strHelp), "%s", fields[i].label);
+		metrics_add_family(page, strName, "gauge", strHelp);
+
+		for (j=0; j<inv_count; j++) {
+			ii = &inv_devices[j].ii;
+			if ((labels[j][0] == 0) || (!(ii->valid & flag)) || (ii->stale & flag)) continue;
+
+			for (k=0; k<fields[i].count; k++) {
+				format_field(&fields[i], ((char *) ii) + offset, k, strValue, sizeof(strValue));
+				if (fields[i].count > 1) metrics_add(page, "%s{%s,index=\"%d\"} %s\n", strName, labels[j], k+1, strValue);
+				else metrics_add(page, "%s{%s} %s\n", strName, labels[j], strValue);
+			}
+		}
+	}
+}
+
+/**
+	Renders the page from the latest poll, for the scrapers that connect from now on. The
+	page is rendered over the one sent before it, unless a slow scraper is still being sent
+	that page, in which case scrapers are sent the current page until the next poll.
+*/
+void metrics_update()
+{
+	static char labels[INV_MAX_DEVICES][METRICS_LABEL_LENGTH];
+	static char ports[SP_MAX_PORTS][METRICS_LABEL_LENGTH];
+	struct METRICS_PAGE *page;
+	struct INVERTER *dev;
+	long count;
+	int next;
+	int i, j;
+
+	if (metrics_listener.fd < 0) return;
+
+	// Turn away scrapers that ran out of time.
+	for (i=0; i<METRICS_MAX_CLIENTS; i++) {
+		if ((metrics_clients[i].h.fd >= 0) && (get_time_msec() - metrics_clients[i].opened_at > METRICS_TIMEOUT_SEC * 1000L)) {
+			metrics_close_client(&metrics_clients[i]);
+		}
+	}
+
+	next = (metrics_current + 1) % 2;
+	page = &metrics_pages[next];
+	if (page->readers > 0) return;
+	page->len = 0;
+	page->text[0] = 0;
+	metrics_full = 0;
+
+	// An inverter(or serial port) whose labels do not fit is left out, rather than served under broken labels.
+	for (j=0; j<inv_count; j++) {
+		if (metrics_labels(&inv_devices[j], labels[j], sizeof(labels[j])) != 1) labels[j][0] = 0;
+	}
+	for (i=0; i<sp_count; i++) {
+		if (metrics_escape(metrics_port_name(i), ports[i], sizeof(ports[i])) != 1) ports[i][0] = 0;
+	}
+
+	// The current values, state and total values of each inverter.
+	metrics_add_fields(page, REG_FIELDS(reg_icv), offsetof(struct INVERTER_INFO, icv), INFO_ICV, "", labels);
+	metrics_add_fields(page, REG_FIELDS(reg_ics), offsetof(struct INVERTER_INFO, ics), INFO_ICS, "", labels);
+	metrics_add_fields(page, REG_FIELDS(reg_itv), offsetof(struct INVERTER_INFO, itv), INFO_ITV, "total_", labels);
+
+	// How each inverter is answering.
+	metrics_add_family(page, "motech_up", "gauge", "1 if the inverter answered its latest poll");
+	for (j=0; j<inv_count; j++) {
+		dev = &inv_devices[j];
+		if (labels[j][0] == 0) continue;
+		metrics_add(page, "motech_up{%s} %d\n", labels[j], ((dev->polls > 0) && (dev->fail_count == 0)) ? 1 : 0);
+	}
+	metrics_add_family(page, "motech_polls_total", "counter", "Polls of the inverter");
+	for (j=0; j<inv_count; j++) if (labels[j][0] != 0) metrics_add(page, "motech_polls_total{%s} %ld\n", labels[j], inv_devices[j].polls);
+	metrics_add_family(page, "motech_poll_failures_total", "counter", "Polls without a valid sample");
+	for (j=0; j<inv_count; j++) if (labels[j][0] != 0) metrics_add(page, "motech_poll_failures_total{%s} %ld\n", labels[j], inv_devices[j].failures);
+	metrics_add_family(page, "motech_consecutive_failures", "gauge", "Consecutive polls without a valid sample");
+	for (j=0; j<inv_count; j++) if (labels[j][0] != 0) metrics_add(page, "motech_consecutive_failures{%s} %d\n", labels[j], inv_devices[j].fail_count);
+	metrics_add_family(page, "motech_turnaround_seconds", "gauge", "Latest turnaround latency of the inverter");
+	for (j=0; j<inv_count; j++) if (labels[j][0] != 0) metrics_add(page, "motech_turnaround_seconds{%s} %.3f\n", labels[j], inv_devices[j].latency / 1000.0);
+	metrics_add_family(page, "motech_turnaround_smoothed_seconds", "gauge", "Smoothed turnaround latency of the inverter");
+	for (j=0; j<inv_count; j++) if (labels[j][0] != 0) metrics_add(page, "motech_turnaround_smoothed_seconds{%s} %.3f\n", labels[j], inv_devices[j].srtt / 8000.0);
+	metrics_add_family(page, "motech_turnaround_timeout_seconds", "gauge", "Turnaround allowed for the next request to the inverter");
+	for (j=0; j<inv_count; j++) if (labels[j][0] != 0) metrics_add(page, "motech_turnaround_timeout_seconds{%s} %.3f\n", labels[j], inv_devices[j].rto / 1000.0);
+
+	// The serial ports and the engine.
+	metrics_add_family(page, "motech_crc_errors_total", "counter", "Response frames discarded as their CRC did not match");
+	for (i=0; i<sp_count; i++) if (ports[i][0] != 0) metrics_add(page, "motech_crc_errors_total{port=\"%s\"} %ld\n", ports[i], sp_ports[i].fa.crc_errors);
+	metrics_add_family(page, "motech_transactions_total", "counter", "Requests sent to the inverters(each retry counted)");
+	metrics_add(page, "motech_transactions_total %ld\n", engine_stats.transactions);
+	metrics_add_family(page, "motech_transaction_failures_total", "counter", "Requests without a valid response");
+	metrics_add(page, "motech_transaction_failures_total %ld\n", engine_stats.failures);
+	metrics_add_family(page, "motech_transaction_retries_total", "counter", "Failed requests sent again");
+	metrics_add(page, "motech_transaction_retries_total %ld\n", engine_stats.retries);
+	metrics_add_family(page, "motech_transaction_duration_seconds", "histogram", "Time from sending a request to its response being received");
+	for (i=0, count=0; i<ENGINE_DURATION_BUCKETS; i++) {
+		count += engine_stats.durations[i];
+		metrics_add(page, "motech_transaction_duration_seconds_bucket{le=\"%g\"} %ld\n", engine_duration_bounds[i] / 1000.0, count);
+	}
+	count += engine_stats.durations[ENGINE_DURATION_BUCKETS];
+	metrics_add(page, "motech_transaction_duration_seconds_bucket{le=\"+Inf\"} %ld\n", count);
+	metrics_add(page, "motech_transaction_duration_seconds_sum %.6f\n", engine_stats.duration_usec / 1000000.0);
+	metrics_add(page, "motech_transaction_duration_seconds_count %ld\n", count);
+	metrics_add_family(page, "motech_serial_transmit_bytes_total", "counter", "Bytes written to the serial ports");
+	metrics_add(page, "motech_serial_transmit_bytes_total %ld\n", engine_stats.bytes_tx);
+	metrics_add_family(page, "motech_serial_receive_bytes_total", "counter", "Bytes read from the serial ports");
+	metrics_add(page, "motech_serial_receive_bytes_total %ld\n", engine_stats.bytes_rx);
+	metrics_add_family(page, "motech_communication_failures", "gauge", "Failure count kept for restart on failure(-r)");
+	metrics_add(page, "motech_communication_failures %d\n", rof_fail_count);
+	metrics_add_family(page, "motech_last_poll_timestamp_seconds", "gauge", "Time of the latest poll");
+	metrics_add(page, "motech_last_poll_timestamp_seconds %ld\n", (long) time(NULL));
+
+	metrics_current = next;
+}
+
+/**
+	Closes a scraper's connection, and frees its slot.
+
+	Inputs: The client.
+*/
+void metrics_close_client(struct METRICS_CLIENT *c)
+{
+	engine_remove_handler(&c->h);
+	close(c->h.fd);
+	c->h.fd = -1;
+	if (c->page != NULL) c->page->readers--;
+	c->page = NULL;
+
+	// Accept a waiting scraper into the slot.
+	if (metrics_waiting) {
+		metrics_waiting = 0;
+		engine_modify_handler(&metrics_listener, EPOLLIN);
+	}
+}
+
+/**
+	Prepares the response to a scraper's request: the current page for GET /metrics, and an
+	error otherwise.
+
+	Inputs: The client.
+*/
+void metrics_respond(struct METRICS_CLIENT *c)
+{
+	char *path;
+	char *status;
+
+	path = c->request + 4;
+	if (strncmp(c->request, "GET ", 4) != 0) {
+		status = "405 Method Not Allowed";
+	} else if ((strncmp(path, "/metrics", 8) == 0) && ((path[8] == ' ') || (path[8] == '?'))) {
+		c->page = &metrics_pages[metrics_current];
+		c->page->readers++;
+		c->header_len = snprintf(c->header, METRICS_HEADER_SIZE, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", c->page->len);
+		c->sent = 0;
+		return;
+	} else {
+		status = "404 Not Found";
+	}
+
+	c->header_len = snprintf(c->header, METRICS_HEADER_SIZE, "HTTP/1.1 %s\r\nContent-Type: text/plain\r\nContent-Length: %d\r\nConnection: close\r\n\r\n%s\n", status, (int) strlen(status) + 1, status);
+	c->sent = 0;
+}
+
+/**
+	Sends as much of the response as the socket accepts, in one call for the header and
+	page. Once the whole response is sent, the connection is closed.
+
+	Inputs: The client.
+*/
+void metrics_send(struct METRICS_CLIENT *c)
+{
+	struct msghdr msg;
+	struct iovec iov[2];
+	int total;
+	int n;
+
+	total = c->header_len + ((c->page != NULL) ? c->page->len : 0);
+	while (c->sent < total) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 0;
+		if (c->sent < c->header_len) {
+			iov[msg.msg_iovlen].iov_base = c->header + c->sent;
+			iov[msg.msg_iovlen++].iov_len = c->header_len - c->sent;
+		}
+		if (c->page != NULL) {
+			n = (c->sent > c->header_len) ? c->sent - c->header_len : 0;
+			iov[msg.msg_iovlen].iov_base = c->page->text + n;
+			iov[msg.msg_iovlen++].iov_len = c->page->len - n;
+		}
+
+		n = sendmsg(c->h.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n > 0) {
+			c->sent += n;
+		} else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+			// Send the rest once the scraper has read some of it.
+			engine_modify_handler(&c->h, EPOLLOUT);
+			return;
+		} else {
+			break;
+		}
+	}
+
+	metrics_close_client(c);
+}
+
+/**
+	Handles scraper events: reads the request, then sends the response.
+*/
+void metrics_handle_client(struct ENGINE_HANDLER *h, unsigned int events)
+{
+	struct METRICS_CLIENT *c = h->context;
+	int n;
+
+	(void) events;
+	if (c->h.fd < 0) return;
+
+	if (c->header_len == 0) {
+		n = recv(c->h.fd, c->request + c->request_len, METRICS_REQUEST_SIZE - 1 - c->request_len, MSG_DONTWAIT);
+		if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) return;
+		if (n <= 0) {
+			metrics_close_client(c);
+			return;
+		}
+		c->request_len += n;
+		c->request[c->request_len] = 0;
+
+		// Wait for the rest of the request, unless it is too long to be a scrape.
+		if ((strstr(c->request, "\r\n\r\n") == NULL) && (strstr(c->request, "\n\n") == NULL)) {
+			if (c->request_len == METRICS_REQUEST_SIZE - 1) metrics_close_client(c);
+			return;
+		}
+		metrics_respond(c);
+	}
+
+	metrics_send(c);
+}
+
+/**
+	Gets a free client slot, closing the connection of a scraper that ran out of time if
+	there is none.
+
+	Returns: The client, or NULL if every slot is in use.
+*/
+struct METRICS_CLIENT *metrics_free_client()
+{
+	int i;
+
+	for (i=0; i<METRICS_MAX_CLIENTS; i++) {
+		if (metrics_clients[i].h.fd < 0) return &metrics_clients[i];
+	}
+	for (i=0; i<METRICS_MAX_CLIENTS; i++) {
+		if (get_time_msec() - metrics_clients[i].opened_at > METRICS_TIMEOUT_SEC * 1000L) {
+			metrics_close_client(&metrics_clients[i]);
+			return &metrics_clients[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+	Handles connections to the listening socket. While every slot is in use, further
+	scrapers are left in the listen backlog until a slot is freed.
+*/
+void metrics_accept(struct ENGINE_HANDLER *h, unsigned int events)
+{
+	struct METRICS_CLIENT *c;
+	int fd;
+
+	(void) events;
+	while (1) {
+		c = metrics_free_client();
+		if (c == NULL) {
+			metrics_waiting = 1;
+			engine_modify_handler(&metrics_listener, 0);
+			return;
+		}
+		if ((fd = accept(h->fd, NULL, NULL)) < 0) return;
+
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		c->h.fd = fd;
+		c->h.handle = metrics_handle_client;
+		c->h.context = c;
+		c->request_len = 0;
+		c->header_len = 0;
+		c->page = NULL;
+		c->sent = 0;
+		c->opened_at = get_time_msec();
+		if (engine_add_handler(&c->h, EPOLLIN) != 1) {
+			close(fd);
+			c->h.fd = -1;
+		}
+	}
+}
+
+/**
+	Starts serving the metrics, from the engine, on the address and port of the -x option.
+
+	Inputs: The option, as [address:]port.
+	Returns: 1 on success, -1 otherwise.
+*/
+int metrics_start(char *spec)
+{
+	struct sockaddr_in addr;
+	char strHost[LINE_LENGTH * 2];
+	char strLabels[METRICS_LABEL_LENGTH];
+	char *p;
+	int port;
+	int on;
+	int i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	p = strrchr(spec, ':');
+	port = atoi((p != NULL) ? p + 1 : spec);
+	if (p != NULL) {
+		snprintf(strHost, sizeof(strHost), "%.*s", (int) (p - spec), spec);
+		if ((strHost[0] != 0) && (inet_pton(AF_INET, strHost, &addr.sin_addr) != 1)) port = 0;
+	}
+	if ((port < 1) || (port > 65535)) {
+		fprintf(stderr, "Invalid metrics address '%s'.\n", spec);
+		return -1;
+	}
+	addr.sin_port = htons(port);
+
+	metrics_listener.fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (metrics_listener.fd < 0) {
+		perror("Unable to create the metrics socket.");
+		return -1;
+	}
+	on = 1;
+	setsockopt(metrics_listener.fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if ((bind(metrics_listener.fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) || (listen(metrics_listener.fd, SOMAXCONN) < 0)) {
+		perror("Unable to listen on the metrics port.");
+		close(metrics_listener.fd);
+		metrics_listener.fd = -1;
+		return -1;
+	}
+	fcntl(metrics_listener.fd, F_SETFL, O_NONBLOCK);
+
+	for (i=0; i<METRICS_MAX_CLIENTS; i++) metrics_clients[i].h.fd = -1;
+	metrics_waiting = 0;
+	metrics_listener.handle = metrics_accept;
+	metrics_listener.context = NULL;
+	if (engine_add_handler(&metrics_listener, EPOLLIN) != 1) {
+		close(metrics_listener.fd);
+		metrics_listener.fd = -1;
+		return -1;
+	}
+
+	for (i=0; i<inv_count; i++) {
+		if (metrics_labels(&inv_devices[i], strLabels, sizeof(strLabels)) != 1) {
+			fprintf(stderr, "The name of serial port %s is too long to label its metrics, which are left out.\n", sp_ports[inv_devices[i].port].dev_name);
+		}
+	}
+
+	// The failure count is otherwise only read once a poll fails.
+	if (rof_flag != 0) read_fail_count();
+	metrics_update();
+	printf("Serving metrics on port %d.\n", port);
+
+	return 1;
+}
+
+/**
+	Stops serving the metrics, closing the scrapers' connections.
+*/
+void metrics_stop()
+{
+	int i;
+
+	if (metrics_listener.fd < 0) return;
+
+	for (i=0; i<METRICS_MAX_CLIENTS; i++) {
+		if (metrics_clients[i].h.fd >= 0) metrics_close_client(&metrics_clients[i]);
+	}
+	engine_remove_handler(&metrics_listener);
+	close(metrics_listener.fd);
+	metrics_listener.fd = -1;
+}
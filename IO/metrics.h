@@ -0,0 +1,15 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Serves the latest sample and the poller's counters to Prometheus
+					scrapers, from the epoll engine between serial port events.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../Application/global.h"
+
+// External declarations.
+extern int 		metrics_start(char *);
+extern void 	metrics_update();
+extern void 	metrics_stop();
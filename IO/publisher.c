@@ -0,0 +1,579 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Publishes each sample to the sinks(MQTT, InfluxDB and UDP), each from
+					a thread of its own, so a slow or failed sink holds up neither the
+					polling nor the other sinks.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../Application/global.h"
+#include "internet.h"
+#include "resolver.h"
+
+struct PUBLISH_RING publish_ring;			// The latest samples, serialised once for every sink.
+volatile int publish_running = 0;			// 1 until the sinks' threads are asked to stop.
+int publish_started = 0;					// Number of sinks' threads started.
+
+int sink_send_mqtt(struct SINK *);
+int sink_send_influxdb(struct SINK *);
+int sink_send_udp(struct SINK *);
+void publisher_stop();
+
+/**
+	Adds a sink, from its host[:port][/target] option(the target is the MQTT topic prefix,
+	or the InfluxDB database).
+
+	Inputs: The sink type(SINK_*), and the option.
+	Returns: 1 on success, -1 if the option is invalid or there are too many sinks.
+*/
+int publisher_add_sink(int type, char *spec)
+{
+	struct SINK *sink;
+	char *p;
+
+	if (pub_sink_count == PUBLISH_MAX_SINKS) return -1;
+	sink = &pub_sinks[pub_sink_count];
+	memset(sink, 0, sizeof(struct SINK));
+	sink->type = type;
+	sink->conn.host = strdup(spec);
+	sink->conn.fd = -1;
+
+	switch (type) {
+		case SINK_MQTT:
+			sink->name = "MQTT";
+			sink->conn.port = MQTT_PORT;
+			sink->target = PUBLISH_MEASUREMENT;
+			sink->send = sink_send_mqtt;
+			break;
+		case SINK_INFLUXDB:
+			sink->name = "InfluxDB";
+			sink->conn.port = INFLUXDB_PORT;
+			sink->target = INFLUXDB_DATABASE;
+			sink->send = sink_send_influxdb;
+			break;
+		default:
+			sink->name = "UDP";
+			sink->conn.port = UDP_PORT;
+			sink->send = sink_send_udp;
+			break;
+	}
+
+	p = strchr(sink->conn.host, '/');
+	if (p != NULL) {
+		*p = 0;
+		if (p[1] != 0) sink->target = p + 1;
+	}
+	p = strchr(sink->conn.host, ':');
+	if (p != NULL) {
+		*p = 0;
+		sink->conn.port = atoi(p + 1);
+	}
+	if ((sink->conn.host[0] == 0) || (sink->conn.port <= 0) || (sink->conn.port > 65535)) return -1;
+	if ((type == SINK_MQTT) && (strlen(sink->target) >= MQTT_PREFIX_LENGTH)) return -1;
+
+	pub_sink_count++;
+	return 1;
+}
+
+/**
+	Wakes a sink's thread(without blocking, as a wake-up already pending is enough).
+
+	Inputs: The sink.
+*/
+void sink_wake(struct SINK *sink)
+{
+	if (write(sink->wake_fd[1], "", 1) < 0) return;
+}
+
+/**
+	Escapes an InfluxDB line protocol tag value, putting a backslash before each comma,
+	space and equals sign.
+
+	Inputs: The value, the buffer, and its size.
+	Returns: 1 on success, -1 if the escaped value does not fit.
+*/
+int publisher_escape_tag(char *value, char *strOut, int size)
+{
+	int len;
+	char *p;
+
+	len = 0;
+	for (p=value; *p; p++) {
+		if (len + 2 > size) return -1;
+		if ((*p == ',') || (*p == ' ') || (*p == '=')) strOut[len++] = '\\';
+		strOut[len++] = *p;
+	}
+	if (len >= size) return -1;
+	strOut[len] = 0;
+
+	return 1;
+}
+
+/**
+	Publishes an inverter's sample: serialises it once, as an InfluxDB line, into the ring
+	the sinks read from, and wakes the sinks. Never waits for a sink; the oldest sample is
+	overwritten once the ring is full.
+
+	Inputs: The inverter(with a current sample), and the time of the sample.
+	Returns: 1 if the sample was published, -1 otherwise.
+*/
+int publisher_publish(struct INVERTER *dev, time_t when)
+{
+	struct PUBLISH_RING *ring = &publish_ring;
+	struct PUBLISH_RECORD *rec;
+	struct INVERTER_INFO *ii = &dev->ii;
+	char strPort[PUBLISH_KEY_LENGTH * 2];
+	char *port_name;
+	unsigned int n;
+	int len, k;
+	int i;
+
+	if (!publish_running) return -1;
+
+	n = ring->head;
+	rec = &ring->records[n % PUBLISH_RING_SIZE];
+	rec->seq = (n << 1) | 1;
+	__sync_synchronize();
+
+	// The serial port and address tell the inverters apart.
+	port_name = strrchr(sp_ports[dev->port].dev_name, '/');
+	port_name = (port_name != NULL) ? port_name + 1 : sp_ports[dev->port].dev_name;
+	if ((snprintf(rec->key, sizeof(rec->key), "%s/%d", port_name, dev->address) >= (int) sizeof(rec->key)) ||
+		(publisher_escape_tag(port_name, strPort, sizeof(strPort)) != 1)) {
+		fprintf(stderr, "The name of serial port %s is too long to publish its inverters' samples.\n", sp_ports[dev->port].dev_name);
+		return -1;
+	}
+
+	// The current values, then the state and total values unless they are from an earlier poll.
+	len = snprintf(rec->line, PUBLISH_RECORD_SIZE, "%s,port=%s,address=%d ", PUBLISH_MEASUREMENT, strPort, dev->address);
+	k = format_keyed_fields(REG_FIELDS(reg_icv), &ii->icv, "", rec->line + len, PUBLISH_RECORD_SIZE - len);
+	if ((len < PUBLISH_RECORD_SIZE) && (k > 0)) len += k;
+	else len = PUBLISH_RECORD_SIZE;
+	if (((ii->valid & INFO_ICS) && (!(ii->stale & INFO_ICS))) && (len + 1 < PUBLISH_RECORD_SIZE)) {
+		rec->line[len++] = ',';
+		k = format_keyed_fields(REG_FIELDS(reg_ics), &ii->ics, "", rec->line + len, PUBLISH_RECORD_SIZE - len);
+		len = (k > 0) ? len + k : PUBLISH_RECORD_SIZE;
+	}
+	if (((ii->valid & INFO_ITV) && (!(ii->stale & INFO_ITV))) && (len + 1 < PUBLISH_RECORD_SIZE)) {
+		rec->line[len++] = ',';
+		k = format_keyed_fields(REG_FIELDS(reg_itv), &ii->itv, "Total_", rec->line + len, PUBLISH_RECORD_SIZE - len);
+		len = (k > 0) ? len + k : PUBLISH_RECORD_SIZE;
+	}
+	if (len < PUBLISH_RECORD_SIZE) len += snprintf(rec->line + len, PUBLISH_RECORD_SIZE - len, " %ld\n", (long) when);
+
+	// A sample too long for the record is not published(the slot matches no sample).
+	if (len >= PUBLISH_RECORD_SIZE) {
+		fprintf(stderr, "The sample of the inverter at address %d is too long to publish.\n", dev->address);
+		return -1;
+	}
+
+	rec->len = len;
+	__sync_synchronize();
+	rec->seq = n << 1;
+	__sync_synchronize();
+	ring->head = n + 1;
+
+	for (i=0; i<pub_sink_count; i++) sink_wake(&pub_sinks[i]);
+
+	return 1;
+}
+
+/**
+	Fills a sink's batch from the ring, oldest first. Samples overwritten before the sink
+	copied them are counted as dropped.
+
+	Inputs: The sink.
+	Returns: The number of samples in the batch.
+*/
+int sink_fill_batch(struct SINK *sink)
+{
+	struct PUBLISH_RECORD *rec;
+	unsigned int head;
+	unsigned int seq;
+	int len;
+
+	head = publish_ring.head;
+	__sync_synchronize();
+	if (head - sink->next > PUBLISH_RING_SIZE) {
+		sink->dropped += head - PUBLISH_RING_SIZE - sink->next;
+		sink->next = head - PUBLISH_RING_SIZE;
+	}
+
+	while ((sink->next != head) && (sink->batch_count < PUBLISH_BATCH_RECORDS)) {
+		rec = &publish_ring.records[sink->next % PUBLISH_RING_SIZE];
+		seq = rec->seq;
+		__sync_synchronize();
+		len = rec->len;
+
+		// The copy only counts if the record still holds the same sample afterwards.
+		if ((seq == (sink->next << 1)) && (len > 0) && (len <= PUBLISH_RECORD_SIZE)) {
+			memcpy(sink->batch + sink->batch_len, rec->line, len);
+			memcpy(sink->keys[sink->batch_count], rec->key, sizeof(rec->key));
+			__sync_synchronize();
+			if (rec->seq == seq) {
+				sink->offsets[sink->batch_count++] = sink->batch_len;
+				sink->batch_len += len;
+			} else {
+				sink->dropped++;
+			}
+		} else {
+			sink->dropped++;
+		}
+		sink->next++;
+	}
+
+	return sink->batch_count;
+}
+
+/**
+	Encodes an MQTT remaining length.
+
+	Inputs: The buffer(at least 4 bytes), and the length.
+	Returns: The number of bytes written.
+*/
+int mqtt_put_length(unsigned char *buf, int len)
+{
+	int n;
+
+	n = 0;
+	do {
+		buf[n] = len % 128;
+		len /= 128;
+		if (len > 0) buf[n] |= 0x80;
+		n++;
+	} while (len > 0);
+
+	return n;
+}
+
+/**
+	Opens the connection to an MQTT broker(unless it is still open), with a clean MQTT
+	3.1.1 session.
+
+	Inputs: The sink.
+	Returns: 1 if the connection was already open, 0 if it was opened, -1 otherwise.
+*/
+int sink_connect_mqtt(struct SINK *sink)
+{
+	unsigned char packet[LINE_LENGTH * 4];
+	unsigned char ack[4];
+	char strClient[LINE_LENGTH * 2];
+	int id_len;
+	int len;
+	int n;
+
+	if (http_is_reusable(&sink->conn)) return 1;
+	if (http_connect(&sink->conn) != 1) return -1;
+
+	// CONNECT: protocol name and level, clean session, keep alive, and client identifier.
+	id_len = snprintf(strClient, sizeof(strClient), "motech-%d-%d", (int) getpid(), (int) (sink - pub_sinks));
+	packet[0] = 0x10;
+	len = 1 + mqtt_put_length(packet + 1, 10 + 2 + id_len);
+	memcpy(packet + len, "\x00\x04MQTT\x04\x02", 8);
+	len += 8;
+	packet[len++] = MQTT_KEEPALIVE_SEC >> 8;
+	packet[len++] = MQTT_KEEPALIVE_SEC & 0xFF;
+	packet[len++] = id_len >> 8;
+	packet[len++] = id_len & 0xFF;
+	memcpy(packet + len, strClient, id_len);
+	len += id_len;
+
+	// CONNACK: a return code of 0 accepts the connection.
+	if (http_send_all(sink->conn.fd, (char *) packet, len) == 1) {
+		for (len = 0; len < 4; len += n) {
+			n = recv(sink->conn.fd, ack + len, 4 - len, 0);
+			if (n <= 0) break;
+		}
+		if ((len == 4) && (ack[0] == 0x20) && (ack[3] == 0)) return 0;
+		if (len == 4) fprintf(stderr, "The MQTT broker %s refused the connection(return code %d).\n", sink->conn.host, ack[3]);
+	}
+
+	http_close(&sink->conn);
+	return -1;
+}
+
+/**
+	Sends the batch to an MQTT broker, as one message per sample(QoS 0), to the topic
+	prefix/port/address.
+
+	Inputs: The sink.
+	Returns: 1 on success, -1 otherwise.
+*/
+int sink_send_mqtt(struct SINK *sink)
+{
+	unsigned char packet[sizeof(sink->batch) + PUBLISH_BATCH_RECORDS * (MQTT_TOPIC_LENGTH + 8)];
+	char strTopic[MQTT_TOPIC_LENGTH];
+	int topic_len;
+	int line_len;
+	int opened;
+	int len;
+	int i;
+
+	// All the messages go in one write.
+	len = 0;
+	for (i=0; i<sink->batch_count; i++) {
+		topic_len = snprintf(strTopic, sizeof(strTopic), "%s/%s", sink->target, sink->keys[i]);
+		if (topic_len >= (int) sizeof(strTopic)) topic_len = sizeof(strTopic) - 1;
+		line_len = ((i + 1 < sink->batch_count) ? sink->offsets[i + 1] : sink->batch_len) - sink->offsets[i] - 1;
+
+		packet[len++] = 0x30;
+		len += mqtt_put_length(packet + len, 2 + topic_len + line_len);
+		packet[len++] = topic_len >> 8;
+		packet[len++] = topic_len & 0xFF;
+		memcpy(packet + len, strTopic, topic_len);
+		len += topic_len;
+		memcpy(packet + len, sink->batch + sink->offsets[i], line_len);
+		len += line_len;
+	}
+
+	// A connection the broker has closed since the last batch is opened again, and the batch sent again.
+	for (;;) {
+		opened = sink_connect_mqtt(sink);
+		if (opened < 0) return -1;
+		if (http_send_all(sink->conn.fd, (char *) packet, len) == 1) break;
+
+		http_close(&sink->conn);
+		if (opened == 0) return -1;
+	}
+	sink->conn.used_at = time(NULL);
+	sink->conn.requests++;
+
+	return 1;
+}
+
+/**
+	Posts the batch to InfluxDB(v1 /write, in seconds), on a keep-alive connection.
+
+	Inputs: The sink.
+	Returns: 1 on success, 0 if InfluxDB rejected the samples, -1 otherwise.
+*/
+int sink_send_influxdb(struct SINK *sink)
+{
+	char strRequest[sizeof(sink->batch) + BUFSIZ];
+	char strHost[NI_MAXHOST + 8];
+	int status;
+	int len;
+
+	http_host_value(&sink->conn, strHost, sizeof(strHost));
+	len = snprintf(strRequest, BUFSIZ, "POST /write?db=%s&precision=s HTTP/1.1\r\nHost: %s\r\nContent-Type: text/plain\r\nContent-Length: %d\r\nConnection: keep-alive\r\n\r\n",
+			sink->target, strHost, sink->batch_len);
+	if (len >= BUFSIZ) return 0;
+	memcpy(strRequest + len, sink->batch, sink->batch_len);
+	strRequest[len + sink->batch_len] = 0;
+
+	status = http_send_request(&sink->conn, strRequest);
+	if ((status == 204) || (status == 200)) return 1;
+	if (status < 0) return -1;
+
+	// Malformed samples would be rejected again, but the database may yet be created(or the server recover).
+	fprintf(stderr, "InfluxDB did not accept the samples(HTTP %d): %.100s\n", status, sink->conn.body);
+	if ((status == 400) || (status == 413)) return 0;
+
+	return -1;
+}
+
+/**
+	Sends the batch as UDP datagrams, each holding as many whole lines as fit.
+
+	Inputs: The sink.
+	Returns: 1 on success, -1 otherwise.
+*/
+int sink_send_udp(struct SINK *sink)
+{
+	struct HOST_ADDRESS addrs[RESOLVE_MAX_ADDRS];
+	int line_end;
+	int start;
+	int end;
+	int i;
+
+	if (sink->conn.fd < 0) {
+		if (resolve_host(sink->conn.host, sink->conn.port, addrs, RESOLVE_MAX_ADDRS) <= 0) return -1;
+		sink->conn.fd = socket(addrs[0].addr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+		if (sink->conn.fd < 0) return -1;
+		if (connect(sink->conn.fd, (struct sockaddr *) &addrs[0].addr, addrs[0].len) < 0) {
+			close(sink->conn.fd);
+			sink->conn.fd = -1;
+			return -1;
+		}
+		sink->conn.connects++;
+	}
+
+	start = 0;
+	end = 0;
+	for (i=0; i<=sink->batch_count; i++) {
+		line_end = (i < sink->batch_count) ? ((i + 1 < sink->batch_count) ? sink->offsets[i + 1] : sink->batch_len) : -1;
+
+		// Send the lines so far once the next would not fit(or none is left).
+		if ((end > start) && ((line_end < 0) || (line_end - start > UDP_MAX_DATAGRAM))) {
+			if (send(sink->conn.fd, sink->batch + start, end - start, MSG_NOSIGNAL) < 0) {
+				close(sink->conn.fd);
+				sink->conn.fd = -1;
+				return -1;
+			}
+			start = end;
+		}
+		end = line_end;
+	}
+	sink->conn.requests++;
+
+	return 1;
+}
+
+/**
+	Closes a sink's connection, ending an MQTT session cleanly.
+
+	Inputs: The sink.
+*/
+void sink_close(struct SINK *sink)
+{
+	if (sink->conn.fd < 0) return;
+
+	if (sink->type == SINK_MQTT) http_send_all(sink->conn.fd, "\xE0\x00", 2);
+	if (sink->type == SINK_UDP) {
+		close(sink->conn.fd);
+		sink->conn.fd = -1;
+	} else {
+		http_close(&sink->conn);
+	}
+}
+
+/**
+	Delays a sink's next send after a failure, doubling the delay(with jitter) for each
+	consecutive failure.
+
+	Inputs: The sink.
+*/
+void sink_backoff(struct SINK *sink)
+{
+	long backoff;
+
+	backoff = get_backoff_msec(sink->failures, PUBLISH_RETRY_SEC * 1000L, PUBLISH_BACKOFF_MAX_SEC * 1000L);
+	sink->failures++;
+	sink->retry_at = get_time_msec() + backoff;
+	fprintf(stderr, "Publishing to %s(%s) failed %d time(s) in a row, trying again in %ld s.\n", sink->name, sink->conn.host, sink->failures, backoff / 1000);
+}
+
+/**
+	Runs a sink's thread: sends the samples published, in batches, as soon as they arrive
+	(or, after a failure, once the backoff has passed).
+
+	Inputs: The sink.
+*/
+void *sink_run(void *arg)
+{
+	struct SINK *sink = (struct SINK *) arg;
+	struct pollfd pfd;
+	char buf[64];
+	long delay;
+	int stopping;
+	int result;
+
+	pfd.fd = sink->wake_fd[0];
+	pfd.events = POLLIN;
+	for (;;) {
+		// Checked first, so a sample published just before the stop is still sent.
+		stopping = !publish_running;
+		__sync_synchronize();
+		while (read(sink->wake_fd[0], buf, sizeof(buf)) > 0);
+
+		delay = -1;
+		while (sink_fill_batch(sink) > 0) {
+			delay = sink->retry_at - get_time_msec();
+			if (delay > 0) break;
+
+			result = sink->send(sink);
+			if (result < 0) {
+				sink_backoff(sink);
+				delay = sink->retry_at - get_time_msec();
+				break;
+			}
+
+			// A batch the sink rejected is dropped, as sending it again would not help.
+			if (result == 0) sink->dropped += sink->batch_count;
+			else sink->sent += sink->batch_count;
+			sink->failures = 0;
+			sink->batch_len = 0;
+			sink->batch_count = 0;
+			delay = -1;
+		}
+
+		if (stopping) break;
+		poll(&pfd, 1, (delay < 0) ? -1 : (int) delay);
+	}
+
+	sink_close(sink);
+	return NULL;
+}
+
+/**
+	Starts a thread for each sink. Stop signals are left to the polling thread.
+
+	Returns: 1 on success(or if there are no sinks), -1 otherwise.
+*/
+int publisher_start()
+{
+	struct SINK *sink;
+	sigset_t old;
+	int i, j;
+
+	if (pub_sink_count == 0) return 1;
+
+	memset(&publish_ring, 0, sizeof(struct PUBLISH_RING));
+	for (i=0; i<pub_sink_count; i++) {
+		sink = &pub_sinks[i];
+		resolver_prefetch(sink->conn.host, sink->conn.port);
+		if (pipe(sink->wake_fd) < 0) {
+			perror("Unable to create a sink's pipe.");
+			return -1;
+		}
+		for (j=0; j<2; j++) fcntl(sink->wake_fd[j], F_SETFL, O_NONBLOCK);
+	}
+
+	block_stop_signals(&old);
+	publish_running = 1;
+	for (publish_started=0; publish_started<pub_sink_count; publish_started++) {
+		if (pthread_create(&pub_sinks[publish_started].thread, NULL, sink_run, &pub_sinks[publish_started]) != 0) {
+			fprintf(stderr, "Unable to start the thread for %s.\n", pub_sinks[publish_started].name);
+			break;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (publish_started < pub_sink_count) {
+		publisher_stop();
+		return -1;
+	}
+
+	return 1;
+}
+
+/**
+	Stops the sinks' threads once each has sent the samples waiting(unless it is backing
+	off after a failure).
+*/
+void publisher_stop()
+{
+	struct SINK *sink;
+	int i;
+
+	if (publish_started == 0) return;
+
+	__sync_synchronize();
+	publish_running = 0;
+	for (i=0; i<publish_started; i++) sink_wake(&pub_sinks[i]);
+
+	for (i=0; i<publish_started; i++) {
+		sink = &pub_sinks[i];
+		pthread_join(sink->thread, NULL);
+		if ((verbose) || (sink->dropped > 0) || (sink->batch_count > 0)) {
+			printf("%s(%s): %ld sample(s) sent, %ld dropped, %d unsent.\n", sink->name, sink->conn.host, sink->sent, sink->dropped, sink->batch_count);
+		}
+	}
+	for (i=0; i<pub_sink_count; i++) {
+		close(pub_sinks[i].wake_fd[0]);
+		close(pub_sinks[i].wake_fd[1]);
+	}
+	publish_started = 0;
+}
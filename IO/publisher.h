@@ -0,0 +1,19 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Publishes each sample to the sinks(MQTT, InfluxDB and UDP), each from
+					a thread of its own, so a slow or failed sink holds up neither the
+					polling nor the other sinks.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../Application/global.h"
+
+// External declarations.
+extern struct PUBLISH_RING publish_ring;
+extern int 		publisher_add_sink(int, char *);
+extern int 		publisher_start();
+extern void 	publisher_stop();
+extern int 		publisher_publish(struct INVERTER *, time_t);
+extern int 		publisher_escape_tag(char *, char *, int);
@@ -0,0 +1,193 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Resolves host names in the background, caching the addresses
+					found between uploads.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../Application/global.h"
+
+struct RESOLVER_ENTRY resolver_cache[RESOLVE_MAX_HOSTS];		// Host names looked up, and their addresses.
+pthread_mutex_t resolver_lock = PTHREAD_MUTEX_INITIALIZER;		// Guards the cache.
+pthread_cond_t resolver_done = PTHREAD_COND_INITIALIZER;		// Signalled as each lookup completes.
+
+/**
+	Looks up the addresses of a cache entry's host name(IPv4 and IPv6), on its own
+	thread. A failed lookup keeps the addresses found before, so they are still used
+	until a lookup succeeds.
+
+	Inputs: The cache entry.
+*/
+void *resolver_lookup(void *arg)
+{
+	struct RESOLVER_ENTRY *entry = arg;
+	struct addrinfo hints;
+	struct addrinfo *result;
+	struct addrinfo *ai;
+	char strPort[LINE_LENGTH];
+	int count;
+	int err;
+
+	// The host name and port do not change once the entry is in use.
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+	sprintf(strPort, "%d", entry->port);
+	err = getaddrinfo(entry->host, strPort, &hints, &result);
+
+	pthread_mutex_lock(&resolver_lock);
+	if (err == 0) {
+		count = 0;
+		for (ai = result; (ai != NULL) && (count < RESOLVE_MAX_ADDRS); ai = ai->ai_next) {
+			if (ai->ai_addrlen > sizeof(struct sockaddr_storage)) continue;
+			memcpy(&entry->addrs[count].addr, ai->ai_addr, ai->ai_addrlen);
+			entry->addrs[count].len = ai->ai_addrlen;
+			count++;
+		}
+		if (count > 0) entry->addr_count = count;
+		entry->expires_at = time(NULL) + ((count > 0) ? RESOLVE_TTL_SEC : RESOLVE_RETRY_SEC);
+		freeaddrinfo(result);
+	} else {
+		fprintf(stderr, "Cannot resolve IP address for: %s(%s)%s\n", entry->host, gai_strerror(err), (entry->addr_count > 0) ? ", using the last address found" : "");
+		entry->expires_at = time(NULL) + RESOLVE_RETRY_SEC;
+	}
+	entry->resolving = 0;
+	pthread_cond_broadcast(&resolver_done);
+	pthread_mutex_unlock(&resolver_lock);
+
+	return NULL;
+}
+
+/**
+	Finds the cache entry of a host name, adding it if it is new. The caller holds the
+	lock.
+
+	Inputs: The host name, and the port.
+	Returns: The entry, or NULL if the cache is full.
+*/
+struct RESOLVER_ENTRY *resolver_find(char *host, int port)
+{
+	int i;
+
+	for (i=0; i<RESOLVE_MAX_HOSTS; i++) {
+		if (resolver_cache[i].host == NULL) {
+			resolver_cache[i].host = strdup(host);
+			resolver_cache[i].port = port;
+			return &resolver_cache[i];
+		}
+		if ((resolver_cache[i].port == port) && (strcmp(resolver_cache[i].host, host) == 0)) return &resolver_cache[i];
+	}
+
+	return NULL;
+}
+
+/**
+	Starts a lookup of an entry's host name if its addresses have expired, and one is
+	not already running. The caller holds the lock.
+
+	Inputs: The cache entry.
+*/
+void resolver_refresh(struct RESOLVER_ENTRY *entry)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t old;
+
+	if ((entry->resolving) || (time(NULL) < entry->expires_at)) return;
+
+	// Stop signals are left to the polling thread.
+	block_stop_signals(&old);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, resolver_lookup, entry) == 0) {
+		entry->resolving = 1;
+		entry->started_at = get_time_msec();
+	} else fprintf(stderr, "Unable to start looking up %s.\n", entry->host);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/**
+	Gets the addresses of a host name. Cached addresses are returned straight away(and
+	looked up again in the background once they expire), so only the first lookup of a
+	host name is waited for, and then for at most RESOLVE_WAIT_MSEC.
+
+	Inputs: The host name, the port, and the array for the addresses(and its size).
+	Returns: The number of addresses, or 0 if none are known.
+*/
+int resolve_host(char *host, int port, struct HOST_ADDRESS *addrs, int max)
+{
+	struct RESOLVER_ENTRY *entry;
+	struct timespec deadline;
+	long remaining;
+	int count;
+
+	pthread_mutex_lock(&resolver_lock);
+	entry = resolver_find(host, port);
+	if (entry == NULL) {
+		pthread_mutex_unlock(&resolver_lock);
+		fprintf(stderr, "Cannot resolve IP address for: %s(the resolver cache is full)\n", host);
+		return 0;
+	}
+
+	resolver_refresh(entry);
+
+	// Wait for the first lookup, but not for a hung DNS server(once its time is up, later calls do not wait either).
+	remaining = entry->started_at + RESOLVE_WAIT_MSEC - get_time_msec();
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += remaining / 1000;
+	deadline.tv_nsec += (remaining % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	while ((entry->addr_count == 0) && (entry->resolving) && (remaining > 0)) {
+		if (pthread_cond_timedwait(&resolver_done, &resolver_lock, &deadline) == ETIMEDOUT) break;
+	}
+
+	count = (entry->addr_count < max) ? entry->addr_count : max;
+	memcpy(addrs, entry->addrs, count * sizeof(struct HOST_ADDRESS));
+	pthread_mutex_unlock(&resolver_lock);
+
+	if (count == 0) fprintf(stderr, "Cannot resolve IP address for: %s\n", host);
+	return count;
+}
+
+/**
+	Starts looking up a host name, without waiting for the result(eg at start-up, so
+	the address is known by the first upload).
+
+	Inputs: The host name, and the port.
+*/
+void resolver_prefetch(char *host, int port)
+{
+	struct RESOLVER_ENTRY *entry;
+
+	pthread_mutex_lock(&resolver_lock);
+	entry = resolver_find(host, port);
+	if (entry != NULL) resolver_refresh(entry);
+	pthread_mutex_unlock(&resolver_lock);
+}
+
+/**
+	Looks up a host name again in the background(eg after none of its addresses could be
+	connected to), still using its last addresses until the lookup completes.
+
+	Inputs: The host name, and the port.
+*/
+void resolver_invalidate(char *host, int port)
+{
+	struct RESOLVER_ENTRY *entry;
+
+	pthread_mutex_lock(&resolver_lock);
+	entry = resolver_find(host, port);
+	if ((entry != NULL) && (entry->addr_count > 0)) {
+		entry->expires_at = 0;
+		resolver_refresh(entry);
+	}
+	pthread_mutex_unlock(&resolver_lock);
+}
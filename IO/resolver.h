@@ -0,0 +1,15 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Resolves host names in the background, caching the addresses
+					found between uploads.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../Application/global.h"
+
+// External declarations.
+extern int 		resolve_host(char *, int, struct HOST_ADDRESS *, int);
+extern void 	resolver_prefetch(char *, int);
+extern void 	resolver_invalidate(char *, int);
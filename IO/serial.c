@@ -8,34 +8,41 @@
 
 // Include Files.
 #include "../Application/global.h"
+#include "../Application/frame.h"
+
+struct FRAME_ASSEMBLER sp_frame;	// Receive frame assembler for the serial port.
 
 /**
 	Attempts to open a new port.
 
-	Returns: File descriptor of the serial port opened.
+	Inputs: The serial port device name.
+	Returns: File descriptor of the serial port opened, or -1 on failure.
 */
-int open_port()
+int open_port(char *dev_name)
 {
 	int sp;
 	struct termios tio_settings;
 
-	if (verbose) printf("Opening serial port: %s\n", sp_dev_name);
+	if (verbose) printf("Opening serial port: %s\n", dev_name);
 
 	// Open port, and check for error.
-	sp = open(sp_dev_name, O_RDWR | O_NOCTTY | O_NDELAY);
+	sp = open(dev_name, O_RDWR | O_NOCTTY | O_NDELAY);
 	if (sp == -1) {
 		perror("Unable to open serial port.");
-		check_for_failures();
-		exit(EXIT_FAILURE);
+		return -1;
 	} else {
 		fcntl(sp, F_SETFL, O_NONBLOCK);
 	}
 
-	// Set the applicable serial port settings.
+	// Set the applicable serial port settings. Reads return immediately with whatever
+	// has arrived(VMIN=0, VTIME=0), as waiting is done by poll() in read_sp_response().
+	memset(&tio_settings, 0, sizeof(struct termios));
 	tio_settings.c_cflag = sp_baud_rate | CS8 | CLOCAL | CREAD;
 	tio_settings.c_iflag = IGNPAR;
 	tio_settings.c_oflag = 0;
 	tio_settings.c_lflag = 0;
+	tio_settings.c_cc[VMIN] = 0;
+	tio_settings.c_cc[VTIME] = 0;
 	tcsetattr(sp, TCSANOW, &tio_settings);
 
 	if (verbose) printf("Serial port opened.\n");
@@ -53,6 +60,17 @@ void close_port(int sp)
 	if (verbose) printf("Serial port closed.\n");
 }
 
+/**
+	Discards stale input(in the driver and the frame assembler) ahead of a new request.
+
+	Inputs: The serial port, and the address and function code the response is expected with.
+*/
+void flush_sp_input(int sp, char address, unsigned char function)
+{
+	tcflush(sp, TCIFLUSH);
+	frame_reset(&sp_frame, address, function);
+}
+
 /**
 	Write command to serial port.
 */
@@ -65,44 +83,138 @@ void write_sp_command(int sp, unsigned char *command, int command_len, char *com
 }
 
 /**
-	Read response from serial port.
+	Converts a termios baud rate to bits per second.
+
+	Inputs: The termios baud rate(eg B9600).
+	Returns: The bits per second.
+*/
+int get_baud_bps(int baud_rate)
+{
+	switch (baud_rate) {
+		case B19200:	return 19200;
+		case B38400:	return 38400;
+		default:		return 9600;
+	}
+}
+
+/**
+	Gets the baud rate a serial port is set to.
+
+	Inputs: The serial port.
+	Returns: The termios baud rate(sp_baud_rate unless the port was switched).
+*/
+int get_port_baud(int sp)
+{
+	int i;
+
+	for (i=0; i<sp_count; i++) {
+		if ((sp_ports[i].fd == sp) && (sp_ports[i].baud_rate != 0)) return sp_ports[i].baud_rate;
+	}
+
+	return sp_baud_rate;
+}
+
+/**
+	Switches a serial port to another baud rate, once any pending output has been sent.
+	Input received at the old rate is discarded.
+
+	Inputs: The index of the serial port, and the termios baud rate(eg B19200).
+	Returns: 1 on success, -1 otherwise.
+*/
+int set_port_baud(int port, int baud_rate)
+{
+	struct termios tio_settings;
+	int sp = sp_ports[port].fd;
+
+	if (tcgetattr(sp, &tio_settings) < 0) return -1;
+	cfsetispeed(&tio_settings, baud_rate);
+	cfsetospeed(&tio_settings, baud_rate);
+	if (tcsetattr(sp, TCSADRAIN, &tio_settings) < 0) {
+		perror("Unable to set the serial port baud rate.");
+		return -1;
+	}
+	tcflush(sp, TCIFLUSH);
+	sp_ports[port].baud_rate = baud_rate;
+
+	if (verbose) printf("Serial port %s set to %dbps.\n", sp_ports[port].dev_name, get_baud_bps(baud_rate));
+
+	return 1;
+}
+
+/**
+	Calculates the time taken to transfer bytes over the serial line(10 bits per byte).
 
-	Returns: Pointer to the response from serial port.
+	Inputs: The serial port, and the number of bytes.
+	Returns: The wire time (in milliseconds, rounded up).
+*/
+long get_wire_time_msec(int sp, int num_bytes)
+{
+	int bps = get_baud_bps(get_port_baud(sp));
+
+	return ((num_bytes * 10 * 1000L) + bps - 1) / bps;
+}
+
+/**
+	Read response from serial port. Waits in poll() until a complete, valid response frame
+	has been assembled from the received bytes(stray bytes and corrupt frames are skipped),
+	reading whatever is available on each wakeup, or until the deadline has passed. The
+	first byte must arrive within sp_timeout_msec of the request being sent; once it has,
+	the deadline becomes the wire time of the expected response plus the turnaround allowance.
+
+	Inputs: The serial port, the buffer for the frame, the expected frame length(set to the
+			received frame length), and the command name.
+	Returns: 1 on success, -1 on timeout or error.
 */
 int read_sp_response(int sp, char *buffer, int *buffer_len, char *command_name)
 {
+	unsigned char rxBuf[FRAME_RING_SIZE];
+	struct pollfd pfd;
+	long deadline;
+	long remaining;
 	int bufRead;
-	int bufPos;
-	char valIn;
-	int counter;
-
-	// Read one byte at a time, allow timeout, and report error if issue arises.
-	bufPos = 0;
-	counter = 0;
-	while (bufPos < *buffer_len) {
-		// Read one byte.
-		bufRead = read(sp, &valIn, 1);
-
-		// Wait/Block for required time.
-		isleep(READ_SLEEP_USEC);
-		
-		// Check for successful read.
+	int waiting;
+	int ret;
+
+	pfd.fd = sp;
+	pfd.events = POLLIN;
+
+	// Read in bulk as bytes arrive, until a full frame or the deadline.
+	waiting = 1;
+	deadline = get_time_msec() + get_wire_time_msec(sp, REQUEST_LENGTH) + sp_timeout_msec;
+	while (frame_extract(&sp_frame, (unsigned char *) buffer, buffer_len) != 1) {
+		remaining = deadline - get_time_msec();
+		if (remaining <= 0) {
+			if (verbose) fprintf(stderr, "Did not receive expected response via Serial for '%s(%d, %d)'\n", command_name, sp_frame.count, *buffer_len);
+			*buffer_len = 0;
+			return -1;
+		}
+
+		// Wait for data to arrive.
+		ret = poll(&pfd, 1, (int) remaining);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			perror("Unable to poll serial port.");
+			*buffer_len = 0;
+			return -1;
+		}
+		if (ret == 0) continue;
+
+		// Read everything available that fits in the ring buffer.
+		bufRead = read(sp, rxBuf, frame_space(&sp_frame));
 		if (bufRead > 0) {
-			buffer[bufPos] = valIn;
-			bufPos++;
-			counter = 0;
-		} else {
-			counter++;
-
-			// If the failure counter has reached the maximum limit, return error.
-			if (counter > READ_COUNTER_MAX) {
-				if (verbose) fprintf(stderr, "Did not receive expected response via Serial for '%s(%d, %d)'\n", command_name, bufPos, bufRead);
-				*buffer_len = bufPos;
-				return -1;
+			frame_push(&sp_frame, rxBuf, bufRead);
+
+			// The inverter is answering, so allow time for the rest of the response.
+			if (waiting) {
+				waiting = 0;
+				deadline = get_time_msec() + get_wire_time_msec(sp, *buffer_len) + READ_TIMEOUT_MSEC;
 			}
+		} else if ((pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) || ((bufRead < 0) && (errno != EAGAIN) && (errno != EINTR))) {
+			if (verbose) fprintf(stderr, "Serial port read failed for '%s(%d)'\n", command_name, sp_frame.count);
+			*buffer_len = 0;
+			return -1;
 		}
 	}
 
 	return 1;
 }
-
@@ -10,7 +10,12 @@
 #include "../Application/global.h"
 
 // External declarations.
-extern int 		open_port();
+extern int 		open_port(char *);
 extern void 	close_port(int);
+extern void 	flush_sp_input(int, char, unsigned char);
 extern void 	write_sp_command(int, char *, int, char *);
+extern int 		get_baud_bps(int);
+extern int 		get_port_baud(int);
+extern int 		set_port_baud(int, int);
+extern long 	get_wire_time_msec(int, int);
 extern int 		read_sp_response(int, char *, int *, char *);
@@ -0,0 +1,329 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Stores the statuses for PVOutput on disk until they have been
+					uploaded, and uploads them in batches.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../Application/global.h"
+#include "internet.h"
+#include <sys/stat.h>
+
+/*
+ * The spool holds one status per line, in the Add Batch Status format, oldest first.
+ * Statuses are only appended, and a second file(the spool's name with ".pos") holds
+ * the offset of the first status not yet processed by PVOutput. The offset is only
+ * moved on once PVOutput has answered for a batch, and the spool is emptied once all
+ * of it has been processed, so each status is sent until it is processed, and not
+ * after. A status sent again because its answer was lost replaces itself, as PVOutput
+ * keeps one status per date and time.
+ */
+
+/**
+	Reads the offset of the first status not yet processed.
+
+	Returns: The offset, or 0 if none is stored.
+*/
+long spool_read_offset()
+{
+	char strPath[BUFSIZ];
+	char line[LINE_LENGTH];
+	FILE *file;
+	long offset;
+
+	offset = 0;
+	snprintf(strPath, sizeof(strPath), "%s.pos", pvo_spool_file);
+	file = fopen(strPath, "r");
+	if (file != NULL)
+	{
+		if (fgets (line, sizeof(line), file) != NULL) offset = atol(line);
+		fclose (file);
+	}
+
+	return (offset > 0) ? offset : 0;
+}
+
+/**
+	Stores the offset of the first status not yet processed. The offset is written to a
+	temporary file which then replaces the old one, so it is never left half written.
+
+	Inputs: The offset.
+	Returns: 1 on success, -1 otherwise.
+*/
+int spool_write_offset(long offset)
+{
+	char strPath[BUFSIZ];
+	char strTemp[BUFSIZ];
+	FILE *file;
+
+	snprintf(strPath, sizeof(strPath), "%s.pos", pvo_spool_file);
+	snprintf(strTemp, sizeof(strTemp), "%s.pos.tmp", pvo_spool_file);
+	file = fopen(strTemp, "w");
+	if (file == NULL) return -1;
+
+	fprintf(file, "%ld\n", offset);
+	fflush(file);
+	fsync(fileno(file));
+	fclose(file);
+
+	if (rename(strTemp, strPath) < 0) {
+		perror("Unable to store the spool offset.");
+		return -1;
+	}
+
+	return 1;
+}
+
+/**
+	Opens a spool(or spill) file to append to. A line left incomplete(eg by a power
+	failure) is ended first, so it cannot run into the next.
+
+	Inputs: The file.
+	Returns: The file descriptor, or -1 on failure.
+*/
+int spool_open(char *path)
+{
+	char last;
+	int fd;
+
+	fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0644);
+	if (fd < 0) {
+		perror("Unable to open the spool.");
+		return -1;
+	}
+
+	if ((pread(fd, &last, 1, lseek(fd, 0, SEEK_END) - 1) == 1) && (last != '\n') && (write(fd, "\n", 1) != 1)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+	Appends a status to a spool(or spill) file.
+
+	Inputs: The file, and the status.
+	Returns: 1 on success, -1 otherwise(eg the file is full).
+*/
+int spool_write_status(char *path, struct PVO_STATUS *status)
+{
+	char line[SPOOL_LINE_LENGTH];
+	struct stat st;
+	int len;
+	int fd;
+
+	// Date, time, lifetime energy(v1), power(v2) and voltage(v6).
+	len = snprintf(line, sizeof(line), "%s,%s,%ld,%d,,,,%.1f\n", status->date, status->time, status->energy, status->power, status->voltage);
+	if (len >= (int) sizeof(line)) return -1;
+
+	if ((stat(path, &st) == 0) && (st.st_size + len > SPOOL_MAX_BYTES)) {
+		fprintf(stderr, "The spool %s is full, so the status for %s %s was not stored.\n", path, status->date, status->time);
+		return -1;
+	}
+
+	fd = spool_open(path);
+	if (fd < 0) return -1;
+	if (write(fd, line, len) != len) {
+		perror("Unable to write to the spool.");
+		close(fd);
+		return -1;
+	}
+	fsync(fd);
+	close(fd);
+
+	return 1;
+}
+
+/**
+	Appends a status to the spool, to be uploaded by the upload thread.
+
+	Inputs: The status.
+	Returns: 1 on success, -1 otherwise.
+*/
+int spool_append(struct PVO_STATUS *status)
+{
+	return spool_write_status(pvo_spool_file, status);
+}
+
+/**
+	Moves the statuses of a spill file to the end of the spool, and removes the spill file.
+
+	Inputs: The spill file.
+	Returns: 1 on success, -1 otherwise(the spill file is kept).
+*/
+int spool_merge(char *path)
+{
+	char buf[BUFSIZ];
+	int in;
+	int out;
+	int n;
+
+	in = open(path, O_RDONLY);
+	if (in < 0) return 1;
+	out = spool_open(pvo_spool_file);
+	if (out < 0) {
+		close(in);
+		return -1;
+	}
+
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		if (write(out, buf, n) != n) {
+			n = -1;
+			break;
+		}
+	}
+	close(in);
+	fsync(out);
+	close(out);
+	if (n < 0) {
+		perror("Unable to add the spill file to the spool.");
+		return -1;
+	}
+
+	unlink(path);
+	return 1;
+}
+
+/**
+	Reads the next batch of statuses from the spool. Lines that are not statuses(eg one
+	left incomplete by a power failure, or one too long to be a status) are skipped, and a
+	status for the same date and time as the one before it replaces it(as PVOutput would).
+	The last line is left until it has its end, as it may still be being written.
+
+	Inputs: The spool, the buffer for the statuses(separated by ';'), its size, and the
+			offset to update(to just after the last line read).
+	Returns: The number of statuses read.
+*/
+int spool_read_batch(FILE *file, char *data, int size, long *offset)
+{
+	char line[SPOOL_LINE_LENGTH];
+	char key[STRING_SIZE * 2];
+	char last_key[STRING_SIZE * 2];
+	char date[STRING_SIZE];
+	char time[STRING_SIZE];
+	int last_pos;
+	int count;
+	int len;
+	int c;
+
+	count = 0;
+	len = 0;
+	last_pos = 0;
+	last_key[0] = 0;
+	data[0] = 0;
+	while ((count < PVOUTPUT_BATCH_SIZE) && (fgets(line, sizeof(line), file) != NULL)) {
+		// A line without an end is still being written, or was cut short, unless it filled the buffer.
+		if (line[strlen(line) - 1] != '\n') {
+			if (strlen(line) < sizeof(line) - 1) break;
+
+			// Skip the rest of a line too long to be a status, once it has its end.
+			while (((c = getc(file)) != EOF) && (c != '\n'));
+			if (c == EOF) break;
+			*offset = ftell(file);
+			continue;
+		}
+
+		line[strlen(line) - 1] = 0;
+		if (sscanf(line, "%8[0-9],%5[0-9:],", date, time) != 2) {
+			*offset = ftell(file);
+			continue;
+		}
+		sprintf(key, "%s,%s", date, time);
+
+		if (strcmp(key, last_key) == 0) {
+			// Coalesce into the status before.
+			len = last_pos;
+			count--;
+		} else if (len + (int) strlen(line) + 2 > size) {
+			break;
+		}
+
+		last_pos = len;
+		strcpy(last_key, key);
+		len += sprintf(data + len, "%s%s", (count > 0) ? ";" : "", line);
+		count++;
+		*offset = ftell(file);
+	}
+
+	return count;
+}
+
+/**
+	Records that PVOutput has processed the statuses up to an offset, and empties the
+	spool once all of it has been processed.
+
+	Inputs: The offset from spool_read_next().
+	Returns: 1 on success, -1 otherwise(the statuses will be sent again).
+*/
+int spool_ack(long next)
+{
+	struct stat st;
+
+	// Empty the spool, after rewinding the offset: if the spool is not emptied(eg by a power
+	// failure), its statuses are sent again, rather than statuses added after it are skipped.
+	if ((stat(pvo_spool_file, &st) == 0) && (next >= st.st_size)) {
+		if (spool_write_offset(0) != 1) return -1;
+		if (truncate(pvo_spool_file, 0) == 0) return 1;
+		perror("Unable to empty the spool.");
+	}
+
+	return spool_write_offset(next);
+}
+
+/**
+	Reads the oldest batch of statuses not yet processed by PVOutput, of up to
+	PVOUTPUT_BATCH_SIZE statuses. The spool is emptied once all of it has been processed.
+
+	Inputs: The buffer for the statuses(separated by ';'), its size, and the offset to
+			pass to spool_ack() once PVOutput has processed them.
+	Returns: The number of statuses read(0 if none are waiting).
+*/
+int spool_read_next(char *data, int size, long *next)
+{
+	struct stat st;
+	FILE *file;
+	long offset;
+	int count;
+
+	*next = 0;
+	file = fopen(pvo_spool_file, "r");
+	if (file == NULL) return 0;
+	if ((fstat(fileno(file), &st) < 0) || (st.st_size == 0)) {
+		fclose(file);
+		return 0;
+	}
+
+	// An offset beyond the end is left over from emptying the spool.
+	offset = spool_read_offset();
+	if (offset > st.st_size) offset = 0;
+	fseek(file, offset, SEEK_SET);
+
+	*next = offset;
+	count = spool_read_batch(file, data, size, next);
+	fclose(file);
+
+	// Only lines that are not statuses were left.
+	if ((count == 0) && (*next >= st.st_size)) spool_ack(*next);
+
+	return count;
+}
+
+/**
+	Gets the size of the statuses not yet processed by PVOutput.
+
+	Returns: The size(in bytes).
+*/
+long spool_pending()
+{
+	struct stat st;
+	long offset;
+
+	if (stat(pvo_spool_file, &st) < 0) return 0;
+	offset = spool_read_offset();
+	if (offset > st.st_size) offset = 0;
+
+	return st.st_size - offset;
+}
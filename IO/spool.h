@@ -0,0 +1,18 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Stores the statuses for PVOutput on disk until they have been
+					uploaded, and uploads them in batches.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../Application/global.h"
+
+// External declarations.
+extern int 		spool_write_status(char *, struct PVO_STATUS *);
+extern int 		spool_append(struct PVO_STATUS *);
+extern int 		spool_merge(char *);
+extern int 		spool_read_next(char *, int, long *);
+extern int 		spool_ack(long);
+extern long 	spool_pending();
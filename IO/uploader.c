@@ -0,0 +1,373 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Uploads the statuses to PVOutput from a background thread, so the
+					network never holds up the polling.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../Application/global.h"
+#include "internet.h"
+#include "spool.h"
+
+struct UPLOAD_QUEUE upload_queue;			// Statuses waiting for the upload thread.
+pthread_t upload_thread;					// The upload thread.
+volatile int upload_running = 0;			// 1 until the upload thread is asked to stop.
+volatile int upload_final_drain = 0;		// 1 if the upload thread uploads the spool once more before stopping.
+char upload_spill_file[BUFSIZ];				// File for the statuses that did not fit in the queue.
+struct UPLOAD_SCHEDULE upload_schedule;		// When the next request may be sent.
+
+/**
+	Wakes the upload thread(without blocking, as a wake-up already pending is enough).
+*/
+void uploader_wake()
+{
+	if (write(upload_queue.wake_fd[1], "", 1) < 0) return;
+}
+
+/**
+	Passes a status to the upload thread. Never waits for the upload thread: if the queue
+	is full, the oldest status is dropped, or new statuses go to the spill file until the
+	upload thread has caught up(as set by -w).
+
+	Inputs: The status.
+	Returns: 1 if the status was queued(or spilled), -1 otherwise.
+*/
+int uploader_push(struct PVO_STATUS *status)
+{
+	struct UPLOAD_QUEUE *q = &upload_queue;
+	unsigned int head;
+	unsigned int tail;
+	int result;
+
+	tail = q->tail;
+	if (pvo_overflow == UPLOAD_SPILL) {
+		// Once spilling, statuses keep going to the spill file, so they stay in order.
+		if ((q->spilling) || (tail - q->head >= UPLOAD_QUEUE_SIZE)) {
+			pthread_mutex_lock(&q->spill_lock);
+			if ((!q->spilling) && (verbose)) printf("The upload queue is full, so statuses are being stored in %s.\n", upload_spill_file);
+			q->spilling = 1;
+			result = spool_write_status(upload_spill_file, status);
+			if (result == 1) q->spilled++;
+			pthread_mutex_unlock(&q->spill_lock);
+			uploader_wake();
+			return result;
+		}
+	} else {
+		// Drop the oldest status, unless the upload thread takes it first.
+		while (tail - (head = q->head) >= UPLOAD_QUEUE_SIZE) {
+			if (__sync_bool_compare_and_swap(&q->head, head, head + 1)) {
+				q->dropped++;
+				fprintf(stderr, "The upload queue is full, so the status for %s %s was dropped.\n", q->items[head % UPLOAD_QUEUE_SIZE].date, q->items[head % UPLOAD_QUEUE_SIZE].time);
+			}
+		}
+	}
+
+	// Fill the slot before publishing it.
+	q->items[tail % UPLOAD_QUEUE_SIZE] = *status;
+	__sync_synchronize();
+	q->tail = tail + 1;
+	uploader_wake();
+
+	return 1;
+}
+
+/**
+	Takes the oldest status from the queue(on the upload thread).
+
+	Inputs: The status to fill.
+	Returns: 1 if a status was taken, 0 if the queue is empty.
+*/
+int uploader_pop(struct PVO_STATUS *status)
+{
+	struct UPLOAD_QUEUE *q = &upload_queue;
+	unsigned int head;
+
+	for (;;) {
+		head = q->head;
+		if (head == q->tail) return 0;
+		__sync_synchronize();
+		*status = q->items[head % UPLOAD_QUEUE_SIZE];
+		__sync_synchronize();
+
+		// The copy only counts if the status was not dropped(and its slot reused) meanwhile.
+		if (__sync_bool_compare_and_swap(&q->head, head, head + 1)) return 1;
+	}
+}
+
+/**
+	Fills the token bucket up to now: the full limit is available again(with no spacing
+	owed) once the reported reset time has passed, and otherwise requests are added at
+	the rate limit.
+
+	Inputs: The schedule, and the time now(in milliseconds).
+*/
+void schedule_refill(struct UPLOAD_SCHEDULE *sched, long now)
+{
+	if ((sched->reset_at != 0) && (now >= sched->reset_at)) {
+		sched->tokens = sched->limit;
+		sched->remaining = -1;
+		sched->reset_at = 0;
+		sched->sent_at = 0;
+	} else {
+		sched->tokens += (now - sched->refilled_at) * ((double) sched->limit / (PVOUTPUT_RATE_WINDOW_SEC * 1000.0));
+	}
+	if (sched->tokens > sched->limit) sched->tokens = sched->limit;
+	sched->refilled_at = now;
+}
+
+/**
+	Gets the time until the next request may be sent. Besides waiting out failures and
+	an empty bucket, the requests left are spread over the rest of the rate limit
+	window, so statuses are coalesced into fuller batches rather than using up the
+	limit(a full batch is sent as soon as a request is available).
+
+	Inputs: The schedule, the time now(in milliseconds), and 1 if a full batch is waiting.
+	Returns: The time to wait(in milliseconds, 0 to send now).
+*/
+long schedule_delay(struct UPLOAD_SCHEDULE *sched, long now, int full)
+{
+	long delay;
+	long wait;
+	long spacing;
+
+	schedule_refill(sched, now);
+	delay = (sched->retry_at > now) ? sched->retry_at - now : 0;
+
+	if (sched->tokens < 1) {
+		if ((sched->remaining == 0) && (sched->reset_at > now)) wait = sched->reset_at - now;
+		else wait = (long) ((1 - sched->tokens) * ((PVOUTPUT_RATE_WINDOW_SEC * 1000.0) / sched->limit)) + 1;
+		if (wait > delay) delay = wait;
+	}
+
+	if ((!full) && (sched->sent_at != 0)) {
+		if (sched->reset_at <= now) spacing = (PVOUTPUT_RATE_WINDOW_SEC * 1000L) / sched->limit;
+		else if (sched->remaining > 0) spacing = (sched->reset_at - now) / sched->remaining;
+		else spacing = 0;
+		wait = sched->sent_at + spacing - now;
+		if (wait > delay) delay = wait;
+	}
+
+	return delay;
+}
+
+/**
+	Updates the schedule from the response to a request: takes the request from the
+	bucket, corrects the bucket from PVOutput's rate limit headers, and backs off
+	(doubling the delay, with jitter) while requests fail.
+
+	Inputs: The schedule, the response's status code(-1 if there was none), and the time
+			the request was sent(in milliseconds).
+*/
+void schedule_update(struct UPLOAD_SCHEDULE *sched, int status, long now)
+{
+	char strValue[LINE_LENGTH];
+	long backoff;
+	long reset;
+
+	if (status > 0) {
+		schedule_refill(sched, now);
+		sched->tokens -= 1;
+		sched->sent_at = now;
+
+		// PVOutput reports the limit, the requests left, and when the limit resets(as a Unix time).
+		if ((http_get_header(&pvo_conn, "X-Rate-Limit-Limit", strValue, sizeof(strValue))) && (atoi(strValue) > 0)) sched->limit = atoi(strValue);
+		if (http_get_header(&pvo_conn, "X-Rate-Limit-Remaining", strValue, sizeof(strValue))) {
+			sched->remaining = atoi(strValue);
+			if (sched->tokens > sched->remaining) sched->tokens = sched->remaining;
+		}
+		if (http_get_header(&pvo_conn, "X-Rate-Limit-Reset", strValue, sizeof(strValue))) {
+			// Whole seconds, so allow one more before counting on the reset.
+			reset = atol(strValue) - time(NULL) + 1;
+			sched->reset_at = (reset > 0) ? now + (reset * 1000L) : 0;
+		}
+
+		// Exceeding the limit is answered with 403, and waited out rather than retried.
+		if ((status == 403) && (strstr(pvo_conn.body, "Exceeded") != NULL)) {
+			sched->tokens = 0;
+			sched->remaining = 0;
+			if (sched->reset_at == 0) sched->reset_at = now + (PVOUTPUT_RATE_WINDOW_SEC * 1000L);
+			fprintf(stderr, "PVOutput's rate limit was exceeded, so uploads wait %ld s.\n", (sched->reset_at - now) / 1000);
+			return;
+		}
+		if ((verbose) && (sched->remaining >= 0)) {
+			printf("PVOutput rate limit: %d of %d requests left, resetting in %ld s.\n", sched->remaining, sched->limit, (sched->reset_at > now) ? (sched->reset_at - now) / 1000 : 0);
+		}
+	}
+
+	// A processed batch(or one PVOutput rejected, which is dropped) ends any backoff.
+	if ((status == 200) || ((status >= 400) && (status < 500) && (status != 401) && (status != 403))) {
+		sched->failures = 0;
+		sched->retry_at = 0;
+		return;
+	}
+
+	backoff = get_backoff_msec(sched->failures, UPLOAD_RETRY_SEC * 1000L, UPLOAD_BACKOFF_MAX_SEC * 1000L);
+	sched->failures++;
+	sched->retry_at = now + backoff;
+	fprintf(stderr, "Uploading to PVOutput failed %d time(s) in a row, trying again in %ld s.\n", sched->failures, backoff / 1000);
+}
+
+/**
+	Uploads the spool to PVOutput, oldest first, as the schedule allows.
+
+	Inputs: 1 to send every batch waiting as soon as requests allow(eg before exiting),
+			0 to coalesce statuses into fuller batches.
+	Returns: The time until the spool should be uploaded again(in milliseconds), or -1
+			if it is empty.
+*/
+long uploader_send_spool(int flush)
+{
+	char data[PVOUTPUT_BATCH_SIZE * SPOOL_LINE_LENGTH];
+	long delay;
+	long next;
+	long now;
+	int count;
+	int status;
+
+	for (;;) {
+		count = spool_read_next(data, sizeof(data), &next);
+		if (count == 0) return -1;
+
+		now = get_time_msec();
+		delay = schedule_delay(&upload_schedule, now, (flush) || (count == PVOUTPUT_BATCH_SIZE));
+		if (delay > 0) {
+			if (verbose) printf("%ld bytes of statuses are waiting in %s, to be uploaded in %ld s.\n", spool_pending(), pvo_spool_file, (delay + 999) / 1000);
+			return delay;
+		}
+
+		status = send_batch_http_pvoutput(data, count);
+		schedule_update(&upload_schedule, status, now);
+
+		// A batch PVOutput processed(or rejected as a bad request, which sending again would not fix) is done.
+		if ((status == 200) || ((status >= 400) && (status < 500) && (status != 401) && (status != 403))) {
+			if (spool_ack(next) != 1) return UPLOAD_RETRY_SEC * 1000L;
+		}
+	}
+}
+
+/**
+	Runs the upload thread: stores each queued status in the spool, and uploads the spool
+	as the schedule allows(new statuses are still stored as they arrive while it waits).
+*/
+void *uploader_run(void *arg)
+{
+	struct UPLOAD_QUEUE *q = &upload_queue;
+	struct PVO_STATUS status;
+	struct pollfd pfd;
+	char buf[64];
+	long delay;
+	int stopping;
+
+	(void) arg;
+	pfd.fd = q->wake_fd[0];
+	pfd.events = POLLIN;
+	for (;;) {
+		// Checked first, so a status queued just before the stop is still stored.
+		stopping = !upload_running;
+		__sync_synchronize();
+
+		while (read(q->wake_fd[0], buf, sizeof(buf)) > 0);
+		while (uploader_pop(&status)) spool_append(&status);
+
+		// The spill file is newer than anything queued before it, so it is added once the queue is empty.
+		if (q->spilling) {
+			pthread_mutex_lock(&q->spill_lock);
+			if (spool_merge(upload_spill_file) == 1) q->spilling = 0;
+			pthread_mutex_unlock(&q->spill_lock);
+		}
+
+		if (stopping) {
+			if (upload_final_drain) uploader_send_spool(1);
+			break;
+		}
+
+		delay = uploader_send_spool(0);
+		poll(&pfd, 1, (delay < 0) ? -1 : (int) delay);
+	}
+
+	http_close(&pvo_conn);
+	return NULL;
+}
+
+/**
+	Starts the upload thread. Stop signals are left to the polling thread.
+
+	Returns: 1 on success, -1 otherwise.
+*/
+int uploader_start()
+{
+	sigset_t old;
+	int i;
+
+	memset(&upload_queue, 0, sizeof(struct UPLOAD_QUEUE));
+	memset(&upload_schedule, 0, sizeof(struct UPLOAD_SCHEDULE));
+	upload_schedule.limit = PVOUTPUT_RATE_LIMIT;
+	upload_schedule.tokens = PVOUTPUT_RATE_LIMIT;
+	upload_schedule.remaining = -1;
+	upload_schedule.refilled_at = get_time_msec();
+	pthread_mutex_init(&upload_queue.spill_lock, NULL);
+	snprintf(upload_spill_file, sizeof(upload_spill_file), "%s.spill", pvo_spool_file);
+
+	// Statuses spilled before a restart are newer than the spool.
+	if (access(upload_spill_file, F_OK) == 0) upload_queue.spilling = 1;
+
+	if (pipe(upload_queue.wake_fd) < 0) {
+		perror("Unable to create the upload thread's pipe.");
+		return -1;
+	}
+	for (i=0; i<2; i++) fcntl(upload_queue.wake_fd[i], F_SETFL, O_NONBLOCK);
+
+	block_stop_signals(&old);
+	upload_running = 1;
+	if (pthread_create(&upload_thread, NULL, uploader_run, NULL) != 0) {
+		fprintf(stderr, "Unable to start the upload thread.\n");
+		upload_running = 0;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return upload_running ? 1 : -1;
+}
+
+/**
+	Stops the upload thread once it has stored the statuses queued.
+
+	Inputs: 1 to upload the spool once more first(eg before a single poll exits), 0 to
+			leave it for the next run.
+*/
+void uploader_stop(int drain)
+{
+	if (!upload_running) return;
+
+	upload_final_drain = drain;
+	__sync_synchronize();
+	upload_running = 0;
+	uploader_wake();
+	pthread_join(upload_thread, NULL);
+
+	close(upload_queue.wake_fd[0]);
+	close(upload_queue.wake_fd[1]);
+	if ((upload_queue.dropped > 0) || (upload_queue.spilled > 0)) {
+		printf("Upload queue: %ld status(es) dropped, %ld spilled.\n", upload_queue.dropped, upload_queue.spilled);
+	}
+}
+
+/**
+	Queues the status of an inverter(or the inverters combined) for upload to PVOutput.
+
+	Inputs: The inverter info.
+	Returns: 1 if the status was queued, -1 otherwise.
+*/
+int uploader_queue(struct INVERTER_INFO *inv_info)
+{
+	struct PVO_STATUS status;
+
+	memcpy(status.date, inv_info->dt.date, STRING_SIZE);
+	memcpy(status.time, inv_info->dt.time, STRING_SIZE);
+	status.energy = (long) inv_info->itv.Eac;
+	status.power = (int) inv_info->icv.Pac;
+	status.voltage = inv_info->icv.Vac;
+
+	return uploader_push(&status);
+}
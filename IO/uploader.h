@@ -0,0 +1,16 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Uploads the statuses to PVOutput from a background thread, so the
+					network never holds up the polling.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../Application/global.h"
+
+// External declarations.
+extern struct UPLOAD_QUEUE upload_queue;
+extern int 		uploader_start();
+extern void 	uploader_stop(int);
+extern int 		uploader_queue(struct INVERTER_INFO *);
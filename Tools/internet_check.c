@@ -0,0 +1,203 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Checks that IO/internet.c reads each kind of HTTP response the PVOutput
+					stand-in server can send: bodies framed by a length, by chunks or by
+					the connection closing, responses received in pieces, kept-alive
+					connections the server has given up on, and responses that come too
+					late(which must not be sent again).
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "pvoutput_server.h"
+#include "../IO/internet.h"
+#include <stdarg.h>
+
+#define CHECK_REQUESTS		3											// Requests per case
+#define CHECK_STATUSES		30											// Statuses per request(so a body spans several chunks)
+
+// A way of answering, and what the client should see.
+struct CHECK_CASE {
+	char 	*name;
+	int 	framing;			// PVS_FRAMING_*.
+	int 	split_bytes;		// Pieces each response is written in(0 = whole).
+	int 	stale;				// Chance a request on a reused connection is dropped(in percent).
+	int 	drop;				// Chance any request is dropped(in percent).
+	int 	slow;				// Chance a request on a reused connection is answered too late(in percent).
+	int 	status;				// Status each request should return(-1 if it is answered too late).
+	int 	connects;			// Connections the client should open.
+	int 	requests;			// Requests the server should receive.
+};
+
+struct CHECK_CASE check_cases[] = {
+	{"Content-Length, kept alive", PVS_FRAMING_LENGTH, 0, 0, 0, 0, 200, 1, CHECK_REQUESTS},
+	{"Content-Length, in pieces", PVS_FRAMING_LENGTH, 7, 0, 0, 0, 200, 1, CHECK_REQUESTS},
+	{"Chunked, kept alive", PVS_FRAMING_CHUNKED, 0, 0, 0, 0, 200, 1, CHECK_REQUESTS},
+	{"Chunked, in pieces", PVS_FRAMING_CHUNKED, 5, 0, 0, 0, 200, 1, CHECK_REQUESTS},
+	{"Close-delimited", PVS_FRAMING_CLOSE, 0, 0, 0, 0, 200, CHECK_REQUESTS, CHECK_REQUESTS},
+	{"Close-delimited, in pieces", PVS_FRAMING_CLOSE, 7, 0, 0, 0, 200, CHECK_REQUESTS, CHECK_REQUESTS},
+	{"Stale connection, sent again", PVS_FRAMING_LENGTH, 0, 100, 0, 0, 200, CHECK_REQUESTS, (CHECK_REQUESTS * 2) - 1},
+	{"Stale connection, chunked in pieces", PVS_FRAMING_CHUNKED, 5, 100, 0, 0, 200, CHECK_REQUESTS, (CHECK_REQUESTS * 2) - 1},
+	{"No response on a new connection", PVS_FRAMING_LENGTH, 0, 0, 100, 0, -1, CHECK_REQUESTS, CHECK_REQUESTS},
+	{"Slow response, not sent again", PVS_FRAMING_LENGTH, 0, 0, 0, 100, 200, 2, CHECK_REQUESTS}
+};
+
+#define CHECK_CASE_COUNT	(sizeof(check_cases) / sizeof(struct CHECK_CASE))
+
+int check_failures;
+int check_port;			// Port every case's server listens on(the first picks a free port), so the resolver caches one address.
+
+/**
+	Records the result of a check.
+
+	Inputs: The check's name, 1 if it passed, and what went wrong(if it did not).
+*/
+void check_result(char *name, int passed, char *fmt, ...)
+{
+	va_list args;
+
+	if (passed) {
+		printf("PASS %s\n", name);
+		return;
+	}
+
+	check_failures++;
+	printf("FAIL %s: ", name);
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	printf("\n");
+}
+
+/**
+	Checks http_decode_chunks() on a body, which is decoded in place.
+
+	Inputs: The check's name, the body, and the decoded body expected(NULL if the body is
+			incomplete, and must be left as it is).
+*/
+void check_chunks(char *name, char *body, char *expected)
+{
+	char strBody[BUFSIZ];
+	int len;
+
+	snprintf(strBody, sizeof(strBody), "%s", body);
+	len = http_decode_chunks(strBody, strlen(strBody));
+	if (expected == NULL) check_result(name, (len == -1) && (strcmp(strBody, body) == 0), "returned %d, left \"%s\"", len, strBody);
+	else check_result(name, (len == (int) strlen(expected)) && (strcmp(strBody, expected) == 0), "returned %d, \"%s\"", len, strBody);
+}
+
+/**
+	Checks the Host header value http_host_value() formats for a host and port.
+
+	Inputs: The check's name, the host, the port, and the value expected.
+*/
+void check_host(char *name, char *host, int port, char *expected)
+{
+	struct HTTP_CONNECTION conn;
+	char strHost[NI_MAXHOST + 8];
+
+	conn.host = host;
+	conn.port = port;
+	http_host_value(&conn, strHost, sizeof(strHost));
+	check_result(name, strcmp(strHost, expected) == 0, "\"%s\", not \"%s\"", strHost, expected);
+}
+
+/**
+	Sends batches of statuses through send_batch_http_pvoutput() to a server answering
+	as the case describes, and checks the status, body and connections of each.
+
+	Inputs: The case.
+*/
+void check_case(struct CHECK_CASE *cc)
+{
+	static struct PVS_SERVER server;
+	struct PVS_STATS stats;
+	char strData[BUFSIZ];
+	char strExpected[BUFSIZ];
+	int stats_fd;
+	int expected;
+	int status;
+	int passed;
+	pid_t pid;
+	int len, exp_len;
+	int i, j;
+
+	memset(&server, 0, sizeof(server));
+	server.port = check_port;
+	server.framing = cc->framing;
+	server.split_bytes = cc->split_bytes;
+	server.split_msec = (cc->split_bytes > 0) ? 1 : 0;
+	server.faults.stale = cc->stale;
+	server.faults.drop = cc->drop;
+	server.faults.slow = cc->slow;
+	pid = pvs_start(&server, &stats_fd);
+	if (pid < 0) {
+		check_result(cc->name, 0, "unable to start the PVOutput server");
+		return;
+	}
+
+	check_port = server.port;
+	http_close(&pvo_conn);
+	pvo_conn.port = server.port;
+	pvo_conn.connects = 0;
+	pvo_conn.requests = 0;
+	passed = 1;
+
+	for (i=0; (i<CHECK_REQUESTS) && (passed); i++) {
+		// The server echoes "date,time,1" for each status added.
+		len = 0;
+		exp_len = 0;
+		for (j=0; j<CHECK_STATUSES; j++) {
+			len += snprintf(strData + len, sizeof(strData) - len, "%s2026010%d,%02d:%02d,%d,%d", (j > 0) ? ";" : "", i + 1, j / 60, j % 60, 1000 + j, j);
+			exp_len += snprintf(strExpected + exp_len, sizeof(strExpected) - exp_len, "%s2026010%d,%02d:%02d,1", (j > 0) ? ";" : "", i + 1, j / 60, j % 60);
+		}
+
+		// A request answered after the client gave up must fail, rather than be sent again.
+		expected = ((cc->slow > 0) && (pvo_conn.fd >= 0)) ? -1 : cc->status;
+		status = send_batch_http_pvoutput(strData, CHECK_STATUSES);
+		if (status != expected) {
+			check_result(cc->name, 0, "request %d returned %d, not %d", i + 1, status, expected);
+			passed = 0;
+		} else if ((status == 200) && ((pvo_conn.body_len != exp_len) || (strcmp(pvo_conn.body, strExpected) != 0))) {
+			check_result(cc->name, 0, "request %d read a body of %d bytes, not %d: \"%.60s\"", i + 1, pvo_conn.body_len, exp_len, pvo_conn.body);
+			passed = 0;
+		} else if ((cc->framing == PVS_FRAMING_CLOSE) && (pvo_conn.fd >= 0)) {
+			check_result(cc->name, 0, "request %d left a close-delimited connection open", i + 1);
+			passed = 0;
+		}
+	}
+	http_close(&pvo_conn);
+	pvs_stop(pid, stats_fd, &stats);
+
+	if (passed) {
+		check_result(cc->name, (pvo_conn.connects == cc->connects) && (stats.requests == cc->requests),
+				"%ld connections opened and %ld requests received, not %d and %d", pvo_conn.connects, stats.requests, cc->connects, cc->requests);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+
+	verbose = 0;
+	pvo_api_key = "check";
+	pvo_sys_id = "1";
+	pvo_conn.host = "127.0.0.1";
+	pvo_conn.fd = -1;
+
+	check_chunks("Chunks", "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n", "hello world");
+	check_chunks("Chunk extensions and trailers", "5;a=b\r\nhello\r\n0\r\nX-Check: 1\r\n\r\n", "hello");
+	check_chunks("Incomplete chunk", "5\r\nhel", NULL);
+	check_chunks("Incomplete chunk size", "5\r\nhello\r\n6", NULL);
+	check_chunks("Missing last chunk", "5\r\nhello\r\n", NULL);
+	check_chunks("Incomplete trailers", "5\r\nhello\r\n0\r\nX-Check: 1\r\n", NULL);
+	check_host("Host on the default port", "www.pvoutput.org", 80, "www.pvoutput.org");
+	check_host("Host on another port", "127.0.0.1", 18080, "127.0.0.1:18080");
+
+	for (i=0; i<CHECK_CASE_COUNT; i++) check_case(&check_cases[i]);
+
+	printf("%s: %d check(s) failed.\n", (check_failures == 0) ? "Passed" : "Failed", check_failures);
+
+	return (check_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
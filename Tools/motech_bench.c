@@ -0,0 +1,310 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Benchmarks poll cycles of the epoll engine against simulated
+					Motech inverters.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "simulator.h"
+#include "../Application/interface.h"
+#include "../IO/engine.h"
+#include "../IO/serial.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define	BENCH_OPTLIST		"c:n:l:"
+#define BENCH_CYCLES		20											// Default poll cycles per configuration
+#define BENCH_MAX_COUNTS	8											// Most inverter counts benchmarked
+#define BENCH_MAX_BLOCKS	16											// Most distinct requests tracked per configuration
+#define BENCH_MAX_SAMPLES	8192										// Most samples per statistic
+
+// Samples of one statistic (in microseconds).
+struct BENCH_SAMPLES {
+	char 	name[64];
+	long 	values[BENCH_MAX_SAMPLES];
+	int 	count;
+};
+
+struct BENCH_SAMPLES bench_cycle;							// Wall time per cycle.
+struct BENCH_SAMPLES bench_first;							// First-byte latency, after the request was written.
+struct BENCH_SAMPLES bench_blocks[BENCH_MAX_BLOCKS];		// Time per request, by register block.
+int bench_block_count;
+long bench_failures;
+
+/**
+	Adds a sample to a statistic, dropping it once the statistic is full.
+*/
+void bench_add_sample(struct BENCH_SAMPLES *s, long value)
+{
+	if (s->count < BENCH_MAX_SAMPLES) s->values[s->count++] = value;
+}
+
+/**
+	Compares two samples for qsort().
+*/
+int bench_compare(const void *a, const void *b)
+{
+	long x = *(const long *) a;
+	long y = *(const long *) b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+	Gets a percentile of a statistic(sorting its samples).
+
+	Inputs: The statistic, and the percentile.
+	Returns: The sample at the percentile, or 0 if there are none.
+*/
+long bench_percentile(struct BENCH_SAMPLES *s, int pct)
+{
+	int i;
+
+	if (s->count == 0) return 0;
+	qsort(s->values, s->count, sizeof(long), bench_compare);
+	i = ((s->count * pct) + 99) / 100 - 1;
+	if (i < 0) i = 0;
+
+	return s->values[i];
+}
+
+/**
+	Prints the p50, p99 and largest sample of a statistic(in milliseconds).
+*/
+void bench_print_samples(char *label, struct BENCH_SAMPLES *s)
+{
+	printf("    %-44s p50 %8.2f ms  p99 %8.2f ms  max %8.2f ms  (%d)\n", label,
+			bench_percentile(s, 50) / 1000.0, bench_percentile(s, 99) / 1000.0, bench_percentile(s, 100) / 1000.0, s->count);
+}
+
+/**
+	Records the timing of each completed transaction(the engine's observer).
+*/
+void bench_observe(struct SERIAL_PORT *port, struct TRANSACTION *txn, int received)
+{
+	char strDesc[BUFSIZ];
+	long now;
+	int i;
+
+	now = get_time_usec();
+	if (!received) {
+		bench_failures++;
+		return;
+	}
+	if (port->first_usec != 0) bench_add_sample(&bench_first, port->first_usec - port->sent_usec);
+
+	// Find the statistic for the register block(s) requested.
+	if (txn->wake) sprintf(strDesc, "Serial Port Initialisation");
+	else describe_span(&txn->span, strDesc, sizeof(strDesc));
+	for (i=0; i<bench_block_count; i++) {
+		if (strcmp(bench_blocks[i].name, strDesc) == 0) break;
+	}
+	if (i == bench_block_count) {
+		if (bench_block_count == BENCH_MAX_BLOCKS) return;
+		snprintf(bench_blocks[bench_block_count++].name, sizeof(bench_blocks[0].name), "%.63s", strDesc);
+	}
+	bench_add_sample(&bench_blocks[i], now - port->start_usec);
+}
+
+/**
+	Starts a simulator in a child process.
+
+	Inputs: The number of inverters(addresses 1 upwards), the bits per second, the
+			turnaround latency, and the buffer for the pseudo-terminal name.
+	Returns: The child's process ID, or -1 on failure.
+*/
+pid_t bench_start_simulator(int count, int baud, int latency_msec, char *dev_name)
+{
+	static struct SIMULATOR sim;
+	int fds[2];
+	pid_t pid;
+	int i;
+
+	memset(&sim, 0, sizeof(sim));
+	sim.baud = baud;
+	sim.latency_msec = latency_msec;
+	for (i=1; i<=count; i++) sim_add_inverter(&sim, i);
+	if (sim_open(&sim) != 1) return -1;
+	if (pipe(fds) < 0) return -1;
+
+	pid = fork();
+	if (pid == 0) {
+		// Serve requests until the benchmark stops us.
+		close(fds[0]);
+		signal(SIGTERM, SIG_DFL);
+		if (write(fds[1], "", 1) < 0) _exit(EXIT_FAILURE);
+		close(fds[1]);
+		while (sim_step(&sim, -1) == 1);
+		_exit(EXIT_SUCCESS);
+	}
+
+	// Wait until the simulator is running, then hand the pseudo-terminal to the application.
+	close(fds[1]);
+	if ((pid > 0) && (read(fds[0], dev_name, 1) < 0)) pid = -1;
+	close(fds[0]);
+	strcpy(dev_name, sim.dev_name);
+	close(sim.master);
+	close(sim.slave);
+
+	return pid;
+}
+
+/**
+	Gets the CPU time used by this process.
+
+	Returns: The user and system time (in microseconds).
+*/
+long bench_cpu_usec()
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000L + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/**
+	Runs poll cycles against simulated inverters, and prints the statistics.
+
+	Inputs: The baud rate(B9600 or B19200), the number of inverters, the number of cycles,
+			the turnaround latency, and 1 for cold cycles(every block, as a cron run), or 0
+			for warm cycles(the current values and state, as in daemon mode).
+*/
+void bench_run(int baud_rate, int count, int cycles, int latency_msec, int cold)
+{
+	static char dev_name[64];
+	struct ENGINE_STATS before;
+	long start, cpu;
+	long cpu_total, bytes_tx, bytes_rx, wakeups, retries;
+	pid_t pid;
+	int i, j, k;
+
+	sp_baud_rate = baud_rate;
+	pid = bench_start_simulator(count, get_baud_bps(baud_rate), latency_msec, dev_name);
+	if (pid < 0) {
+		fprintf(stderr, "Unable to start the simulator.\n");
+		return;
+	}
+
+	sp_ports[0].dev_name = dev_name;
+	sp_ports[0].fd = open_port(dev_name);
+	if ((sp_ports[0].fd < 0) || (engine_add_ports() != 1)) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return;
+	}
+
+	inv_count = 0;
+	for (i=1; i<=count; i++) add_inverter(0, i);
+
+	memset(&bench_cycle, 0, sizeof(bench_cycle));
+	memset(&bench_first, 0, sizeof(bench_first));
+	memset(bench_blocks, 0, sizeof(bench_blocks));
+	bench_block_count = 0;
+	bench_failures = 0;
+	before = engine_stats;
+	cpu_total = 0;
+
+	// The first cycle of a warm run fills the cache, and is not counted.
+	for (k=(cold ? 0 : -1); k<cycles; k++) {
+		for (i=0; i<inv_count; i++) {
+			if (cold) {
+				// As a fresh cron run: wake the inverter, and read every block.
+				cleanup_inverter_info(&inv_devices[i].ii);
+				inv_devices[i].awake = 0;
+				inv_devices[i].static_read_at = 0;
+				memset(inv_devices[i].read_at, 0, sizeof(inv_devices[i].read_at));
+			} else {
+				// As a daemon poll: only the blocks with the shortest period are due.
+				inv_devices[i].static_read_at = time(NULL);
+				for (j=0; j<INV_MAX_BLOCKS; j++) inv_devices[i].read_at[j] = get_time_msec() - (INV_PERIOD_CURRENT * 1000L);
+			}
+		}
+
+		if (k < 0) {
+			engine_poll_cycle();
+			before = engine_stats;
+			bench_failures = 0;
+			memset(&bench_first, 0, sizeof(bench_first));
+			memset(bench_blocks, 0, sizeof(bench_blocks));
+			bench_block_count = 0;
+			continue;
+		}
+
+		start = get_time_usec();
+		cpu = bench_cpu_usec();
+		engine_poll_cycle();
+		cpu_total += bench_cpu_usec() - cpu;
+		bench_add_sample(&bench_cycle, get_time_usec() - start);
+	}
+
+	bytes_tx = engine_stats.bytes_tx - before.bytes_tx;
+	bytes_rx = engine_stats.bytes_rx - before.bytes_rx;
+	wakeups = engine_stats.wakeups - before.wakeups;
+	retries = engine_stats.retries - before.retries;
+
+	printf("%d bps, %d inverter(s), %s cycles:\n", get_baud_bps(baud_rate), count, cold ? "cold" : "warm");
+	bench_print_samples("Cycle", &bench_cycle);
+	bench_print_samples("First byte latency", &bench_first);
+	for (i=0; i<bench_block_count; i++) bench_print_samples(bench_blocks[i].name, &bench_blocks[i]);
+	printf("    Per cycle: %ld bytes tx, %ld bytes rx, %ld wakeups, %.3f ms CPU, %.2f failed transactions, %.2f retries\n\n",
+			bytes_tx / cycles, bytes_rx / cycles, wakeups / cycles, (cpu_total / 1000.0) / cycles, ((double) bench_failures) / cycles, ((double) retries) / cycles);
+
+	for (i=0; i<inv_count; i++) cleanup_inverter_info(&inv_devices[i].ii);
+	engine_remove_ports();
+	close_port(sp_ports[0].fd);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char *argv[])
+{
+	int counts[BENCH_MAX_COUNTS] = {1, 4, 16};
+	int count_total;
+	int cycles;
+	int latency_msec;
+	char *count;
+	int opt;
+	int i;
+
+	count_total = 3;
+	cycles = BENCH_CYCLES;
+	latency_msec = SIM_LATENCY_MSEC;
+
+	while ((opt = getopt(argc, argv, BENCH_OPTLIST)) != -1)
+	{
+		switch (opt) {
+			case 'c':	// Cycles per configuration
+				cycles = atoi(optarg);
+				if ((cycles < 1) || (cycles > BENCH_CYCLES * 4)) cycles = BENCH_CYCLES;
+				break;
+			case 'n':	// Inverter counts
+				count_total = 0;
+				for (count = strtok(optarg, ","); (count != NULL) && (count_total < BENCH_MAX_COUNTS); count = strtok(NULL, ",")) {
+					counts[count_total] = atoi(count);
+					if ((counts[count_total] >= 1) && (counts[count_total] <= SIM_MAX_INVERTERS)) count_total++;
+				}
+				break;
+			case 'l':	// Simulated turnaround latency
+				latency_msec = atoi(optarg);
+				break;
+			default:
+				printf("Usage: %s [-c cycles] [-n count[,count...]] [-l latency_msec]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	verbose = 0;
+	if (engine_init() != 1) return EXIT_FAILURE;
+	engine_observer = bench_observe;
+
+	for (i=0; i<count_total; i++) {
+		bench_run(B9600, counts[i], cycles, latency_msec, 1);
+		bench_run(B9600, counts[i], cycles, latency_msec, 0);
+		bench_run(B19200, counts[i], cycles, latency_msec, 1);
+		bench_run(B19200, counts[i], cycles, latency_msec, 0);
+	}
+
+	return EXIT_SUCCESS;
+}
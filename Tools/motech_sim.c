@@ -0,0 +1,116 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Simulates Motech inverters on a pseudo-terminal, for testing
+					and benchmarking without an inverter attached.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "simulator.h"
+
+#define	SIM_OPTLIST		"a:l:j:b:r:o:N:P:C:T:D:S:v"
+
+volatile sig_atomic_t sim_running = 1;
+
+/**
+	Stops the simulator on SIGTERM/SIGINT.
+*/
+void handle_stop_signal(int sig)
+{
+	sim_running = 0;
+}
+
+/**
+	Prints the command line options.
+*/
+void print_options(char *name)
+{
+	printf("Usage: %s [options]\n\n", name);
+	printf("\t-a x[,y,...]\tInverter Address(es) to answer for(45 (Default))\n");
+	printf("\t-l x\t\tTurnaround latency in milliseconds(%d (Default))\n", SIM_LATENCY_MSEC);
+	printf("\t-j x\t\tRandom extra latency, up to x milliseconds(0 (Default))\n");
+	printf("\t-b x\t\tPace responses at x bits per second, and start the inverters at that rate(9600, 19200, 0=Unpaced at 9600 (Default))\n");
+	printf("\t-r file\t\tRegister contents, one \"register value [address]\" per line\n");
+	printf("\t-o path\t\tSymbolic link to create to the pseudo-terminal\n");
+	printf("\t-v\t\tVerbose, log each request and fault\n\n");
+	printf("Faults(chance per response, in percent)\n");
+	printf("\t-N x\t\tNo response\n");
+	printf("\t-P x\t\tStray prefix bytes\n");
+	printf("\t-C x\t\tBad CRC\n");
+	printf("\t-T x\t\tTruncated frame\n");
+	printf("\t-D x\t\tDropped byte\n");
+	printf("\t-S x\t\tRandom seed\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct SIMULATOR sim;
+	struct sigaction sa;
+	char *link_name;
+	char *reg_file;
+	char *addr;
+	int opt;
+
+	memset(&sim, 0, sizeof(sim));
+	sim.latency_msec = SIM_LATENCY_MSEC;
+	link_name = NULL;
+	reg_file = NULL;
+	srand(time(NULL));
+
+	while ((opt = getopt(argc, argv, SIM_OPTLIST)) != -1)
+	{
+		switch (opt) {
+			case 'a':	// Inverter Addresses
+				for (addr = strtok(optarg, ","); addr != NULL; addr = strtok(NULL, ",")) {
+					if (sim_add_inverter(&sim, atoi(addr)) == NULL) fprintf(stderr, "Too many addresses, ignoring %s.\n", addr);
+				}
+				break;
+			case 'l': sim.latency_msec = atoi(optarg); break;
+			case 'j': sim.jitter_msec = atoi(optarg); break;
+			case 'b': sim.baud = atoi(optarg); break;
+			case 'r': reg_file = optarg; break;
+			case 'o': link_name = optarg; break;
+			case 'N': sim.faults.silent = atoi(optarg); break;
+			case 'P': sim.faults.stray = atoi(optarg); break;
+			case 'C': sim.faults.bad_crc = atoi(optarg); break;
+			case 'T': sim.faults.truncate = atoi(optarg); break;
+			case 'D': sim.faults.drop = atoi(optarg); break;
+			case 'S': srand(atoi(optarg)); break;
+			case 'v': sim.verbose = 1; break;
+			default:
+				print_options(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (sim.count == 0) sim_add_inverter(&sim, INV_DEFAULT_ADDRESS);
+	if ((reg_file != NULL) && (sim_load_registers(&sim, reg_file) != 1)) {
+		perror("Unable to read the register file.");
+		return EXIT_FAILURE;
+	}
+
+	if (sim_open(&sim) != 1) return EXIT_FAILURE;
+	if (link_name != NULL) {
+		unlink(link_name);
+		if (symlink(sim.dev_name, link_name) < 0) perror("Unable to create the symbolic link.");
+	}
+
+	// Print the device name for scripts to pass to motech -s.
+	printf("%s\n", sim.dev_name);
+	fflush(stdout);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_stop_signal;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	while (sim_running) {
+		if (sim_step(&sim, 1000) != 1) break;
+	}
+
+	sim_print_stats(&sim, stderr);
+	if (link_name != NULL) unlink(link_name);
+	sim_close(&sim);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,302 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Checks that IO/publisher.c delivers samples to each sink as the sink
+					expects them: MQTT CONNECT and PUBLISH packets, InfluxDB /write bodies
+					(and what is done with the answer), and UDP datagrams of whole lines,
+					with one sink that never answers holding up none of the others.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "sink_server.h"
+#include "../IO/publisher.h"
+#include <stdarg.h>
+
+#define CHECK_SAMPLES		20											// Samples published per inverter
+#define CHECK_DEADLINE_MSEC	3000										// Time the sinks have to receive the samples(well short of the HTTP_TIMEOUT_SEC a sink waits on a dead one)
+#define CHECK_SETTLE_MSEC	300											// Time allowed for anything further to arrive(eg a retry that should not happen)
+#define CHECK_PORT_NAME		"/dev/serial/by-id/usb-FTDI_FT232R_USB_UART_A50285BI-if00-port0"
+#define CHECK_ODD_PORT_NAME	"/dev/inverters/roof east,row=2"			// A serial port name with a space, comma and equals sign
+#define CHECK_ODD_PORT_TAG	"roof\\ east\\,row\\=2"						// The name, escaped as an InfluxDB tag
+#define CHECK_TOPIC			"solar"										// MQTT topic prefix
+#define CHECK_DATABASE		"motechdb"									// InfluxDB database
+
+// Sinks, in the order they are added to the publisher.
+#define CHECK_MQTT			0
+#define CHECK_INFLUXDB		1
+#define CHECK_UDP			2
+#define CHECK_DEAD			3
+#define CHECK_SINKS			4
+
+struct SKS_SERVER check_servers[CHECK_SINKS];
+int check_failures;
+
+/**
+	Records the result of a check.
+
+	Inputs: The check's name, 1 if it passed, and what went wrong(if it did not).
+*/
+void check_result(char *name, int passed, char *fmt, ...)
+{
+	va_list args;
+
+	if (passed) {
+		printf("PASS %s\n", name);
+		return;
+	}
+
+	check_failures++;
+	printf("FAIL %s: ", name);
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	printf("\n");
+}
+
+/**
+	Checks publisher_escape_tag() on a tag value.
+
+	Inputs: The check's name, the value, and the escaped value expected.
+*/
+void check_escape(char *name, char *value, char *expected)
+{
+	char strTag[LINE_LENGTH * 4];
+	int result;
+
+	result = publisher_escape_tag(value, strTag, sizeof(strTag));
+	if (result != 1) strTag[0] = 0;
+	check_result(name, (result == 1) && (strcmp(strTag, expected) == 0), "returned %d, \"%s\", not \"%s\"", result, strTag, expected);
+}
+
+/**
+	Publishes a sample of each inverter.
+
+	Inputs: The time of the samples.
+	Returns: The time taken (in microseconds).
+*/
+long check_publish(time_t when)
+{
+	long start;
+	int i;
+
+	start = get_time_usec();
+	for (i=0; i<inv_count; i++) {
+		// Each sample differs, so one delivered out of order or twice is noticed.
+		inv_devices[i].ii.icv.Pac = (double) (when % 5000);
+		publisher_publish(&inv_devices[i], when);
+	}
+
+	return get_time_usec() - start;
+}
+
+/**
+	Runs the stand-ins until the MQTT and UDP sinks have each received a number of samples
+	and a counter has reached its target, or the time runs out.
+
+	Inputs: The samples, the counter(NULL if none) and its target, and the time allowed(in
+			milliseconds).
+	Returns: The time taken (in milliseconds).
+*/
+long check_pump(long messages, volatile long *counter, long target, long allowed_msec)
+{
+	long start;
+	int i;
+
+	start = get_time_msec();
+	while (get_time_msec() - start < allowed_msec) {
+		if ((check_servers[CHECK_MQTT].stats.messages >= messages) && (check_servers[CHECK_UDP].stats.messages >= messages) &&
+			((counter == NULL) || (*counter >= target))) break;
+		for (i=0; i<CHECK_SINKS; i++) sks_step(&check_servers[i], 1);
+	}
+
+	return get_time_msec() - start;
+}
+
+/**
+	Compares the samples a stand-in received with those published.
+
+	Inputs: The stand-in, its first sample to compare, the sample published it should be,
+			and the number of samples.
+	Returns: The first sample received that differs, or -1 if none do.
+*/
+int check_samples(struct SKS_SERVER *server, int first, int published, int count)
+{
+	struct PUBLISH_RECORD *rec;
+	struct SKS_MESSAGE *m;
+	char strTopic[MQTT_TOPIC_LENGTH];
+	int i;
+
+	if (server->stats.messages < first + count) return server->stats.messages;
+
+	for (i=0; i<count; i++) {
+		rec = &publish_ring.records[(published + i) % PUBLISH_RING_SIZE];
+		m = &server->messages[first + i];
+		if ((rec->len < 1) || ((int) strlen(m->line) != rec->len - 1) || (strncmp(m->line, rec->line, rec->len - 1) != 0)) return first + i;
+
+		snprintf(strTopic, sizeof(strTopic), "%s/%s", CHECK_TOPIC, rec->key);
+		if ((server->type == SINK_MQTT) && (strcmp(m->topic, strTopic) != 0)) return first + i;
+	}
+
+	return -1;
+}
+
+/**
+	Counts the MQTT messages received on an inverter's topic.
+
+	Inputs: The inverter.
+	Returns: The number of messages.
+*/
+int check_topic_count(struct INVERTER *dev)
+{
+	struct SKS_SERVER *server = &check_servers[CHECK_MQTT];
+	char strTopic[MQTT_TOPIC_LENGTH];
+	int count;
+	int i;
+
+	snprintf(strTopic, sizeof(strTopic), "%s/%s/%d", CHECK_TOPIC, strrchr(CHECK_PORT_NAME, '/') + 1, dev->address);
+	count = 0;
+	for (i=0; (i<server->stats.messages) && (i<SKS_MAX_MESSAGES); i++) {
+		if (strcmp(server->messages[i].topic, strTopic) == 0) count++;
+	}
+
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	struct SKS_SERVER *mqtt = &check_servers[CHECK_MQTT];
+	struct SKS_SERVER *influxdb = &check_servers[CHECK_INFLUXDB];
+	struct SKS_SERVER *udp = &check_servers[CHECK_UDP];
+	struct SKS_SERVER *dead = &check_servers[CHECK_DEAD];
+	struct SINK *influxdb_sink = &pub_sinks[CHECK_INFLUXDB];
+	char strSpec[LINE_LENGTH * 4];
+	char strTag[LINE_LENGTH * 4];
+	long publish_usec;
+	long elapsed;
+	long requests;
+	long lines;
+	time_t when;
+	int total;
+	int first;
+	int i;
+
+	verbose = 0;
+	srand(time(NULL));
+
+	check_escape("Tag left as it is", "ttyUSB0", "ttyUSB0");
+	check_escape("Tag escaped", "roof east,row=2", CHECK_ODD_PORT_TAG);
+
+	// Two inverters on a serial port with a long(by-id) name.
+	sp_ports[0].dev_name = CHECK_PORT_NAME;
+	sp_count = 1;
+	for (i=0; i<2; i++) {
+		inv_devices[i].port = 0;
+		inv_devices[i].address = 45 + i;
+		inv_devices[i].ii.valid = INFO_ICV | INFO_ICS | INFO_ITV;
+	}
+	inv_count = 2;
+
+	// The stand-ins, on free ports, with the last an InfluxDB that never answers.
+	memset(check_servers, 0, sizeof(check_servers));
+	mqtt->type = SINK_MQTT;
+	influxdb->type = SINK_INFLUXDB;
+	udp->type = SINK_UDP;
+	dead->type = SINK_INFLUXDB;
+	dead->hang = 1;
+	for (i=0; i<CHECK_SINKS; i++) {
+		if (sks_open(&check_servers[i]) != 1) return EXIT_FAILURE;
+	}
+
+	snprintf(strSpec, sizeof(strSpec), "127.0.0.1:%d/%s", mqtt->port, CHECK_TOPIC);
+	publisher_add_sink(SINK_MQTT, strSpec);
+	snprintf(strSpec, sizeof(strSpec), "127.0.0.1:%d/%s", influxdb->port, CHECK_DATABASE);
+	publisher_add_sink(SINK_INFLUXDB, strSpec);
+	snprintf(strSpec, sizeof(strSpec), "127.0.0.1:%d", udp->port);
+	publisher_add_sink(SINK_UDP, strSpec);
+	snprintf(strSpec, sizeof(strSpec), "127.0.0.1:%d", dead->port);
+	publisher_add_sink(SINK_INFLUXDB, strSpec);
+	if ((pub_sink_count != CHECK_SINKS) || (publisher_start() != 1)) {
+		fprintf(stderr, "Unable to start publishing.\n");
+		return EXIT_FAILURE;
+	}
+
+	// Publish more samples than fit in a batch, then wait for the sinks to receive them.
+	when = 1767225600;
+	publish_usec = 0;
+	for (i=0; i<CHECK_SAMPLES; i++, when += 60) publish_usec += check_publish(when);
+	total = CHECK_SAMPLES * inv_count;
+	elapsed = check_pump(total, &influxdb->stats.messages, total, CHECK_DEADLINE_MSEC);
+
+	check_result("Publishing never waits on a sink", publish_usec < 100000, "%d samples took %ld ms to publish", total, publish_usec / 1000);
+	check_result("A dead sink does not delay the others", (elapsed < CHECK_DEADLINE_MSEC) && (dead->stats.connections == 1),
+			"the samples took %ld ms, and the dead sink accepted %ld connection(s)", elapsed, dead->stats.connections);
+
+	check_result("MQTT CONNECT", (mqtt->stats.connects == 1) && (mqtt->stats.bad == 0),
+			"%ld session(s) opened, %ld malformed packet(s)", mqtt->stats.connects, mqtt->stats.bad);
+	first = check_samples(mqtt, 0, 0, total);
+	check_result("MQTT PUBLISH", (first < 0) && (mqtt->stats.bad == 0), "%ld of %d messages received, sample %d differs, %ld malformed packet(s)",
+			mqtt->stats.messages, total, first, mqtt->stats.bad);
+	check_result("MQTT topics per inverter", (check_topic_count(&inv_devices[0]) == CHECK_SAMPLES) && (check_topic_count(&inv_devices[1]) == CHECK_SAMPLES),
+			"%d and %d messages on the inverters' topics", check_topic_count(&inv_devices[0]), check_topic_count(&inv_devices[1]));
+
+	first = check_samples(influxdb, 0, 0, total);
+	check_result("InfluxDB /write", (first < 0) && (influxdb->stats.bad == 0) && (strcmp(influxdb->path, "/write?db=" CHECK_DATABASE "&precision=s") == 0) &&
+			(influxdb->stats.requests >= (total + PUBLISH_BATCH_RECORDS - 1) / PUBLISH_BATCH_RECORDS) && (influxdb->stats.largest <= PUBLISH_RECORD_SIZE * PUBLISH_BATCH_RECORDS),
+			"%ld of %d lines in %ld request(s) to %s, sample %d differs, %ld malformed", influxdb->stats.messages, total, influxdb->stats.requests, influxdb->path, first, influxdb->stats.bad);
+	snprintf(strSpec, sizeof(strSpec), "127.0.0.1:%d", influxdb->port);
+	check_result("InfluxDB Host header", strcmp(influxdb->host, strSpec) == 0, "\"%s\", not \"%s\"", influxdb->host, strSpec);
+
+	first = check_samples(udp, 0, 0, total);
+	check_result("UDP datagrams", (first < 0) && (udp->stats.bad == 0) && (udp->stats.requests > 1) && (udp->stats.largest <= UDP_MAX_DATAGRAM),
+			"%ld of %d lines in %ld datagram(s) of up to %ld bytes, sample %d differs, %ld malformed", udp->stats.messages, total, udp->stats.requests, udp->stats.largest, first, udp->stats.bad);
+
+	// A batch InfluxDB rejects as malformed(400) is dropped, not sent again.
+	influxdb->status = 400;
+	lines = influxdb->stats.messages;
+	check_publish(when);
+	when += 60;
+	total += inv_count;
+	check_pump(total, &influxdb_sink->dropped, inv_count, CHECK_DEADLINE_MSEC);
+	check_pump(total + 1, NULL, 0, CHECK_SETTLE_MSEC);
+	check_result("InfluxDB 400 drops the batch", (influxdb->stats.messages == lines + inv_count) && (influxdb_sink->dropped == inv_count) && (influxdb_sink->failures == 0),
+			"%ld line(s) sent, %ld sample(s) dropped, %d failure(s)", influxdb->stats.messages - lines, influxdb_sink->dropped, influxdb_sink->failures);
+
+	// A batch InfluxDB fails to store(500) is kept, and sent again(with any samples since) once the backoff has passed.
+	influxdb->status = 500;
+	requests = influxdb->stats.requests;
+	check_publish(when);
+	when += 60;
+	total += inv_count;
+	check_pump(total, &influxdb->stats.rejected, influxdb->stats.rejected + 1, CHECK_DEADLINE_MSEC);
+	check_pump(total + 1, NULL, 0, CHECK_SETTLE_MSEC);
+	check_result("InfluxDB 500 keeps the batch", (influxdb->stats.requests == requests + 1) && (influxdb_sink->dropped == inv_count) && (influxdb_sink->failures == 1),
+			"%ld request(s) sent, %ld sample(s) dropped, %d failure(s)", influxdb->stats.requests - requests, influxdb_sink->dropped, influxdb_sink->failures);
+
+	influxdb->status = 204;
+	elapsed = check_pump(total, &influxdb_sink->sent, total - inv_count, (PUBLISH_RETRY_SEC * 2000L) + CHECK_DEADLINE_MSEC);
+	first = check_samples(influxdb, influxdb->stats.messages - inv_count, total - inv_count, inv_count);
+	check_result("InfluxDB batch sent again", (first < 0) && (influxdb_sink->sent == total - inv_count) && (influxdb_sink->failures == 0),
+			"%ld sample(s) sent after %ld ms, sample %d differs, %d failure(s)", influxdb_sink->sent, elapsed, first, influxdb_sink->failures);
+
+	// A serial port name with a space, comma or equals sign is escaped, so it is still one tag.
+	sp_ports[0].dev_name = CHECK_ODD_PORT_NAME;
+	lines = influxdb->stats.messages;
+	check_publish(when);
+	when += 60;
+	total += inv_count;
+	check_pump(total, &influxdb->stats.messages, lines + inv_count, CHECK_DEADLINE_MSEC);
+	snprintf(strTag, sizeof(strTag), "%s,port=%s,address=%d ", PUBLISH_MEASUREMENT, CHECK_ODD_PORT_TAG, inv_devices[0].address);
+	check_result("InfluxDB port tag escaped", (influxdb->stats.messages == lines + inv_count) && (influxdb->stats.bad == 0) &&
+			(strncmp(influxdb->messages[lines].line, strTag, strlen(strTag)) == 0),
+			"%ld line(s) received, %ld malformed, \"%.60s\"", influxdb->stats.messages - lines, influxdb->stats.bad, influxdb->messages[lines].line);
+
+	// Let the dead sink's thread go, so it can stop.
+	sks_drop_clients(dead);
+	publisher_stop();
+	for (i=0; i<CHECK_SINKS; i++) sks_close(&check_servers[i]);
+
+	printf("%s: %d check(s) failed.\n", (check_failures == 0) ? "Passed" : "Failed", check_failures);
+
+	return (check_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
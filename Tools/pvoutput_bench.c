@@ -0,0 +1,207 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Benchmarks uploads to PVOutput(IO/internet.c) against the PVOutput
+					stand-in server.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "pvoutput_server.h"
+#include "../IO/internet.h"
+#include <sys/resource.h>
+
+#define	BENCH_OPTLIST		"n:b:r:l:j:L:E:N:C:"
+#define BENCH_REQUESTS		200											// Default requests per configuration
+#define BENCH_MAX_SIZES		8											// Most batch sizes benchmarked
+#define BENCH_MAX_SAMPLES	8192										// Most samples per statistic
+
+// Samples of one statistic (in microseconds).
+struct BENCH_SAMPLES {
+	long 	values[BENCH_MAX_SAMPLES];
+	int 	count;
+};
+
+struct BENCH_SAMPLES bench_latency;		// Time per request, from sending it to its response being read.
+
+/**
+	Adds a sample to a statistic, dropping it once the statistic is full.
+*/
+void bench_add_sample(struct BENCH_SAMPLES *s, long value)
+{
+	if (s->count < BENCH_MAX_SAMPLES) s->values[s->count++] = value;
+}
+
+/**
+	Compares two samples for qsort().
+*/
+int bench_compare(const void *a, const void *b)
+{
+	long x = *(const long *) a;
+	long y = *(const long *) b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+	Gets a percentile of a statistic(sorting its samples).
+
+	Inputs: The statistic, and the percentile.
+	Returns: The sample at the percentile, or 0 if there are none.
+*/
+long bench_percentile(struct BENCH_SAMPLES *s, int pct)
+{
+	int i;
+
+	if (s->count == 0) return 0;
+	qsort(s->values, s->count, sizeof(long), bench_compare);
+	i = ((s->count * pct) + 99) / 100 - 1;
+	if (i < 0) i = 0;
+
+	return s->values[i];
+}
+
+/**
+	Gets the CPU time used by this process.
+
+	Returns: The user and system time (in microseconds).
+*/
+long bench_cpu_usec()
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000L + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/**
+	Sends batches of statuses to the stand-in server, and prints the statistics.
+
+	Inputs: The server settings, the number of requests, the statuses per request, the
+			requests per second(0 = as fast as possible), and 1 to keep the connection open
+			between requests(as the application does), or 0 to open one per request.
+*/
+void bench_run(struct PVS_SERVER *settings, int requests, int batch_size, int rate, int keep_alive)
+{
+	static struct PVS_SERVER server;
+	struct PVS_STATS stats;
+	char strData[BUFSIZ];
+	long start, elapsed, cpu;
+	long sample;
+	long failed;
+	int stats_fd;
+	int status;
+	pid_t pid;
+	int len;
+	int i, j;
+
+	server = *settings;
+	pid = pvs_start(&server, &stats_fd);
+	if (pid < 0) {
+		fprintf(stderr, "Unable to start the PVOutput server.\n");
+		return;
+	}
+
+	http_close(&pvo_conn);
+	pvo_conn.port = server.port;
+	pvo_conn.connects = 0;
+	pvo_conn.requests = 0;
+	memset(&bench_latency, 0, sizeof(bench_latency));
+	failed = 0;
+	sample = 0;
+
+	start = get_time_usec();
+	cpu = bench_cpu_usec();
+	for (i=0; i<requests; i++) {
+		// Pace the requests, if a rate was asked for.
+		if (rate > 0) {
+			elapsed = get_time_usec() - start;
+			if (elapsed < (i * 1000000L) / rate) usleep(((i * 1000000L) / rate) - elapsed);
+		}
+
+		// A status a minute, as "date,time,energy,power,,,,voltage".
+		len = 0;
+		for (j=0; j<batch_size; j++, sample++) {
+			len += snprintf(strData + len, sizeof(strData) - len, "%s%08ld,%02ld:%02ld,%ld,%ld,,,,%.1f", (j > 0) ? ";" : "",
+					20260101 + (sample / 1440), (sample / 60) % 24, sample % 60, 1000000 + sample * 10, sample % 5000, 240.0 + (sample % 10) / 10.0);
+		}
+
+		elapsed = get_time_usec();
+		status = send_batch_http_pvoutput(strData, batch_size);
+		bench_add_sample(&bench_latency, get_time_usec() - elapsed);
+		if (status != 200) failed++;
+		if (!keep_alive) http_close(&pvo_conn);
+	}
+	elapsed = get_time_usec() - start;
+	cpu = bench_cpu_usec() - cpu;
+	http_close(&pvo_conn);
+
+	// Collect the server's view of the run.
+	pvs_stop(pid, stats_fd, &stats);
+
+	printf("%d status(es) per request, %s, %d ms server latency:\n", batch_size, keep_alive ? "keep-alive" : "connection per request", settings->latency_msec);
+	printf("    %-44s p50 %8.2f ms  p99 %8.2f ms  max %8.2f ms  (%d)\n", "Request latency",
+			bench_percentile(&bench_latency, 50) / 1000.0, bench_percentile(&bench_latency, 99) / 1000.0, bench_percentile(&bench_latency, 100) / 1000.0, bench_latency.count);
+	printf("    Requests: %d sent, %ld failed, %.1f requests/s, %.1f statuses/s, %.3f ms CPU per request\n",
+			requests, failed, (requests * 1000000.0) / elapsed, (((double) (requests - failed)) * batch_size * 1000000.0) / elapsed, (cpu / 1000.0) / requests);
+	printf("    Connections: %ld opened, %ld accepted by the server\n", pvo_conn.connects, stats.connections);
+	printf("    Server: %ld requests, %ld statuses added, %ld rate limited, %ld errors, %ld dropped, %ld closed\n\n",
+			stats.requests, stats.statuses, stats.rate_limited, stats.errors, stats.drops, stats.closes);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct PVS_SERVER settings;
+	int sizes[BENCH_MAX_SIZES] = {1, PVOUTPUT_BATCH_SIZE};
+	int size_total;
+	int requests;
+	int rate;
+	char *size;
+	int opt;
+	int i;
+
+	memset(&settings, 0, sizeof(settings));
+	settings.window_sec = PVS_RATE_WINDOW_SEC;
+	size_total = 2;
+	requests = BENCH_REQUESTS;
+	rate = 0;
+
+	while ((opt = getopt(argc, argv, BENCH_OPTLIST)) != -1)
+	{
+		switch (opt) {
+			case 'n':	// Requests per configuration
+				requests = atoi(optarg);
+				if ((requests < 1) || (requests > BENCH_MAX_SAMPLES)) requests = BENCH_REQUESTS;
+				break;
+			case 'b':	// Batch sizes
+				size_total = 0;
+				for (size = strtok(optarg, ","); (size != NULL) && (size_total < BENCH_MAX_SIZES); size = strtok(NULL, ",")) {
+					sizes[size_total] = atoi(size);
+					if ((sizes[size_total] >= 1) && (sizes[size_total] <= PVOUTPUT_BATCH_SIZE)) size_total++;
+				}
+				break;
+			case 'r': rate = atoi(optarg); break;
+			case 'l': settings.latency_msec = atoi(optarg); break;
+			case 'j': settings.jitter_msec = atoi(optarg); break;
+			case 'L': settings.limit = atoi(optarg); break;
+			case 'E': settings.faults.error = atoi(optarg); break;
+			case 'N': settings.faults.drop = atoi(optarg); break;
+			case 'C': settings.faults.close = atoi(optarg); break;
+			default:
+				printf("Usage: %s [-n requests] [-b size[,size...]] [-r requests_per_sec] [-l latency_msec] [-j jitter_msec] [-L limit] [-E error%%] [-N drop%%] [-C close%%]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	verbose = 0;
+	pvo_api_key = "bench";
+	pvo_sys_id = "1";
+	pvo_conn.host = "127.0.0.1";
+
+	for (i=0; i<size_total; i++) {
+		bench_run(&settings, requests, sizes[i], rate, 1);
+		bench_run(&settings, requests, sizes[i], rate, 0);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,638 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Stands in for PVOutput's Add Status and Add Batch Status services,
+					for testing and benchmarking uploads without www.pvoutput.org.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "pvoutput_server.h"
+#include <sys/wait.h>
+
+volatile sig_atomic_t pvs_serving;
+
+/**
+	Gets the time from a monotonic clock.
+
+	Returns: The time in microseconds.
+*/
+long pvs_time_usec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000L) + (ts.tv_nsec / 1000);
+}
+
+/**
+	Decides whether a fault is injected.
+
+	Inputs: The chance of the fault(in percent).
+	Returns: 1 if the fault is injected, 0 otherwise.
+*/
+int pvs_chance(int percent)
+{
+	return (percent > 0) && ((rand() % 100) < percent);
+}
+
+/**
+	Opens the listening socket, on the loopback interface.
+
+	Inputs: The server(its port is set, if 0 was asked for).
+	Returns: 1 on success, -1 otherwise.
+*/
+int pvs_open(struct PVS_SERVER *server)
+{
+	struct sockaddr_in addr;
+	socklen_t len;
+	int on;
+	int i;
+
+	server->fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (server->fd < 0) {
+		perror("Unable to create the listening socket.");
+		return -1;
+	}
+	on = 1;
+	setsockopt(server->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(server->port);
+	if ((bind(server->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) || (listen(server->fd, PVS_MAX_CLIENTS) < 0)) {
+		perror("Unable to listen on the port.");
+		close(server->fd);
+		return -1;
+	}
+	len = sizeof(addr);
+	if (getsockname(server->fd, (struct sockaddr *) &addr, &len) == 0) server->port = ntohs(addr.sin_port);
+
+	fcntl(server->fd, F_SETFL, O_NONBLOCK);
+	for (i=0; i<PVS_MAX_CLIENTS; i++) server->clients[i].fd = -1;
+	server->window_at = time(NULL);
+	server->used = 0;
+
+	return 1;
+}
+
+/**
+	Closes a client's connection, discarding any request or response in progress.
+
+	Inputs: The client.
+*/
+void pvs_drop_client(struct PVS_CLIENT *c)
+{
+	if (c->fd < 0) return;
+
+	close(c->fd);
+	c->fd = -1;
+	c->rx_len = 0;
+	c->tx_len = 0;
+	c->tx_pos = 0;
+}
+
+/**
+	Closes the listening socket, and every connection.
+
+	Inputs: The server.
+*/
+void pvs_close(struct PVS_SERVER *server)
+{
+	int i;
+
+	for (i=0; i<PVS_MAX_CLIENTS; i++) pvs_drop_client(&server->clients[i]);
+	close(server->fd);
+}
+
+/**
+	Finds a header of a request.
+
+	Inputs: The request(null-terminated), the header name, and the buffer for the value(and
+			its size).
+	Returns: 1 if the header was found, 0 otherwise.
+*/
+int pvs_get_header(char *request, char *name, char *strOut, int size)
+{
+	char *line;
+	char *end;
+	int name_len;
+	int len;
+
+	name_len = strlen(name);
+	for (line = strstr(request, "\r\n"); line != NULL; line = end) {
+		line += 2;
+		end = strstr(line, "\r\n");
+		if ((end == NULL) || (end == line)) break;
+
+		if ((strncasecmp(line, name, name_len) == 0) && (line[name_len] == ':')) {
+			line += name_len + 1;
+			while ((*line == ' ') || (*line == '\t')) line++;
+			len = end - line;
+			if (len >= size) len = size - 1;
+			memcpy(strOut, line, len);
+			strOut[len] = 0;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+	Finds a parameter of a query string, decoding '+' and %xx escapes.
+
+	Inputs: The query string, the parameter name, and the buffer for the value(and its size).
+	Returns: 1 if the parameter was found, 0 otherwise.
+*/
+int pvs_get_param(char *query, char *name, char *strOut, int size)
+{
+	char hex[3];
+	char *p;
+	int name_len;
+	int len;
+
+	name_len = strlen(name);
+	for (p = query; p != NULL; p = strchr(p, '&')) {
+		if (*p == '&') p++;
+		if ((strncmp(p, name, name_len) != 0) || (p[name_len] != '=')) continue;
+
+		p += name_len + 1;
+		for (len = 0; (*p != 0) && (*p != '&') && (len < size - 1); p++) {
+			if ((*p == '%') && (p[1] != 0) && (p[2] != 0)) {
+				hex[0] = p[1];
+				hex[1] = p[2];
+				hex[2] = 0;
+				strOut[len++] = (char) strtol(hex, NULL, 16);
+				p += 2;
+			} else {
+				strOut[len++] = (*p == '+') ? ' ' : *p;
+			}
+		}
+		strOut[len] = 0;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+	Prepares the response to a request, due once the latency has passed, with its body
+	framed as the server is set to.
+
+	Inputs: The server, the client, the status code, the body, 1 to include the rate
+			limit headers, and 1 to close the connection after the response.
+	Returns: The status code.
+*/
+int pvs_respond(struct PVS_SERVER *server, struct PVS_CLIENT *c, int status, char *body, int rate_headers, int close_after)
+{
+	char strRate[BUFSIZ];
+	char *reason;
+	int remaining;
+	int body_len;
+	int chunk;
+	int pos;
+	int len;
+
+	switch (status) {
+		case 200: reason = "OK"; break;
+		case 400: reason = "Bad Request"; break;
+		case 401: reason = "Unauthorized"; break;
+		case 403: reason = "Forbidden"; break;
+		case 404: reason = "Not Found"; break;
+		case 405: reason = "Method Not Allowed"; break;
+		default: reason = "Internal Server Error"; break;
+	}
+
+	// PVOutput reports its rate limit when a request asks for it(with "X-Rate-Limit: 1").
+	strRate[0] = 0;
+	if ((rate_headers) && (server->limit > 0)) {
+		remaining = (server->used < server->limit) ? server->limit - server->used : 0;
+		snprintf(strRate, sizeof(strRate), "X-Rate-Limit-Limit: %d\r\nX-Rate-Limit-Remaining: %d\r\nX-Rate-Limit-Reset: %ld\r\n",
+				server->limit, remaining, server->window_at + server->window_sec);
+	}
+
+	if (server->framing == PVS_FRAMING_CHUNKED) {
+		// The body is split into chunks, the first with an extension and the last followed by a trailer.
+		len = snprintf(c->tx, sizeof(c->tx), "HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\nTransfer-Encoding: chunked\r\n%s%s\r\n",
+				status, reason, strRate, (close_after) ? "Connection: close\r\n" : "");
+		for (pos = 0, body_len = strlen(body); (pos < body_len) && (len < (int) sizeof(c->tx)); pos += chunk) {
+			chunk = (body_len - pos < PVS_CHUNK_SIZE) ? body_len - pos : PVS_CHUNK_SIZE;
+			len += snprintf(c->tx + len, sizeof(c->tx) - len, "%x%s\r\n%.*s\r\n", chunk, (pos == 0) ? ";pvs=1" : "", chunk, body + pos);
+		}
+		if (len < (int) sizeof(c->tx)) len += snprintf(c->tx + len, sizeof(c->tx) - len, "0\r\nX-Pvs-Trailer: 1\r\n\r\n");
+	} else if (server->framing == PVS_FRAMING_CLOSE) {
+		// Without a length, the body ends when the connection is closed.
+		len = snprintf(c->tx, sizeof(c->tx), "HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\n%s\r\n%s", status, reason, strRate, body);
+		close_after = 1;
+	} else {
+		len = snprintf(c->tx, sizeof(c->tx), "HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n%s%s\r\n%s",
+				status, reason, (int) strlen(body), strRate, (close_after) ? "Connection: close\r\n" : "", body);
+	}
+	if (len >= (int) sizeof(c->tx)) len = sizeof(c->tx) - 1;
+
+	c->tx_len = len;
+	c->tx_pos = 0;
+	c->tx_at = pvs_time_usec() + (server->latency_msec * 1000L);
+	if (server->jitter_msec > 0) c->tx_at += (rand() % (server->jitter_msec + 1)) * 1000L;
+	c->close_after = close_after;
+
+	return status;
+}
+
+/**
+	Answers an Add Status request, which needs a date, a time and a value.
+
+	Inputs: The query string, and the buffer for the body(and its size).
+	Returns: The status code.
+*/
+int pvs_add_status(char *query, char *strOut, int size)
+{
+	char strValue[LINE_LENGTH];
+
+	if ((!pvs_get_param(query, "d", strValue, sizeof(strValue))) || (strlen(strValue) != 8)) {
+		snprintf(strOut, size, "Bad request 400: Invalid date");
+		return 400;
+	}
+	if ((!pvs_get_param(query, "t", strValue, sizeof(strValue))) || (strchr(strValue, ':') == NULL)) {
+		snprintf(strOut, size, "Bad request 400: Invalid time");
+		return 400;
+	}
+	if ((!pvs_get_param(query, "v1", strValue, sizeof(strValue))) && (!pvs_get_param(query, "v2", strValue, sizeof(strValue))) &&
+		(!pvs_get_param(query, "v3", strValue, sizeof(strValue))) && (!pvs_get_param(query, "v4", strValue, sizeof(strValue)))) {
+		snprintf(strOut, size, "Bad request 400: No status found");
+		return 400;
+	}
+
+	snprintf(strOut, size, "OK 200: Added Status");
+	return 200;
+}
+
+/**
+	Answers an Add Batch Status request, with "date,time,1" for each status added.
+
+	Inputs: The query string, the buffer for the body(and its size), and the number of
+			statuses added.
+	Returns: The status code.
+*/
+int pvs_add_batch(char *query, char *strOut, int size, int *added)
+{
+	char strData[PVS_REQUEST_SIZE];
+	char *status;
+	char *next;
+	char *comma;
+	int count;
+	int len;
+
+	*added = 0;
+	if ((!pvs_get_param(query, "data", strData, sizeof(strData))) || (strData[0] == 0)) {
+		snprintf(strOut, size, "Bad request 400: No statuses found");
+		return 400;
+	}
+
+	count = 1;
+	for (next = strchr(strData, ';'); next != NULL; next = strchr(next + 1, ';')) count++;
+	if (count > PVOUTPUT_BATCH_SIZE) {
+		snprintf(strOut, size, "Bad request 400: Maximum %d statuses per batch", PVOUTPUT_BATCH_SIZE);
+		return 400;
+	}
+
+	len = 0;
+	strOut[0] = 0;
+	for (status = strData; status != NULL; status = next) {
+		next = strchr(status, ';');
+		if (next != NULL) *next++ = 0;
+
+		// Only the date and time are echoed back, with whether the status was added.
+		comma = strchr(status, ',');
+		if (comma != NULL) comma = strchr(comma + 1, ',');
+		if (comma == NULL) {
+			len += snprintf(strOut + len, size - len, "%s%s,0", (len > 0) ? ";" : "", status);
+		} else {
+			len += snprintf(strOut + len, size - len, "%s%.*s,1", (len > 0) ? ";" : "", (int) (comma - status), status);
+			(*added)++;
+		}
+		if (len >= size) {
+			strOut[size - 1] = 0;
+			break;
+		}
+	}
+
+	return 200;
+}
+
+/**
+	Answers a request, injecting the configured faults and the rate limit, and records it.
+
+	Inputs: The server, the client, and the request(null-terminated, without its body).
+*/
+void pvs_handle_request(struct PVS_SERVER *server, struct PVS_CLIENT *c, char *request)
+{
+	char strBody[PVS_RESPONSE_SIZE / 2];
+	char strValue[LINE_LENGTH];
+	char strMethod[16];
+	char strPath[PVS_REQUEST_SIZE];
+	char *query;
+	struct timespec ts;
+	int rate_headers;
+	int close_after;
+	int status;
+	int added;
+
+	server->stats.requests++;
+	added = 0;
+	strPath[0] = 0;
+	sscanf(request, "%15s %8191s", strMethod, strPath);
+	query = strchr(strPath, '?');
+	if (query != NULL) *query++ = 0;
+	else query = "";
+
+	rate_headers = (pvs_get_header(request, "X-Rate-Limit", strValue, sizeof(strValue))) && (atoi(strValue) == 1);
+	close_after = ((pvs_get_header(request, "Connection", strValue, sizeof(strValue))) && (strcasecmp(strValue, "close") == 0)) ||
+			(strstr(request, " HTTP/1.0\r\n") != NULL);
+	if (pvs_chance(server->faults.close)) {
+		server->stats.closes++;
+		close_after = 1;
+	}
+
+	// Each request counts against the rate limit, until the window resets.
+	if (server->limit > 0) {
+		if (time(NULL) >= server->window_at + server->window_sec) {
+			server->window_at = time(NULL);
+			server->used = 0;
+		}
+		server->used++;
+	}
+
+	if ((c->answered > 0) && (pvs_chance(server->faults.stale))) {
+		server->stats.stales++;
+		status = 0;
+	} else if (pvs_chance(server->faults.drop)) {
+		server->stats.drops++;
+		status = 0;
+	} else if (strcmp(strMethod, "GET") != 0) {
+		snprintf(strBody, sizeof(strBody), "Method Not Allowed 405: %s", strMethod);
+		status = 405;
+	} else if ((server->limit > 0) && (server->used > server->limit)) {
+		snprintf(strBody, sizeof(strBody), "Forbidden 403: Exceeded %d requests per hour", server->limit);
+		status = 403;
+	} else if (pvs_chance(server->faults.error)) {
+		snprintf(strBody, sizeof(strBody), "Internal Server Error 500");
+		status = 500;
+	} else if ((!pvs_get_param(query, "key", strValue, sizeof(strValue))) || (!pvs_get_param(query, "sid", strValue, sizeof(strValue)))) {
+		snprintf(strBody, sizeof(strBody), "Unauthorized 401: Invalid API Key");
+		status = 401;
+	} else if (strcmp(strPath, PVS_STATUS_PATH) == 0) {
+		status = pvs_add_status(query, strBody, sizeof(strBody));
+		if (status == 200) added = 1;
+	} else if (strcmp(strPath, PVOUTPUT_BATCH_PATH) == 0) {
+		status = pvs_add_batch(query, strBody, sizeof(strBody), &added);
+	} else {
+		snprintf(strBody, sizeof(strBody), "Not Found 404: %.100s", strPath);
+		status = 404;
+	}
+
+	server->stats.statuses += added;
+	if (status == 403) server->stats.rate_limited++;
+	else if (status == 500) server->stats.errors++;
+	else if (status >= 400) server->stats.bad_requests++;
+
+	// Record the request: the time, the connection, the answer(0 if dropped), and the request line.
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (server->log != NULL) {
+		fprintf(server->log, "%ld.%03ld %d %d %s%s%s\n", (long) ts.tv_sec, ts.tv_nsec / 1000000, (int) (c - server->clients), status,
+				strPath, (query[0] != 0) ? "?" : "", query);
+		fflush(server->log);
+	}
+	if (server->verbose) printf("%d %d %.100s\n", (int) (c - server->clients), status, strPath);
+
+	if (status == 0) pvs_drop_client(c);
+	else pvs_respond(server, c, status, strBody, rate_headers, close_after);
+
+	// A slow answer is acted on straight away, but only sent once the client has given up waiting.
+	if ((status != 0) && (c->answered > 0) && (pvs_chance(server->faults.slow))) {
+		server->stats.slows++;
+		c->tx_at += (HTTP_TIMEOUT_SEC + 1) * 1000000L;
+	}
+}
+
+/**
+	Answers each complete request received from a client, one at a time(a request sent
+	before the last was answered waits for it).
+
+	Inputs: The server, and the client.
+*/
+void pvs_parse_requests(struct PVS_SERVER *server, struct PVS_CLIENT *c)
+{
+	char *end;
+	int len;
+
+	while ((c->fd >= 0) && (c->tx_len == 0)) {
+		c->rx[c->rx_len] = 0;
+		end = strstr(c->rx, "\r\n\r\n");
+		if (end == NULL) {
+			// A request too large to be answered ends the connection.
+			if (c->rx_len == PVS_REQUEST_SIZE) {
+				server->stats.bad_requests++;
+				pvs_drop_client(c);
+			}
+			return;
+		}
+
+		end[2] = 0;
+		len = (end + 4) - c->rx;
+		pvs_handle_request(server, c, c->rx);
+		if (c->fd < 0) return;
+
+		memmove(c->rx, c->rx + len, c->rx_len - len);
+		c->rx_len -= len;
+	}
+}
+
+/**
+	Writes a client's response once it is due(or its next piece, if the server splits
+	responses), closing the connection after it if asked.
+
+	Inputs: The server, and the client.
+*/
+void pvs_transmit(struct PVS_SERVER *server, struct PVS_CLIENT *c)
+{
+	int len;
+	int n;
+
+	if ((c->fd < 0) || (c->tx_len == 0) || (pvs_time_usec() < c->tx_at)) return;
+
+	// A response written in pieces waits between them, so the client receives it in parts.
+	len = c->tx_len - c->tx_pos;
+	if ((server->split_bytes > 0) && (len > server->split_bytes)) len = server->split_bytes;
+	n = send(c->fd, c->tx + c->tx_pos, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (n < 0) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) pvs_drop_client(c);
+		return;
+	}
+	c->tx_pos += n;
+	server->stats.bytes_out += n;
+	if (c->tx_pos < c->tx_len) {
+		if (server->split_bytes > 0) c->tx_at = pvs_time_usec() + (server->split_msec * 1000L);
+		return;
+	}
+
+	c->tx_len = 0;
+	c->tx_pos = 0;
+	c->answered++;
+	if (c->close_after) pvs_drop_client(c);
+	else pvs_parse_requests(server, c);
+}
+
+/**
+	Accepts new connections, receives requests, and sends the responses that are due.
+
+	Inputs: The server, and the longest time to wait(in milliseconds, -1 = until something
+			happens).
+	Returns: 1 on success, -1 if the server can no longer run.
+*/
+int pvs_step(struct PVS_SERVER *server, int timeout_msec)
+{
+	struct pollfd pfds[PVS_MAX_CLIENTS + 1];
+	struct PVS_CLIENT *slots[PVS_MAX_CLIENTS + 1];
+	struct PVS_CLIENT *c;
+	long wait_msec;
+	long due;
+	int count;
+	int fd;
+	int i, n;
+
+	// Wake up for the next response due.
+	wait_msec = timeout_msec;
+	pfds[0].fd = server->fd;
+	pfds[0].events = POLLIN;
+	pfds[0].revents = 0;
+	count = 1;
+	for (i=0; i<PVS_MAX_CLIENTS; i++) {
+		c = &server->clients[i];
+		if (c->fd < 0) continue;
+
+		// A full receive buffer waits for the response in progress to be sent.
+		pfds[count].fd = c->fd;
+		pfds[count].events = (c->rx_len < PVS_REQUEST_SIZE) ? POLLIN : 0;
+		pfds[count].revents = 0;
+		if (c->tx_len > 0) {
+			due = (c->tx_at - pvs_time_usec() + 999) / 1000;
+			if (due <= 0) pfds[count].events |= POLLOUT;
+			else if ((wait_msec < 0) || (due < wait_msec)) wait_msec = due;
+		}
+		slots[count++] = c;
+	}
+
+	if (poll(pfds, count, (int) wait_msec) < 0) return (errno == EINTR) ? 1 : -1;
+
+	// Receive requests, and notice connections the client has closed.
+	for (i=1; i<count; i++) {
+		c = slots[i];
+		if ((pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) && (c->rx_len < PVS_REQUEST_SIZE)) {
+			n = recv(c->fd, c->rx + c->rx_len, PVS_REQUEST_SIZE - c->rx_len, MSG_DONTWAIT);
+			if (n <= 0) {
+				if ((n == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) pvs_drop_client(c);
+				continue;
+			}
+			c->rx_len += n;
+			server->stats.bytes_in += n;
+			pvs_parse_requests(server, c);
+		}
+	}
+	for (i=1; i<count; i++) pvs_transmit(server, slots[i]);
+
+	// Accept new connections(closing any beyond the clients that can be served).
+	if (pfds[0].revents & POLLIN) {
+		while ((fd = accept(server->fd, NULL, NULL)) >= 0) {
+			for (i=0; (i<PVS_MAX_CLIENTS) && (server->clients[i].fd >= 0); i++);
+			if (i == PVS_MAX_CLIENTS) {
+				close(fd);
+				continue;
+			}
+			fcntl(fd, F_SETFL, O_NONBLOCK);
+			memset(&server->clients[i], 0, sizeof(server->clients[i]));
+			server->clients[i].fd = fd;
+			server->stats.connections++;
+		}
+	}
+
+	return 1;
+}
+
+/**
+	Prints the server's statistics.
+
+	Inputs: The server, and the stream to print to.
+*/
+void pvs_print_stats(struct PVS_SERVER *server, FILE *out)
+{
+	fprintf(out, "Connections: %ld\n", server->stats.connections);
+	fprintf(out, "Requests: %ld (%ld statuses added)\n", server->stats.requests, server->stats.statuses);
+	fprintf(out, "Refused: %ld rate limited, %ld bad requests\n", server->stats.rate_limited, server->stats.bad_requests);
+	fprintf(out, "Bytes in/out: %ld/%ld\n", server->stats.bytes_in, server->stats.bytes_out);
+	fprintf(out, "Faults: %ld errors, %ld dropped, %ld closed, %ld stale, %ld slow\n", server->stats.errors, server->stats.drops, server->stats.closes, server->stats.stales, server->stats.slows);
+}
+
+/**
+	Stops a server started by pvs_start(), on SIGTERM.
+*/
+void pvs_stop_serving(int sig)
+{
+	pvs_serving = 0;
+}
+
+/**
+	Starts the server in a child process, which reports its statistics through a pipe
+	when stopped.
+
+	Inputs: The server(listening on a free port once started, if its port is 0), and the
+			pipe's read end.
+	Returns: The child's process ID, or -1 on failure.
+*/
+pid_t pvs_start(struct PVS_SERVER *server, int *stats_fd)
+{
+	struct sigaction sa;
+	int fds[2];
+	pid_t pid;
+
+	if (pvs_open(server) != 1) return -1;
+	if (pipe(fds) < 0) {
+		pvs_close(server);
+		return -1;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		// Serve requests until the parent stops us, then report.
+		close(fds[0]);
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = pvs_stop_serving;
+		sigaction(SIGTERM, &sa, NULL);
+		pvs_serving = 1;
+		while ((pvs_serving) && (pvs_step(server, 100) == 1));
+		if (write(fds[1], &server->stats, sizeof(server->stats)) < 0) _exit(EXIT_FAILURE);
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+	close(server->fd);
+	*stats_fd = fds[0];
+
+	return pid;
+}
+
+/**
+	Stops a server started by pvs_start(), and collects its statistics.
+
+	Inputs: The child's process ID, the pipe's read end, and the statistics to fill in.
+*/
+void pvs_stop(pid_t pid, int stats_fd, struct PVS_STATS *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	kill(pid, SIGTERM);
+	if (read(stats_fd, stats, sizeof(*stats)) != sizeof(*stats)) fprintf(stderr, "The PVOutput server did not report its statistics.\n");
+	close(stats_fd);
+	waitpid(pid, NULL, 0);
+}
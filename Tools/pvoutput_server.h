@@ -0,0 +1,105 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Stands in for PVOutput's Add Status and Add Batch Status services,
+					for testing and benchmarking uploads without www.pvoutput.org.
+	Version		:	v0.8
+*/
+
+#ifndef PVOUTPUT_SERVER_H
+
+	// Header Guard.
+	#define PVOUTPUT_SERVER_H
+
+	// Include Files.
+	#include "../Application/global.h"
+
+	/*
+	* Definitions.
+	*/
+
+	#define PVS_MAX_CLIENTS				32											// Most connections open at once
+	#define PVS_REQUEST_SIZE			8192										// Largest request(request line and headers)
+	#define PVS_RESPONSE_SIZE			4096										// Largest response
+	#define PVS_STATUS_PATH				"/service/r2/addstatus.jsp"					// PVOutput Add Status service
+	#define PVS_PORT					18080										// Default port
+	#define PVS_RATE_LIMIT				60											// Default requests allowed per window
+	#define PVS_RATE_WINDOW_SEC			3600										// Default rate limit window (in seconds)
+	#define PVS_CHUNK_SIZE				16											// Largest chunk of a chunked response body
+
+	// Response Framing (how the end of a response body is marked)
+	#define PVS_FRAMING_LENGTH			0											// Content-Length header
+	#define PVS_FRAMING_CHUNKED			1											// Transfer-Encoding: chunked
+	#define PVS_FRAMING_CLOSE			2											// The connection is closed after the body
+
+	/*
+	 * Custom Structures
+	 */
+
+	// Server Faults (chance of each fault per request, in percent)
+	struct PVS_FAULTS {
+		int 	error;				// Answered with 500 Internal Server Error.
+		int 	drop;				// The connection is closed without an answer.
+		int 	close;				// Answered, then the connection is closed.
+		int 	stale;				// A request on a reused connection is dropped, as by a server that timed it out.
+		int 	slow;				// A request on a reused connection is answered only after the client has timed out.
+	};
+
+	// Server Statistics
+	struct PVS_STATS {
+		long 	connections;		// Connections accepted.
+		long 	requests;			// Requests received.
+		long 	statuses;			// Statuses added.
+		long 	bad_requests;		// Requests answered with 400, 401, 404 or 405.
+		long 	rate_limited;		// Requests answered with 403, as the rate limit was exceeded.
+		long 	errors;
+		long 	drops;
+		long 	closes;
+		long 	stales;
+		long 	slows;
+		long 	bytes_in;
+		long 	bytes_out;
+	};
+
+	// Server Client (a connection, the request being received, and the response due)
+	struct PVS_CLIENT {
+		int 	fd;					// Socket(-1 if the slot is free).
+		char 	rx[PVS_REQUEST_SIZE+1];
+		int 	rx_len;				// Bytes of the next request received.
+		char 	tx[PVS_RESPONSE_SIZE];
+		int 	tx_len;				// Length of the response in progress(0 if none).
+		int 	tx_pos;				// Bytes of the response written.
+		long 	tx_at;				// Time the response is due (in microseconds).
+		int 	close_after;		// 1 to close the connection once the response is written.
+		int 	answered;			// Responses written on the connection.
+	};
+
+	// PVOutput Server (the listening socket, its clients, and the behaviour injected)
+	struct PVS_SERVER {
+		int 				fd;				// Listening socket.
+		int 				port;			// Port listened on(0 picks a free port when opened).
+		struct PVS_CLIENT 	clients[PVS_MAX_CLIENTS];
+		int 				latency_msec;	// Time taken to answer each request.
+		int 				jitter_msec;	// Random extra latency, up to this many milliseconds.
+		int 				limit;			// Requests allowed per window(0 = unlimited).
+		int 				window_sec;		// Rate limit window.
+		int 				framing;		// How each response body is framed(PVS_FRAMING_*).
+		int 				split_bytes;	// Responses are written in pieces of this many bytes(0 = whole).
+		int 				split_msec;		// Time between the pieces of a response.
+		long 				window_at;		// Time the current window started (Unix time).
+		int 				used;			// Requests made in the current window.
+		struct PVS_FAULTS 	faults;
+		struct PVS_STATS 	stats;
+		FILE 				*log;			// Each request is recorded here, if set.
+		int 				verbose;
+	};
+
+	// External declarations.
+	extern int 		pvs_open(struct PVS_SERVER *);
+	extern void 	pvs_close(struct PVS_SERVER *);
+	extern int 		pvs_step(struct PVS_SERVER *, int);
+	extern void 	pvs_print_stats(struct PVS_SERVER *, FILE *);
+	extern pid_t 	pvs_start(struct PVS_SERVER *, int *);
+	extern void 	pvs_stop(pid_t, int, struct PVS_STATS *);
+
+#endif
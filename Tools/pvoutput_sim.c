@@ -0,0 +1,120 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Stands in for PVOutput's Add Status and Add Batch Status services,
+					for testing and benchmarking uploads without www.pvoutput.org.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "pvoutput_server.h"
+
+#define	PVS_OPTLIST		"p:l:j:L:W:F:P:D:r:E:N:C:K:T:S:v"
+
+volatile sig_atomic_t pvs_running = 1;
+
+/**
+	Stops the server on SIGTERM/SIGINT.
+*/
+void handle_stop_signal(int sig)
+{
+	pvs_running = 0;
+}
+
+/**
+	Prints the command line options.
+*/
+void print_options(char *name)
+{
+	printf("Usage: %s [options]\n\n", name);
+	printf("\t-p x\t\tPort to listen on, on the loopback interface(%d (Default), 0=Any free port)\n", PVS_PORT);
+	printf("\t-l x\t\tLatency of each response in milliseconds(0 (Default))\n");
+	printf("\t-j x\t\tRandom extra latency, up to x milliseconds(0 (Default))\n");
+	printf("\t-L x\t\tRequests allowed per window, answered with 403 beyond it(%d (Default), 0=Unlimited)\n", PVS_RATE_LIMIT);
+	printf("\t-W x\t\tRate limit window in seconds(%d (Default))\n", PVS_RATE_WINDOW_SEC);
+	printf("\t-F x\t\tResponse framing(length (Default), chunked, close)\n");
+	printf("\t-P x\t\tWrite each response in pieces of x bytes(0=Whole (Default))\n");
+	printf("\t-D x\t\tTime between the pieces of a response in milliseconds(0 (Default))\n");
+	printf("\t-r file\t\tRecord each request, as \"time connection status request\" per line\n");
+	printf("\t-v\t\tVerbose, print each request\n\n");
+	printf("Faults(chance per request, in percent)\n");
+	printf("\t-E x\t\t500 Internal Server Error\n");
+	printf("\t-N x\t\tNo response(the connection is closed)\n");
+	printf("\t-C x\t\tConnection closed after the response\n");
+	printf("\t-K x\t\tRequest on a kept-alive connection dropped, as by a server that timed it out\n");
+	printf("\t-T x\t\tRequest on a kept-alive connection answered after the client's %d second timeout\n", HTTP_TIMEOUT_SEC);
+	printf("\t-S x\t\tRandom seed\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct PVS_SERVER server;
+	struct sigaction sa;
+	char *log_file;
+	int opt;
+
+	memset(&server, 0, sizeof(server));
+	server.port = PVS_PORT;
+	server.limit = PVS_RATE_LIMIT;
+	server.window_sec = PVS_RATE_WINDOW_SEC;
+	log_file = NULL;
+	srand(time(NULL));
+
+	while ((opt = getopt(argc, argv, PVS_OPTLIST)) != -1)
+	{
+		switch (opt) {
+			case 'p': server.port = atoi(optarg); break;
+			case 'l': server.latency_msec = atoi(optarg); break;
+			case 'j': server.jitter_msec = atoi(optarg); break;
+			case 'L': server.limit = atoi(optarg); break;
+			case 'W':
+				server.window_sec = atoi(optarg);
+				if (server.window_sec < 1) server.window_sec = PVS_RATE_WINDOW_SEC;
+				break;
+			case 'F':
+				if (strcmp(optarg, "chunked") == 0) server.framing = PVS_FRAMING_CHUNKED;
+				else if (strcmp(optarg, "close") == 0) server.framing = PVS_FRAMING_CLOSE;
+				else server.framing = PVS_FRAMING_LENGTH;
+				break;
+			case 'P': server.split_bytes = atoi(optarg); break;
+			case 'D': server.split_msec = atoi(optarg); break;
+			case 'r': log_file = optarg; break;
+			case 'E': server.faults.error = atoi(optarg); break;
+			case 'N': server.faults.drop = atoi(optarg); break;
+			case 'C': server.faults.close = atoi(optarg); break;
+			case 'K': server.faults.stale = atoi(optarg); break;
+			case 'T': server.faults.slow = atoi(optarg); break;
+			case 'S': srand(atoi(optarg)); break;
+			case 'v': server.verbose = 1; break;
+			default:
+				print_options(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if ((log_file != NULL) && ((server.log = fopen(log_file, "a")) == NULL)) {
+		perror("Unable to open the request log.");
+		return EXIT_FAILURE;
+	}
+	if (pvs_open(&server) != 1) return EXIT_FAILURE;
+
+	// Print the address for scripts to pass to motech -o.
+	printf("127.0.0.1:%d\n", server.port);
+	fflush(stdout);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_stop_signal;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	while (pvs_running) {
+		if (pvs_step(&server, 1000) != 1) break;
+		if (server.verbose) fflush(stdout);
+	}
+
+	pvs_print_stats(&server, stderr);
+	pvs_close(&server);
+	if (server.log != NULL) fclose(server.log);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,546 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Simulates Motech inverters on a pseudo-terminal, for testing
+					and benchmarking without an inverter attached.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "simulator.h"
+
+/**
+	Gets the time from a monotonic clock.
+
+	Returns: The time in microseconds.
+*/
+long sim_time_usec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000L) + (ts.tv_nsec / 1000);
+}
+
+/**
+	Calculates the CRC16 of a frame, independently of protocol.c so that the simulator
+	also checks the application's CRC.
+
+	Inputs: The bytes, and the number of bytes.
+	Returns: The CRC(low byte is sent first).
+*/
+unsigned short sim_crc16(unsigned char *data, int len)
+{
+	unsigned short crc;
+	int i, j;
+
+	crc = 0xFFFF;
+	for (i=0; i<len; i++) {
+		crc ^= data[i];
+		for (j=0; j<8; j++) {
+			if (crc & 1) crc = (crc >> 1) ^ 0xA001;
+			else crc >>= 1;
+		}
+	}
+
+	return crc;
+}
+
+/**
+	Stores a string in consecutive registers, two characters per register.
+
+	Inputs: The inverter, the first register, and the string.
+*/
+void sim_set_string(struct SIM_INVERTER *inv, int reg, char *str)
+{
+	int len;
+	int i;
+
+	len = strlen(str);
+	for (i=0; i<STRING_REGISTERS; i++) {
+		inv->regs[reg+i] = (((i*2 < len) ? (unsigned char) str[i*2] : ' ') << 8) | ((i*2+1 < len) ? (unsigned char) str[i*2+1] : ' ');
+	}
+}
+
+/**
+	Fills an inverter's registers with plausible values for a sunny afternoon.
+
+	Inputs: The inverter.
+*/
+void sim_default_registers(struct SIM_INVERTER *inv)
+{
+	char sn[STRING_REGISTERS*2+1];
+	int i;
+
+	memset(inv->regs, 0, sizeof(inv->regs));
+
+	// Trip settings(0x01, 0x0B), and device settings(0x12).
+	for (i=0; i<10; i++) inv->regs[0x01+i] = 100 + i;
+	for (i=0; i<7; i++) inv->regs[0x0B+i] = 200 + i;
+	inv->regs[0x12] = 1;
+	inv->regs[0x13] = inv->address;
+	inv->regs[0x14] = 0;
+	inv->regs[0x15] = 0;
+
+	// Total values(0x19): relay count, running time, and energy(kWh, 0.1 Wh).
+	inv->regs[0x1A] = 120;
+	inv->regs[0x1B] = 5123;
+	inv->regs[0x1C] = 30;
+	inv->regs[0x1E] = 15234;
+	inv->regs[0x1F] = 5000;
+
+	// Brand, type, and a serial number derived from the address.
+	sprintf(sn, "SN%014d", inv->address);
+	sim_set_string(inv, 0x67, "MOTECH");
+	sim_set_string(inv, 0x6F, "PVMate3840U");
+	sim_set_string(inv, 0x77, sn);
+
+	// Current state(0xB5): producing, no errors.
+	inv->regs[0xB5] = 2;
+
+	// Current values(0xBA): PV voltages and powers, AC voltage, power, current, frequency and energy today.
+	inv->regs[0xBA] = 3500;
+	inv->regs[0xBB] = 3480;
+	inv->regs[0xBD] = 1200;
+	inv->regs[0xBE] = 1150;
+	inv->regs[0xC0] = 2405;
+	inv->regs[0xC1] = 2300;
+	inv->regs[0xC2] = 96;
+	inv->regs[0xC3] = 5002;
+	inv->regs[0xC4] = 12;
+	inv->regs[0xC5] = 3456;
+
+	// Extended current values(0xCC): time on today(1/2048 hr), and heatsink temperature.
+	inv->regs[0xCC] = 5 * 2048;
+	inv->regs[0xCE] = 452;
+}
+
+/**
+	Adds an inverter address to the simulator, with the default register contents.
+
+	Inputs: The simulator, and the address.
+	Returns: The inverter, or NULL if the list is full.
+*/
+struct SIM_INVERTER *sim_add_inverter(struct SIMULATOR *sim, int address)
+{
+	struct SIM_INVERTER *inv;
+	int i;
+
+	for (i=0; i<sim->count; i++) {
+		if (sim->inverters[i].address == address) return &sim->inverters[i];
+	}
+	if (sim->count >= SIM_MAX_INVERTERS) return NULL;
+
+	inv = &sim->inverters[sim->count++];
+	inv->address = address;
+	sim_default_registers(inv);
+
+	return inv;
+}
+
+/**
+	Finds a simulated inverter.
+
+	Inputs: The simulator, and the address.
+	Returns: The inverter, or NULL if the address is not simulated.
+*/
+struct SIM_INVERTER *sim_find_inverter(struct SIMULATOR *sim, int address)
+{
+	int i;
+
+	for (i=0; i<sim->count; i++) {
+		if (sim->inverters[i].address == address) return &sim->inverters[i];
+	}
+
+	return NULL;
+}
+
+/**
+	Sets a register of one inverter, or of all of them.
+
+	Inputs: The simulator, the address(-1 for all inverters), the register, and the value.
+	Returns: 1 on success, -1 otherwise.
+*/
+int sim_set_register(struct SIMULATOR *sim, int address, int reg, int value)
+{
+	int i;
+
+	if ((reg < 0) || (reg >= SIM_REGISTERS)) return -1;
+
+	for (i=0; i<sim->count; i++) {
+		if ((address < 0) || (sim->inverters[i].address == address)) sim->inverters[i].regs[reg] = value & 0xFFFF;
+	}
+
+	return 1;
+}
+
+/**
+	Loads register contents from a file. Each line holds "register value [address]"
+	(decimal, or hexadecimal with 0x), and lines starting with # are ignored.
+
+	Inputs: The simulator, and the file name.
+	Returns: 1 on success, -1 otherwise.
+*/
+int sim_load_registers(struct SIMULATOR *sim, char *file_name)
+{
+	FILE *file;
+	char line[BUFSIZ];
+	char reg[BUFSIZ], value[BUFSIZ], address[BUFSIZ];
+	int fields;
+
+	file = fopen(file_name, "r");
+	if (file == NULL) return -1;
+
+	while (fgets (line, sizeof(line), file) != NULL)
+	{
+		if (line[0] == '#') continue;
+		fields = sscanf(line, "%s %s %s", reg, value, address);
+		if (fields < 2) continue;
+		sim_set_register(sim, (fields == 3) ? (int) strtol(address, NULL, 0) : -1, (int) strtol(reg, NULL, 0), (int) strtol(value, NULL, 0));
+	}
+	fclose (file);
+
+	return 1;
+}
+
+/**
+	Opens a pseudo-terminal for the application to use as its serial port.
+
+	Inputs: The simulator.
+	Returns: 1 on success, -1 otherwise.
+*/
+int sim_open(struct SIMULATOR *sim)
+{
+	struct termios options;
+	char *name;
+	int i;
+
+	sim->master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (sim->master < 0) {
+		perror("Unable to open a pseudo-terminal.");
+		return -1;
+	}
+	if ((grantpt(sim->master) < 0) || (unlockpt(sim->master) < 0) || ((name = ptsname(sim->master)) == NULL)) {
+		perror("Unable to unlock the pseudo-terminal.");
+		close(sim->master);
+		return -1;
+	}
+	snprintf(sim->dev_name, sizeof(sim->dev_name), "%s", name);
+
+	// Hold the slave open in raw mode, so it does not echo before the application configures it.
+	sim->slave = open(sim->dev_name, O_RDWR | O_NOCTTY);
+	if (sim->slave < 0) {
+		perror("Unable to open the pseudo-terminal slave.");
+		close(sim->master);
+		return -1;
+	}
+	tcgetattr(sim->slave, &options);
+	cfmakeraw(&options);
+	tcsetattr(sim->slave, TCSANOW, &options);
+
+	// Paced inverters start at the rate the responses are paced at.
+	if (sim->baud == 19200) {
+		for (i=0; i<sim->count; i++) sim->inverters[i].regs[INV_BAUD_REGISTER] = 1;
+	}
+
+	fcntl(sim->master, F_SETFL, O_NONBLOCK);
+	sim->rx_len = 0;
+	sim->tx_len = 0;
+	sim->tx_pos = 0;
+
+	return 1;
+}
+
+/**
+	Closes the pseudo-terminal.
+
+	Inputs: The simulator.
+*/
+void sim_close(struct SIMULATOR *sim)
+{
+	close(sim->slave);
+	close(sim->master);
+}
+
+/**
+	Decides whether a fault is injected.
+
+	Inputs: The chance of the fault(in percent).
+	Returns: 1 if the fault is injected, 0 otherwise.
+*/
+int sim_chance(int percent)
+{
+	return (percent > 0) && ((rand() % 100) < percent);
+}
+
+/**
+	Gets the baud rate an inverter is set to, from its Baudrate register(0=9600, 1=19200,
+	as the application assumes).
+
+	Inputs: The inverter.
+	Returns: The termios baud rate.
+*/
+speed_t sim_inverter_baud(struct SIM_INVERTER *inv)
+{
+	return (inv->regs[INV_BAUD_REGISTER] == 1) ? B19200 : B9600;
+}
+
+/**
+	Sends a response frame, injecting the configured faults, and schedules it after the
+	turnaround latency(paced at the inverter's baud rate, if responses are paced).
+
+	Inputs: The simulator, the inverter, the frame, and its length.
+*/
+void sim_send(struct SIMULATOR *sim, struct SIM_INVERTER *inv, unsigned char *frame, int len)
+{
+	int pos;
+	int i, n;
+
+	if (sim_chance(sim->faults.silent)) {
+		sim->stats.silent++;
+		if (sim->verbose) fprintf(stderr, "Fault: no response from address %d.\n", inv->address);
+		return;
+	}
+
+	// Inject faults into the frame.
+	if (sim_chance(sim->faults.bad_crc)) {
+		frame[len-2] ^= 0x5A;
+		sim->stats.bad_crc++;
+		if (sim->verbose) fprintf(stderr, "Fault: bad CRC from address %d.\n", inv->address);
+	}
+	if (sim_chance(sim->faults.truncate)) {
+		len = 1 + (rand() % (len - 1));
+		sim->stats.truncate++;
+		if (sim->verbose) fprintf(stderr, "Fault: truncated to %d bytes from address %d.\n", len, inv->address);
+	}
+	if (sim_chance(sim->faults.drop)) {
+		pos = rand() % len;
+		memmove(frame + pos, frame + pos + 1, len - pos - 1);
+		len--;
+		sim->stats.drop++;
+		if (sim->verbose) fprintf(stderr, "Fault: dropped byte %d from address %d.\n", pos, inv->address);
+	}
+
+	// Stray bytes(line noise, or another device) ahead of the frame.
+	n = 0;
+	if (sim_chance(sim->faults.stray)) {
+		n = 1 + (rand() % 3);
+		sim->stats.stray++;
+		if (sim->verbose) fprintf(stderr, "Fault: %d stray bytes before address %d.\n", n, inv->address);
+	}
+	for (i=0; i<n; i++) sim->tx[i] = rand() & 0xFF;
+	memcpy(sim->tx + n, frame, len);
+
+	sim->tx_len = n + len;
+	sim->tx_pos = 0;
+	sim->tx_baud = (sim->baud > 0) ? ((sim_inverter_baud(inv) == B19200) ? 19200 : 9600) : 0;
+	sim->tx_at = sim_time_usec() + (sim->latency_msec * 1000L);
+	if (sim->jitter_msec > 0) sim->tx_at += (rand() % (sim->jitter_msec * 1000L));
+	sim->stats.responses++;
+}
+
+/**
+	Builds the response to a read request.
+
+	Inputs: The simulator, the inverter, the first register, and the number of registers.
+*/
+void sim_respond(struct SIMULATOR *sim, struct SIM_INVERTER *inv, int start, int count)
+{
+	unsigned char frame[SIM_MAX_FRAME];
+	unsigned short crc;
+	int len;
+	int i;
+
+	if ((count < 1) || (count * 2 > FRAME_MAX_DATA) || (start + count > SIM_REGISTERS)) return;
+
+	// Build "0A address 03 length data... crc crc 0D".
+	len = 0;
+	frame[len++] = 0x0A;
+	frame[len++] = inv->address;
+	frame[len++] = 0x03;
+	frame[len++] = count * 2;
+	for (i=0; i<count; i++) {
+		frame[len++] = inv->regs[start+i] >> 8;
+		frame[len++] = inv->regs[start+i] & 0xFF;
+	}
+	crc = sim_crc16(frame + 1, len - 1);
+	frame[len++] = crc & 0xFF;
+	frame[len++] = crc >> 8;
+	frame[len++] = 0x0D;
+
+	sim_send(sim, inv, frame, len);
+}
+
+/**
+	Writes a register, acknowledging by echoing the request. The acknowledgement goes out
+	at the inverter's old baud rate, and a new Baudrate takes effect after it.
+
+	Inputs: The simulator, the inverter, and the request.
+*/
+void sim_write(struct SIMULATOR *sim, struct SIM_INVERTER *inv, unsigned char *req)
+{
+	unsigned char frame[REQUEST_LENGTH];
+	int reg = (req[3] << 8) | req[4];
+
+	if (reg >= SIM_REGISTERS) return;
+	sim->stats.writes++;
+	memcpy(frame, req, REQUEST_LENGTH);
+	sim_send(sim, inv, frame, REQUEST_LENGTH);
+	inv->regs[reg] = (req[5] << 8) | req[6];
+}
+
+/**
+	Checks that the application's serial port is set to the baud rate an inverter is set
+	to(on a real line, a request at another rate arrives as noise). The pseudo-terminal
+	master reports the slave's settings.
+
+	Inputs: The simulator, and the inverter.
+	Returns: 1 if the rates match, 0 otherwise.
+*/
+int sim_link_matches(struct SIMULATOR *sim, struct SIM_INVERTER *inv)
+{
+	struct termios options;
+
+	if (tcgetattr(sim->master, &options) < 0) return 1;
+	return cfgetospeed(&options) == sim_inverter_baud(inv);
+}
+
+/**
+	Looks for complete requests in the received bytes, skipping bytes that do not start
+	a valid request. Only one response is built at a time, as on a half-duplex bus.
+
+	Inputs: The simulator.
+*/
+void sim_parse_requests(struct SIMULATOR *sim)
+{
+	struct SIM_INVERTER *inv;
+	unsigned short crc;
+	unsigned char *req;
+	int skip;
+
+	while ((sim->tx_len == 0) && (sim->rx_len > 0)) {
+		req = sim->rx;
+		skip = 1;
+
+		if (req[0] == 0x0A) {
+			if (sim->rx_len < REQUEST_LENGTH) break;
+
+			// "0A address function startHi startLo countHi countLo crc crc 0D"
+			crc = sim_crc16(req + 1, 6);
+			if ((req[9] == 0x0D) && (req[7] == (crc & 0xFF)) && (req[8] == (crc >> 8))) {
+				skip = REQUEST_LENGTH;
+				sim->stats.requests++;
+				inv = sim_find_inverter(sim, req[1]);
+				if (sim->verbose) fprintf(stderr, "Request: address %d, function 0x%02X, register 0x%02X, count %d%s\n", req[1], req[2], (req[3] << 8) | req[4], (req[5] << 8) | req[6], (inv == NULL) ? " (not simulated)" : "");
+				if ((inv != NULL) && (!sim_link_matches(sim, inv))) {
+					sim->stats.mismatched++;
+					if (sim->verbose) fprintf(stderr, "Ignored: address %d is set to %dbps.\n", inv->address, (sim_inverter_baud(inv) == B19200) ? 19200 : 9600);
+				} else if ((inv != NULL) && (req[2] == 0x03)) {
+					sim_respond(sim, inv, (req[3] << 8) | req[4], (req[5] << 8) | req[6]);
+				} else if ((inv != NULL) && (req[2] == 0x06)) {
+					sim_write(sim, inv, req);
+				}
+			}
+		}
+
+		if (skip == 1) sim->stats.rejected++;
+		memmove(sim->rx, sim->rx + skip, sim->rx_len - skip);
+		sim->rx_len -= skip;
+	}
+}
+
+/**
+	Writes the response bytes that are due, pacing them at the baud rate.
+
+	Inputs: The simulator.
+	Returns: 1 on success, -1 otherwise.
+*/
+int sim_transmit(struct SIMULATOR *sim)
+{
+	long now;
+	long byte_usec;
+	int due;
+	int written;
+
+	now = sim_time_usec();
+	if ((sim->tx_len == 0) || (now < sim->tx_at)) return 1;
+
+	// Each byte takes 10 bits(start, 8 data, stop) on the wire.
+	if (sim->tx_baud > 0) {
+		byte_usec = 10000000L / sim->tx_baud;
+		due = 1 + (int) ((now - sim->tx_at) / byte_usec);
+	} else {
+		byte_usec = 0;
+		due = sim->tx_len;
+	}
+	if (due > sim->tx_len - sim->tx_pos) due = sim->tx_len - sim->tx_pos;
+
+	written = write(sim->master, sim->tx + sim->tx_pos, due);
+	if (written < 0) return ((errno == EAGAIN) || (errno == EINTR)) ? 1 : -1;
+
+	sim->tx_pos += written;
+	sim->tx_at += written * byte_usec;
+	sim->stats.bytes_out += written;
+	if (sim->tx_pos >= sim->tx_len) {
+		sim->tx_len = 0;
+		sim->tx_pos = 0;
+		sim_parse_requests(sim);
+	}
+
+	return 1;
+}
+
+/**
+	Waits for requests, and sends any response that is due.
+
+	Inputs: The simulator, and the longest time to wait(in milliseconds, -1 for no limit).
+	Returns: 1 on success, -1 otherwise.
+*/
+int sim_step(struct SIMULATOR *sim, int timeout_msec)
+{
+	struct pollfd pfd;
+	long wait_msec;
+	int n;
+
+	// Wake up for the next response byte.
+	wait_msec = timeout_msec;
+	if (sim->tx_len > 0) {
+		wait_msec = (sim->tx_at - sim_time_usec() + 999) / 1000;
+		if (wait_msec < 0) wait_msec = 0;
+		if ((timeout_msec >= 0) && (wait_msec > timeout_msec)) wait_msec = timeout_msec;
+	}
+
+	pfd.fd = sim->master;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, (int) wait_msec) < 0) return (errno == EINTR) ? 1 : -1;
+
+	if (pfd.revents & POLLIN) {
+		// Keep the newest bytes if a request arrives while a response is still being sent.
+		if (sim->rx_len == sizeof(sim->rx)) {
+			memmove(sim->rx, sim->rx + REQUEST_LENGTH, sim->rx_len - REQUEST_LENGTH);
+			sim->rx_len -= REQUEST_LENGTH;
+		}
+		n = read(sim->master, sim->rx + sim->rx_len, sizeof(sim->rx) - sim->rx_len);
+		if (n > 0) {
+			sim->rx_len += n;
+			sim->stats.bytes_in += n;
+			sim_parse_requests(sim);
+		}
+	}
+
+	return sim_transmit(sim);
+}
+
+/**
+	Prints the simulator statistics.
+
+	Inputs: The simulator, and the stream to print to.
+*/
+void sim_print_stats(struct SIMULATOR *sim, FILE *out)
+{
+	fprintf(out, "Requests: %ld (%ld bytes rejected)\n", sim->stats.requests, sim->stats.rejected);
+	fprintf(out, "Responses: %ld (%ld register writes, %ld requests ignored at the wrong baud rate)\n", sim->stats.responses, sim->stats.writes, sim->stats.mismatched);
+	fprintf(out, "Bytes in/out: %ld/%ld\n", sim->stats.bytes_in, sim->stats.bytes_out);
+	fprintf(out, "Faults: %ld silent, %ld stray, %ld bad CRC, %ld truncated, %ld dropped\n", sim->stats.silent, sim->stats.stray, sim->stats.bad_crc, sim->stats.truncate, sim->stats.drop);
+}
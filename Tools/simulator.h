@@ -0,0 +1,95 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Simulates Motech inverters on a pseudo-terminal, for testing
+					and benchmarking without an inverter attached.
+	Version		:	v0.8
+*/
+
+#ifndef SIMULATOR_H
+
+	// Header Guard.
+	#define SIMULATOR_H
+
+	// Include Files(posix_openpt() and cfmakeraw() need the GNU extensions).
+	#ifndef _GNU_SOURCE
+		#define _GNU_SOURCE
+	#endif
+	#include "../Application/global.h"
+
+	/*
+	* Definitions.
+	*/
+
+	#define SIM_MAX_INVERTERS			32											// Most inverter addresses served by one simulator
+	#define SIM_REGISTERS				256											// Registers per simulated inverter
+	#define SIM_MAX_FRAME				(FRAME_MAX_DATA + 16)						// Largest response frame, with stray bytes
+	#define SIM_LATENCY_MSEC			10											// Default turnaround latency (in milliseconds)
+
+	/*
+	 * Custom Structures
+	 */
+
+	// Simulated Inverter (an address, and its register contents)
+	struct SIM_INVERTER {
+		int 			address;
+		unsigned short 	regs[SIM_REGISTERS];
+	};
+
+	// Simulator Faults (chance of each fault per response, in percent)
+	struct SIM_FAULTS {
+		int 	silent;				// No response at all.
+		int 	stray;				// Random bytes before the frame.
+		int 	bad_crc;			// A corrupted CRC.
+		int 	truncate;			// The frame is cut short.
+		int 	drop;				// One byte of the frame is lost.
+	};
+
+	// Simulator Statistics
+	struct SIM_STATS {
+		long 	requests;			// Valid requests received(for any address).
+		long 	responses;			// Responses sent.
+		long 	rejected;			// Bytes discarded while looking for a valid request.
+		long 	mismatched;			// Requests ignored, as the line was not at the inverter's baud rate.
+		long 	writes;				// Registers written.
+		long 	silent;
+		long 	stray;
+		long 	bad_crc;
+		long 	truncate;
+		long 	drop;
+		long 	bytes_in;
+		long 	bytes_out;
+	};
+
+	// Simulator (a pseudo-terminal, the inverters answering on it, and the response in progress)
+	struct SIMULATOR {
+		int 					master;			// Pseudo-terminal master file descriptor.
+		int 					slave;			// Pseudo-terminal slave, held open so the master never hangs up.
+		char 					dev_name[64];	// Pseudo-terminal slave device name.
+		struct SIM_INVERTER 	inverters[SIM_MAX_INVERTERS];
+		int 					count;			// Number of inverters.
+		int 					latency_msec;	// Turnaround latency before each response.
+		int 					jitter_msec;	// Random extra latency, up to this many milliseconds.
+		int 					baud;			// Bits per second the inverters start at, and responses are paced (0 = unpaced, at 9600).
+		struct SIM_FAULTS 		faults;
+		struct SIM_STATS 		stats;
+		int 					verbose;
+		unsigned char 			rx[REQUEST_LENGTH * 4];
+		int 					rx_len;			// Bytes of the next request received.
+		unsigned char 			tx[SIM_MAX_FRAME];
+		int 					tx_len;			// Length of the response in progress.
+		int 					tx_pos;			// Bytes of the response written.
+		long 					tx_at;			// Time the next response byte is due (in microseconds).
+		int 					tx_baud;		// Bits per second the response in progress is paced at (0 = unpaced).
+	};
+
+	// External declarations.
+	extern int 		sim_open(struct SIMULATOR *);
+	extern void 	sim_close(struct SIMULATOR *);
+	extern struct SIM_INVERTER *sim_add_inverter(struct SIMULATOR *, int);
+	extern int 		sim_set_register(struct SIMULATOR *, int, int, int);
+	extern int 		sim_load_registers(struct SIMULATOR *, char *);
+	extern int 		sim_step(struct SIMULATOR *, int);
+	extern void 	sim_print_stats(struct SIMULATOR *, FILE *);
+
+#endif
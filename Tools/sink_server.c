@@ -0,0 +1,435 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Stands in for the sinks samples are published to(an MQTT broker,
+					InfluxDB's /write service, and a UDP listener), checking the framing of
+					what each receives, for testing publishing without the real services.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "sink_server.h"
+
+/**
+	Opens the server's socket on the loopback interface: a listening socket for MQTT and
+	InfluxDB, or a datagram socket for UDP.
+
+	Inputs: The server(its port is set, if 0 was asked for).
+	Returns: 1 on success, -1 otherwise.
+*/
+int sks_open(struct SKS_SERVER *server)
+{
+	struct sockaddr_in addr;
+	socklen_t len;
+	int on;
+	int i;
+
+	if (server->type == SINK_UDP) server->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	else server->fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (server->fd < 0) {
+		perror("Unable to create the server's socket.");
+		return -1;
+	}
+	on = 1;
+	setsockopt(server->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(server->port);
+	if ((bind(server->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+		((server->type != SINK_UDP) && (listen(server->fd, SKS_MAX_CLIENTS) < 0))) {
+		perror("Unable to listen on the port.");
+		close(server->fd);
+		return -1;
+	}
+	len = sizeof(addr);
+	if (getsockname(server->fd, (struct sockaddr *) &addr, &len) == 0) server->port = ntohs(addr.sin_port);
+
+	fcntl(server->fd, F_SETFL, O_NONBLOCK);
+	for (i=0; i<SKS_MAX_CLIENTS; i++) server->clients[i].fd = -1;
+
+	return 1;
+}
+
+/**
+	Closes a client's connection, discarding anything received but not yet parsed.
+
+	Inputs: The client.
+*/
+void sks_drop_client(struct SKS_CLIENT *c)
+{
+	if (c->fd < 0) return;
+
+	close(c->fd);
+	c->fd = -1;
+	c->rx_len = 0;
+	c->connected = 0;
+}
+
+/**
+	Closes every connection(so a sink waiting on a server that hangs finds it gone).
+
+	Inputs: The server.
+*/
+void sks_drop_clients(struct SKS_SERVER *server)
+{
+	int i;
+
+	for (i=0; i<SKS_MAX_CLIENTS; i++) sks_drop_client(&server->clients[i]);
+}
+
+/**
+	Closes the server's socket, and every connection.
+
+	Inputs: The server.
+*/
+void sks_close(struct SKS_SERVER *server)
+{
+	sks_drop_clients(server);
+	close(server->fd);
+}
+
+/**
+	Records a sample received.
+
+	Inputs: The server, the MQTT topic(and its length, 0 if none), and the sample(and its
+			length, without its newline).
+*/
+void sks_record(struct SKS_SERVER *server, char *topic, int topic_len, char *line, int len)
+{
+	struct SKS_MESSAGE *m;
+
+	if (server->verbose) printf("%ld %.*s%s%.*s\n", server->stats.requests, topic_len, topic, (topic_len > 0) ? " " : "", len, line);
+	if (server->stats.messages < SKS_MAX_MESSAGES) {
+		m = &server->messages[server->stats.messages];
+		m->request = server->stats.requests;
+		snprintf(m->topic, sizeof(m->topic), "%.*s", topic_len, topic);
+		snprintf(m->line, sizeof(m->line), "%.*s", len, line);
+	}
+	server->stats.messages++;
+}
+
+/**
+	Finds a character in a line that is not escaped by a backslash.
+
+	Inputs: The line(and its length), and the character.
+	Returns: The character found, or NULL if there is none.
+*/
+char *sks_find_unescaped(char *line, int len, char ch)
+{
+	int i;
+
+	for (i=0; i<len; i++) {
+		if (line[i] == '\\') i++;
+		else if (line[i] == ch) return line + i;
+	}
+
+	return NULL;
+}
+
+/**
+	Checks a line is an InfluxDB line("measurement,tags fields timestamp"), and records it.
+	Commas, spaces and equals signs in a tag are escaped, so only the others separate it.
+
+	Inputs: The server, and the line(and its length, without its newline).
+	Returns: 1 if the line is well formed, 0 otherwise.
+*/
+int sks_record_line(struct SKS_SERVER *server, char *line, int len)
+{
+	char *space;
+	char *comma;
+
+	sks_record(server, NULL, 0, line, len);
+
+	space = sks_find_unescaped(line, len, ' ');
+	comma = sks_find_unescaped(line, len, ',');
+	if ((space == NULL) || (comma == NULL) || (comma > space) || (sks_find_unescaped(space + 1, len - (space + 1 - line), ' ') == NULL)) {
+		server->stats.bad++;
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+	Records each line of a body, every one of which must end with a newline.
+
+	Inputs: The server, and the body(and its length).
+	Returns: 1 if every line is well formed, 0 otherwise.
+*/
+int sks_record_lines(struct SKS_SERVER *server, char *body, int len)
+{
+	char *end;
+	int valid;
+
+	valid = 1;
+	while (len > 0) {
+		end = memchr(body, '\n', len);
+		if (end == NULL) {
+			server->stats.bad++;
+			sks_record(server, NULL, 0, body, len);
+			return 0;
+		}
+		if (!sks_record_line(server, body, end - body)) valid = 0;
+		len -= (end + 1) - body;
+		body = end + 1;
+	}
+
+	return valid;
+}
+
+/**
+	Answers a client(a short answer, so it is written at once or not at all).
+
+	Inputs: The server, the client, and the answer(and its length).
+*/
+void sks_answer(struct SKS_SERVER *server, struct SKS_CLIENT *c, char *answer, int len)
+{
+	if (server->hang) return;
+	if (send(c->fd, answer, len, MSG_NOSIGNAL | MSG_DONTWAIT) != len) sks_drop_client(c);
+}
+
+/**
+	Parses the next MQTT 3.1.1 packet received: a CONNECT(with a clean session and a client
+	identifier) is answered with a CONNACK, PUBLISH(QoS 0) messages are recorded, PINGREQ
+	is answered, and DISCONNECT ends the connection.
+
+	Inputs: The server, and the client.
+	Returns: The length of the packet, 0 if it is not complete, or -1 if it is malformed
+			(or ends the connection).
+*/
+int sks_parse_mqtt(struct SKS_SERVER *server, struct SKS_CLIENT *c)
+{
+	unsigned char *p = (unsigned char *) c->rx;
+	unsigned char *body;
+	int remaining;
+	int topic_len;
+	int id_len;
+	int mult;
+	int i;
+
+	// Fixed header: the packet type, and the remaining length(7 bits per byte, up to 4 bytes).
+	remaining = 0;
+	mult = 1;
+	for (i=1; ; i++) {
+		if (i > 4) return -1;
+		if (i >= c->rx_len) return 0;
+		remaining += (p[i] & 0x7F) * mult;
+		mult *= 128;
+		if (!(p[i] & 0x80)) break;
+	}
+	body = p + i + 1;
+	if (i + 1 + remaining > SKS_BUFFER_SIZE) return -1;
+	if (i + 1 + remaining > c->rx_len) return 0;
+
+	server->stats.requests++;
+	if (remaining > server->stats.largest) server->stats.largest = remaining;
+
+	switch (p[0]) {
+		case 0x10:	// CONNECT: "MQTT", level 4, clean session only, keep alive, and client identifier.
+			if ((c->connected) || (remaining < 12) || (memcmp(body, "\x00\x04MQTT\x04\x02", 8) != 0)) return -1;
+			id_len = (body[10] << 8) | body[11];
+			if ((id_len == 0) || (12 + id_len != remaining) || (((body[8] << 8) | body[9]) == 0)) return -1;
+			c->connected = 1;
+			server->stats.connects++;
+			if (server->verbose) printf("CONNECT %.*s\n", id_len, body + 12);
+			sks_answer(server, c, "\x20\x02\x00\x00", 4);
+			break;
+		case 0x30:	// PUBLISH(QoS 0, so no packet identifier): topic, then the message.
+			if ((!c->connected) || (remaining < 2)) return -1;
+			topic_len = (body[0] << 8) | body[1];
+			if ((topic_len == 0) || (2 + topic_len > remaining)) return -1;
+			sks_record(server, (char *) body + 2, topic_len, (char *) body + 2 + topic_len, remaining - 2 - topic_len);
+			break;
+		case 0xC0:	// PINGREQ.
+			if ((!c->connected) || (remaining != 0)) return -1;
+			sks_answer(server, c, "\xD0\x00", 2);
+			break;
+		case 0xE0:	// DISCONNECT.
+			if (remaining != 0) return -1;
+			sks_drop_client(c);
+			return 0;
+		default:
+			return -1;
+	}
+
+	return i + 1 + remaining;
+}
+
+/**
+	Parses the next InfluxDB request received: a POST to /write, whose body is recorded
+	line by line, and answered with the server's status(or 400 if a line is malformed).
+
+	Inputs: The server, and the client.
+	Returns: The length of the request, 0 if it is not complete, or -1 if it is malformed.
+*/
+int sks_parse_influxdb(struct SKS_SERVER *server, struct SKS_CLIENT *c)
+{
+	char strAnswer[BUFSIZ];
+	char strMethod[16];
+	char *line;
+	char *end;
+	long content_length;
+	int header_len;
+	int status;
+
+	c->rx[c->rx_len] = 0;
+	end = strstr(c->rx, "\r\n\r\n");
+	if (end == NULL) return (c->rx_len == SKS_BUFFER_SIZE) ? -1 : 0;
+	header_len = (end + 4) - c->rx;
+
+	// Only requests with a body of a known length are accepted.
+	content_length = -1;
+	for (line = strstr(c->rx, "\r\n"); (line != NULL) && (line < end); line = strstr(line + 2, "\r\n")) {
+		if (strncasecmp(line + 2, "Content-Length:", 15) == 0) content_length = atol(line + 17);
+		if ((strncasecmp(line + 2, "Host:", 5) == 0) && (sscanf(line + 7, "%79s", server->host) != 1)) server->host[0] = 0;
+	}
+	if ((content_length < 0) || (header_len + content_length > SKS_BUFFER_SIZE)) return -1;
+	if (header_len + content_length > c->rx_len) return 0;
+
+	server->stats.requests++;
+	if (content_length > server->stats.largest) server->stats.largest = content_length;
+	if ((sscanf(c->rx, "%15s %79s", strMethod, server->path) != 2) || (strcmp(strMethod, "POST") != 0) ||
+		(strncmp(server->path, "/write?", 7) != 0)) return -1;
+
+	// A malformed line fails the whole request, as it does for InfluxDB.
+	status = (server->status > 0) ? server->status : 204;
+	if (!sks_record_lines(server, c->rx + header_len, content_length)) status = 400;
+
+	if (status == 204) {
+		snprintf(strAnswer, sizeof(strAnswer), "HTTP/1.1 204 No Content\r\nX-Influxdb-Version: stand-in\r\n\r\n");
+	} else {
+		server->stats.rejected++;
+		snprintf(strAnswer, sizeof(strAnswer), "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n%s",
+				status, (status == 400) ? "Bad Request" : "Error", (int) strlen(SKS_INFLUXDB_ERROR), SKS_INFLUXDB_ERROR);
+	}
+	sks_answer(server, c, strAnswer, strlen(strAnswer));
+
+	return header_len + content_length;
+}
+
+/**
+	Receives a UDP datagram: whole lines only(each ending with a newline), of up to
+	UDP_MAX_DATAGRAM bytes.
+
+	Inputs: The server.
+*/
+void sks_receive_udp(struct SKS_SERVER *server)
+{
+	char buf[SKS_BUFFER_SIZE];
+	int n;
+
+	while ((n = recv(server->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		server->stats.requests++;
+		server->stats.bytes_in += n;
+		if (n > server->stats.largest) server->stats.largest = n;
+		if (n > UDP_MAX_DATAGRAM) server->stats.bad++;
+		sks_record_lines(server, buf, n);
+	}
+}
+
+/**
+	Parses each complete packet or request received from a client.
+
+	Inputs: The server, and the client.
+*/
+void sks_parse(struct SKS_SERVER *server, struct SKS_CLIENT *c)
+{
+	int len;
+
+	while ((c->fd >= 0) && (c->rx_len > 0)) {
+		len = (server->type == SINK_MQTT) ? sks_parse_mqtt(server, c) : sks_parse_influxdb(server, c);
+		if (len == 0) return;
+		if (len < 0) {
+			server->stats.bad++;
+			sks_drop_client(c);
+			return;
+		}
+
+		memmove(c->rx, c->rx + len, c->rx_len - len);
+		c->rx_len -= len;
+	}
+}
+
+/**
+	Accepts new connections, and receives packets, requests and datagrams.
+
+	Inputs: The server, and the longest time to wait(in milliseconds, -1 = until something
+			happens).
+	Returns: 1 on success, -1 if the server can no longer run.
+*/
+int sks_step(struct SKS_SERVER *server, int timeout_msec)
+{
+	struct pollfd pfds[SKS_MAX_CLIENTS + 1];
+	struct SKS_CLIENT *slots[SKS_MAX_CLIENTS + 1];
+	struct SKS_CLIENT *c;
+	int count;
+	int fd;
+	int i, n;
+
+	pfds[0].fd = server->fd;
+	pfds[0].events = POLLIN;
+	pfds[0].revents = 0;
+	count = 1;
+	for (i=0; i<SKS_MAX_CLIENTS; i++) {
+		c = &server->clients[i];
+		if (c->fd < 0) continue;
+		pfds[count].fd = c->fd;
+		pfds[count].events = POLLIN;
+		pfds[count].revents = 0;
+		slots[count++] = c;
+	}
+
+	if (poll(pfds, count, timeout_msec) < 0) return (errno == EINTR) ? 1 : -1;
+
+	if (server->type == SINK_UDP) {
+		if (pfds[0].revents & POLLIN) sks_receive_udp(server);
+		return 1;
+	}
+
+	// Receive, and notice connections the client has closed.
+	for (i=1; i<count; i++) {
+		c = slots[i];
+		if ((pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) && (c->fd >= 0)) {
+			n = recv(c->fd, c->rx + c->rx_len, SKS_BUFFER_SIZE - c->rx_len, MSG_DONTWAIT);
+			if (n <= 0) {
+				if ((n == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) sks_drop_client(c);
+				continue;
+			}
+			c->rx_len += n;
+			server->stats.bytes_in += n;
+			sks_parse(server, c);
+		}
+	}
+
+	// Accept new connections(closing any beyond the clients that can be served).
+	if (pfds[0].revents & POLLIN) {
+		while ((fd = accept(server->fd, NULL, NULL)) >= 0) {
+			for (i=0; (i<SKS_MAX_CLIENTS) && (server->clients[i].fd >= 0); i++);
+			if (i == SKS_MAX_CLIENTS) {
+				close(fd);
+				continue;
+			}
+			fcntl(fd, F_SETFL, O_NONBLOCK);
+			memset(&server->clients[i], 0, sizeof(server->clients[i]));
+			server->clients[i].fd = fd;
+			server->stats.connections++;
+		}
+	}
+
+	return 1;
+}
+
+/**
+	Prints the server's statistics.
+
+	Inputs: The server, and the stream to print to.
+*/
+void sks_print_stats(struct SKS_SERVER *server, FILE *out)
+{
+	fprintf(out, "Connections: %ld (%ld MQTT sessions)\n", server->stats.connections, server->stats.connects);
+	fprintf(out, "Requests: %ld (%ld samples, largest %ld bytes)\n", server->stats.requests, server->stats.messages, server->stats.largest);
+	fprintf(out, "Refused: %ld malformed, %ld rejected\n", server->stats.bad, server->stats.rejected);
+	fprintf(out, "Bytes in: %ld\n", server->stats.bytes_in);
+}
@@ -0,0 +1,83 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Stands in for the sinks samples are published to(an MQTT broker,
+					InfluxDB's /write service, and a UDP listener), checking the framing of
+					what each receives, for testing publishing without the real services.
+	Version		:	v0.8
+*/
+
+#ifndef SINK_SERVER_H
+
+	// Header Guard.
+	#define SINK_SERVER_H
+
+	// Include Files.
+	#include "../Application/global.h"
+
+	/*
+	* Definitions.
+	*/
+
+	#define SKS_MAX_CLIENTS				8											// Most connections open at once
+	#define SKS_BUFFER_SIZE				32768										// Largest packet, request or datagram received
+	#define SKS_MAX_MESSAGES			256											// Most samples recorded(later ones are only counted)
+	#define SKS_MQTT_PORT				11883										// Default MQTT port
+	#define SKS_INFLUXDB_PORT			18086										// Default InfluxDB port
+	#define SKS_UDP_PORT				18089										// Default UDP port
+	#define SKS_INFLUXDB_ERROR			"{\"error\":\"rejected by the stand-in\"}\n"	// Body of an InfluxDB error
+
+	/*
+	 * Custom Structures
+	 */
+
+	// Sink Server Statistics
+	struct SKS_STATS {
+		long 	connections;		// Connections accepted.
+		long 	requests;			// MQTT packets, InfluxDB requests, or UDP datagrams received.
+		long 	connects;			// MQTT CONNECTs accepted.
+		long 	messages;			// Samples received(MQTT messages, or lines).
+		long 	bad;				// Malformed packets, requests, datagrams or lines.
+		long 	rejected;			// InfluxDB requests answered with an error.
+		long 	largest;			// Largest packet, request body, or datagram.
+		long 	bytes_in;
+	};
+
+	// Sink Server Message (a sample received)
+	struct SKS_MESSAGE {
+		int 	request;					// Packet, request or datagram it arrived in(counted from 1).
+		char 	topic[MQTT_TOPIC_LENGTH];	// MQTT topic(empty for InfluxDB and UDP).
+		char 	line[PUBLISH_RECORD_SIZE];	// The sample, without its newline.
+	};
+
+	// Sink Server Client (a connection, and the data received but not yet parsed)
+	struct SKS_CLIENT {
+		int 	fd;					// Socket(-1 if the slot is free).
+		char 	rx[SKS_BUFFER_SIZE+1];
+		int 	rx_len;
+		int 	connected;			// 1 once an MQTT CONNECT was accepted.
+	};
+
+	// Sink Server (the listening socket, its clients, the behaviour injected, and what was received)
+	struct SKS_SERVER {
+		int 				type;			// SINK_*.
+		int 				fd;				// Listening(or UDP) socket.
+		int 				port;			// Port listened on(0 picks a free port when opened).
+		struct SKS_CLIENT 	clients[SKS_MAX_CLIENTS];
+		int 				status;			// Status InfluxDB requests are answered with(204 if 0).
+		int 				hang;			// 1 to receive, but never answer(a sink that has stopped responding).
+		char 				path[LINE_LENGTH * 4];	// Path of the last InfluxDB request.
+		char 				host[LINE_LENGTH * 4];	// Host header of the last InfluxDB request.
+		struct SKS_MESSAGE 	messages[SKS_MAX_MESSAGES];
+		struct SKS_STATS 	stats;
+		int 				verbose;
+	};
+
+	// External declarations.
+	extern int 		sks_open(struct SKS_SERVER *);
+	extern void 	sks_close(struct SKS_SERVER *);
+	extern void 	sks_drop_clients(struct SKS_SERVER *);
+	extern int 		sks_step(struct SKS_SERVER *, int);
+	extern void 	sks_print_stats(struct SKS_SERVER *, FILE *);
+
+#endif
@@ -0,0 +1,87 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Stands in for the sinks samples are published to(an MQTT broker,
+					InfluxDB's /write service, and a UDP listener), checking the framing of
+					what each receives, for testing publishing without the real services.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "sink_server.h"
+
+#define	SKS_OPTLIST		"t:p:s:Hv"
+
+volatile sig_atomic_t sks_running = 1;
+
+/**
+	Stops the server on SIGTERM/SIGINT.
+*/
+void handle_stop_signal(int sig)
+{
+	sks_running = 0;
+}
+
+/**
+	Prints the command line options.
+*/
+void print_options(char *name)
+{
+	printf("Usage: %s [options]\n\n", name);
+	printf("\t-t x\t\tSink to stand in for(mqtt (Default), influxdb, udp)\n");
+	printf("\t-p x\t\tPort to listen on, on the loopback interface(%d, %d or %d (Default), 0=Any free port)\n", SKS_MQTT_PORT, SKS_INFLUXDB_PORT, SKS_UDP_PORT);
+	printf("\t-s x\t\tStatus InfluxDB requests are answered with(204 (Default))\n");
+	printf("\t-H\t\tReceive, but never answer(a sink that has stopped responding)\n");
+	printf("\t-v\t\tVerbose, print each sample\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct SKS_SERVER server;
+	struct sigaction sa;
+	int opt;
+
+	memset(&server, 0, sizeof(server));
+	server.type = SINK_MQTT;
+	server.port = -1;
+
+	while ((opt = getopt(argc, argv, SKS_OPTLIST)) != -1)
+	{
+		switch (opt) {
+			case 't':
+				if (strcmp(optarg, "influxdb") == 0) server.type = SINK_INFLUXDB;
+				else if (strcmp(optarg, "udp") == 0) server.type = SINK_UDP;
+				else server.type = SINK_MQTT;
+				break;
+			case 'p': server.port = atoi(optarg); break;
+			case 's': server.status = atoi(optarg); break;
+			case 'H': server.hang = 1; break;
+			case 'v': server.verbose = 1; break;
+			default:
+				print_options(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (server.port < 0) server.port = (server.type == SINK_MQTT) ? SKS_MQTT_PORT : ((server.type == SINK_INFLUXDB) ? SKS_INFLUXDB_PORT : SKS_UDP_PORT);
+	if (sks_open(&server) != 1) return EXIT_FAILURE;
+
+	// Print the address for scripts to pass to motech -M, -I or -U.
+	printf("127.0.0.1:%d\n", server.port);
+	fflush(stdout);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_stop_signal;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	while (sks_running) {
+		if (sks_step(&server, 1000) != 1) break;
+		if (server.verbose) fflush(stdout);
+	}
+
+	sks_print_stats(&server, stderr);
+	sks_close(&server);
+
+	return EXIT_SUCCESS;
+}
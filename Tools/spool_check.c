@@ -0,0 +1,150 @@
+/**
+	Author		:	Timothy Black
+	Date		:	26th December 2015
+	Description	:	Checks that IO/spool.c reads the statuses waiting in the spool in
+					batches, skipping lines that are not statuses(including ones too long
+					to be a status), leaving a line still being written until it has its
+					end, and emptying the spool once all of it has been processed.
+	Version		:	v0.8
+*/
+
+// Include Files.
+#include "../IO/spool.h"
+#include <stdarg.h>
+#include <sys/stat.h>
+
+#define CHECK_LONG_LINE		(SPOOL_LINE_LENGTH * 3)						// Length of a line too long to be a status
+
+int check_failures;
+
+/**
+	Records the result of a check.
+
+	Inputs: The check's name, 1 if it passed, and what went wrong(if it did not).
+*/
+void check_result(char *name, int passed, char *fmt, ...)
+{
+	va_list args;
+
+	if (passed) {
+		printf("PASS %s\n", name);
+		return;
+	}
+
+	check_failures++;
+	printf("FAIL %s: ", name);
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	printf("\n");
+}
+
+/**
+	Adds text to the end of the spool, as the poller would.
+
+	Inputs: The text.
+*/
+void check_write(char *text)
+{
+	FILE *file;
+
+	file = fopen(pvo_spool_file, "a");
+	if (file == NULL) return;
+	fputs(text, file);
+	fclose(file);
+}
+
+/**
+	Adds a line too long to be a status to the end of the spool.
+
+	Inputs: 1 to end the line, 0 to leave it unfinished.
+*/
+void check_write_long(int finished)
+{
+	char strLine[CHECK_LONG_LINE + 2];
+
+	memset(strLine, 'x', CHECK_LONG_LINE);
+	strcpy(strLine + CHECK_LONG_LINE, (finished) ? "\n" : "");
+	check_write(strLine);
+}
+
+/**
+	Reads the next batch, checks it holds the statuses expected, and acknowledges it as
+	PVOutput having processed it.
+
+	Inputs: The check's name, and the statuses expected(separated by ';', empty if none).
+*/
+void check_batch(char *name, char *expected)
+{
+	char strData[BUFSIZ];
+	long next;
+	int count;
+
+	count = spool_read_next(strData, sizeof(strData), &next);
+	if (count == 0) strData[0] = 0;
+	check_result(name, strcmp(strData, expected) == 0, "read %d status(es), \"%.100s\", not \"%s\"", count, strData, expected);
+	if (count > 0) spool_ack(next);
+}
+
+/**
+	Checks the spool has been emptied.
+
+	Inputs: The check's name.
+*/
+void check_empty(char *name)
+{
+	struct stat st;
+
+	memset(&st, 0, sizeof(st));
+	check_result(name, (stat(pvo_spool_file, &st) == 0) && (st.st_size == 0) && (spool_pending() == 0),
+			"%ld byte(s) left, %ld pending", (long) st.st_size, spool_pending());
+}
+
+int main(int argc, char *argv[])
+{
+	char strSpool[LINE_LENGTH * 3];
+	char strOffset[BUFSIZ];
+
+	verbose = 0;
+	snprintf(strSpool, sizeof(strSpool), "/tmp/motech_spool_check.%d.txt", (int) getpid());
+	snprintf(strOffset, sizeof(strOffset), "%s.pos", strSpool);
+	pvo_spool_file = strSpool;
+	unlink(strSpool);
+	unlink(strOffset);
+
+	check_write("20260101,12:00,1000,10,,,,240.0\n20260101,12:05,1010,20,,,,240.1\n");
+	check_batch("Statuses in a batch", "20260101,12:00,1000,10,,,,240.0;20260101,12:05,1010,20,,,,240.1");
+	check_empty("Spool emptied once processed");
+
+	check_write("20260101,12:10,1020,30,,,,240.2\n20260101,12:10,1021,31,,,,240.3\n");
+	check_batch("Same date and time replaced", "20260101,12:10,1021,31,,,,240.3");
+
+	check_write("not a status\n20260101,12:15,1030,40,,,,240.4\n");
+	check_batch("Line that is not a status skipped", "20260101,12:15,1030,40,,,,240.4");
+
+	check_write_long(1);
+	check_write("20260101,12:20,1040,50,,,,240.5\n");
+	check_batch("Line too long skipped", "20260101,12:20,1040,50,,,,240.5");
+	check_empty("Spool emptied after a line too long");
+
+	check_write("20260101,12:25,1050,60,,,,240.6\n");
+	check_write_long(0);
+	check_batch("Statuses before an unfinished long line", "20260101,12:25,1050,60,,,,240.6");
+	check_batch("Unfinished long line left", "");
+	check_write("\n20260101,12:30,1060,70,,,,240.7\n");
+	check_batch("Long line skipped once finished", "20260101,12:30,1060,70,,,,240.7");
+
+	check_write("20260101,12:35,1070,80,,,,240.8\n20260101,12:4");
+	check_batch("Statuses before an unfinished line", "20260101,12:35,1070,80,,,,240.8");
+	check_batch("Unfinished line left", "");
+	check_write("0,1080,90,,,,240.9\n");
+	check_batch("Line read once finished", "20260101,12:40,1080,90,,,,240.9");
+	check_empty("Spool emptied at the end");
+
+	unlink(strSpool);
+	unlink(strOffset);
+
+	printf("%s: %d check(s) failed.\n", (check_failures == 0) ? "Passed" : "Failed", check_failures);
+
+	return (check_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
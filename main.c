@@ -10,84 +10,263 @@
 #include "Application/global.h"
 #include "Application/interface.h"
 #include "Application/settings.h"
+#include "IO/engine.h"
 #include "IO/internet.h"
+#include "IO/metrics.h"
+#include "IO/publisher.h"
+#include "IO/resolver.h"
 #include "IO/serial.h"
+#include "IO/uploader.h"
 
 /**
-	Processes search/lookup request for Motech Inverter.
+	Counts the inverters polled on a serial port.
+
+	Inputs: The index of the serial port.
+	Returns: The number of inverters.
+*/
+int count_port_inverters(int port)
+{
+	int count;
+	int i;
+
+	count = 0;
+	for (i=0; i<inv_count; i++) {
+		if (inv_devices[i].port == port) count++;
+	}
+
+	return count;
+}
+
+/**
+	Processes search/lookup request for Motech Inverter. Each address is probed with the
+	short scan request and a short timeout, and the identification strings are only read
+	from inverters that answer. The addresses found are cached for later runs.
+
+	Inputs: The index of the serial port to scan.
 */
-void perform_scan_request(int sp)
+void perform_scan_request(int port)
 {
-	struct INV_DEVICE_VALUES *idv;
+	int sp = sp_ports[port].fd;
+	struct INV_DEVICE_VALUES idv;
+	int found[INV_MAX_DEVICES];
+	int found_count;
 	int address;
 	int pVerb;
+	int pTimeout;
+	int i;
 
-	// Set verbose to OFF.
+	// Set verbose to OFF, and use the short scan timeout.
 	pVerb = verbose;
+	pTimeout = sp_timeout_msec;
 	verbose = 0;
+	sp_timeout_msec = SCAN_TIMEOUT_MSEC;
 
 	// Scan for addresses 1-255.
+	found_count = 0;
 	for (address=1; address<=255; address++) {
 		printf("Searching on address %d\n", address);
-		idv = read_device_values(address, sp);
+		if (scan_inverter(address, sp) != 1) continue;
 
-		// If the address is found
-		if (idv->Brand_Name != NULL) {
-			// Print information on stdout.
-			printf("Found inverter at address %d:\n", address);
-			printf("\tBrand Name: %s\n", idv->Brand_Name);
-			printf("\tType Name: %s\n", idv->Type_Name);
-			printf("\tSerial Number: %s\n", idv->Sn_Name);
+		// Read the identification strings with the normal timeout.
+		sp_timeout_msec = pTimeout;
+		read_device_values(address, sp, &idv);
+		sp_timeout_msec = SCAN_TIMEOUT_MSEC;
 
-			// Set the address to the found address.
-			inv_address = address;
+		// Print information on stdout.
+		printf("Found inverter at address %d:\n", address);
+		printf("\tBrand Name: %s\n", idv.Brand_Name);
+		printf("\tType Name: %s\n", idv.Type_Name);
+		printf("\tSerial Number: %s\n", idv.Sn_Name);
 
-			// Free memory.
-			free(idv);
-		}
+		// Set the address to the found address.
+		inv_address = address;
+		if (found_count < INV_MAX_DEVICES) found[found_count++] = address;
 
-		isleep(READ_SLEEP_USEC);
+		// Stop early once the expected number of inverters is found.
+		if ((inv_look_for_count > 0) && (found_count >= inv_look_for_count)) break;
 	}
 
-	// Set verbose to the previous setting.
+	// Set verbose and the timeout to the previous settings.
 	verbose = pVerb;
+	sp_timeout_msec = pTimeout;
+
+	printf("Found %d inverter(s) on %s.\n", found_count, sp_ports[port].dev_name);
+	write_scan_cache(sp_ports[port].dev_name, found, found_count);
+
+	// Poll the inverters found, unless addresses were given for the serial port.
+	if (count_port_inverters(port) == 0) {
+		for (i=0; i<found_count; i++) add_inverter(port, found[i]);
+	}
 }
 
 /**
-	Processes requests for Motech Inverter.
+	Negotiates a serial port's baud rate again once every inverter on it has just failed
+	INV_DEAD_POLLS polls in a row, as an inverter that restarted may have returned to
+	its default rate.
+
+	Inputs: The index of the serial port.
 */
-void perform_main_requests(int sp)
+void check_port_baud(int port)
 {
-	struct INVERTER_INFO ii;
+	int least;
+	int i;
+
+	least = -1;
+	for (i=0; i<inv_count; i++) {
+		if (inv_devices[i].port != port) continue;
+		if ((least < 0) || (inv_devices[i].fail_count < least)) least = inv_devices[i].fail_count;
+	}
+	if ((least != INV_DEAD_POLLS) || (sp_ports[port].fd < 0)) return;
+
+	fprintf(stderr, "No inverter on %s is answering, checking its baud rate.\n", sp_ports[port].dev_name);
+	if (negotiate_port_baud(port) < 0) return;
+
+	// The inverters answer again, so poll them from the next poll.
+	for (i=0; i<inv_count; i++) {
+		if (inv_devices[i].port != port) continue;
+		inv_devices[i].fail_count = 0;
+		update_inverter_backoff(&inv_devices[i], 1);
+	}
+}
+
+volatile sig_atomic_t dmn_running = 1;	// Cleared by SIGTERM/SIGINT to stop the daemon loop.
+
+/**
+	Processes requests for the Motech Inverters on all serial ports.
+
+	Returns: 1 when a valid sample was read from at least one inverter, -1 otherwise.
+*/
+int perform_main_requests()
+{
+	int err;
+	int valid;
+	int cache_changed;
+	int polled;
+	int i;
+
+	struct INVERTER *dev;
+	static struct INVERTER_INFO ii;
 
 	time_t rtime;
 	struct tm *ti;
 
-	ii.its1 = read_trip_settings1(inv_address, sp);
-	ii.its2 = read_trip_settings2(inv_address, sp);
-	ii.ids = read_device_settings(inv_address, sp);
-	ii.itv = read_total_values(inv_address, sp);
-	ii.idv = read_device_values(inv_address, sp);
-	ii.ics = read_current_state(inv_address, sp);
-	ii.icv = read_current_values(inv_address, sp);
+	engine_poll_cycle();
 
 	time (&rtime);
 	ti = localtime(&rtime);
 
-	strftime((char *) &ii.dt.date, 20, "%Y%m%d", ti);
-	strftime((char *) &ii.dt.time, 20, "%H:%M", ti);
+	// Account for each inverter's outcome.
+	valid = 0;
+	polled = 0;
+	cache_changed = 0;
+	for (i=0; i<inv_count; i++) {
+		dev = &inv_devices[i];
+
+		// Inverters with no blocks due this poll have nothing new to report.
+		if ((dev->skipped) || (dev->blocks == 0)) continue;
+		dev->polls++;
+		polled++;
+
+		strftime((char *) &dev->ii.dt.date, 20, "%Y%m%d", ti);
+		strftime((char *) &dev->ii.dt.time, 20, "%H:%M", ti);
+
+		if (has_current_sample(&dev->ii)) {
+			if (inv_count > 1) printf("Inverter Address: %d(%s)\n", dev->address, sp_ports[dev->port].dev_name);
+			print_inverter_data(&dev->ii);
+			dev->fail_count = 0;
+			update_inverter_backoff(dev, 1);
+			if (update_static_blocks(dev)) cache_changed = 1;
+			if (pub_sink_count > 0) publisher_publish(dev, rtime);
+			valid++;
+		} else {
+			// Wake the inverter's serial interface again before the next poll.
+			dev->awake = 0;
+			dev->fail_count++;
+			dev->failures++;
+
+			// The inverter may be replaced while it is unreachable, so read its settings and names again once it answers.
+			if (dev->static_read_at != 0) {
+				dev->static_read_at = 0;
+				cache_changed = 1;
+			}
+			fprintf(stderr, "Invalid responses were received from the inverter at address %d on %s(%d consecutive failures).\n", dev->address, sp_ports[dev->port].dev_name, dev->fail_count);
+			update_inverter_backoff(dev, 0);
+			if (dev->skip_polls > 0) fprintf(stderr, "Skipping the next %d poll(s) of the inverter at address %d.\n", dev->skip_polls, dev->address);
+		}
+	}
+
+	if (cache_changed) write_static_cache(inv_devices, inv_count);
+	if (sp_auto_baud) {
+		for (i=0; i<sp_count; i++) check_port_baud(i);
+	}
+	if (polled == 0) return 1;
 
-	if (ii.icv != NULL)
+	if (valid > 0)
 	{	
-		print_inverter_data(&ii);
-		if (pvo_send_to != 0) send_response_http_pvoutput(&ii);
+		// Multiple inverters are published as one PVOutput system(uploaded by the upload thread).
+		if (pvo_send_to != 0) {
+			if (inv_count > 1) {
+				aggregate_inverter_info(inv_devices, inv_count, &ii);
+				uploader_queue(&ii);
+			} else {
+				uploader_queue(&inv_devices[0].ii);
+			}
+		}
 
 		if (rof_flag != 0) write_fail_count(0);
+		err = 1;
 	} else {
 		fprintf(stderr, "Not publishing data to webservers as invalid responses from the inverter was received.\n");
 		if (rof_flag != 0) check_for_failures();
+		err = -1;
 	}
-	
+
+	return err;
+}
+
+/**
+	Stops the daemon loop on SIGTERM/SIGINT.
+*/
+void handle_stop_signal(int sig)
+{
+	dmn_running = 0;
+}
+
+/**
+	Processes requests for Motech Inverter at a fixed interval, keeping the serial ports
+	open between polls, until SIGTERM/SIGINT is received.
+*/
+void perform_daemon_requests()
+{
+	struct sigaction sa;
+	long next_poll;
+	long remaining;
+
+	// Stop cleanly on SIGTERM/SIGINT(without SA_RESTART, so the sleep is interrupted).
+	memset(&sa, 0, sizeof(struct sigaction));
+	sa.sa_handler = handle_stop_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	printf("Polling %d inverter(s) on %d serial port(s) every %d seconds.\n", inv_count, sp_count, dmn_interval);
+
+	next_poll = get_time_msec();
+	while (dmn_running) {
+		perform_main_requests();
+		metrics_update();
+
+		// Schedule the next poll on a fixed cadence, skipping any polls that were missed.
+		next_poll += dmn_interval * 1000L;
+		if (next_poll < get_time_msec()) next_poll = get_time_msec();
+
+		// Wait until the next poll is due, or a stop signal arrives.
+		while (dmn_running && ((remaining = next_poll - get_time_msec()) > 0)) {
+			engine_wait(remaining);
+		}
+	}
+
+	printf("Stopping daemon.\n");
 }
 
 /**
@@ -95,30 +274,60 @@ void perform_main_requests(int sp)
  */
 int process_options(int argc, char *argv[]) {
     int opt, opterr;
+    int port;
+    char *addr;
+    static struct option long_options[] = {
+        {"daemon",		no_argument,		NULL,	'd'},
+        {"interval",	required_argument,	NULL,	't'},
+        {"auto-baud",	no_argument,		NULL,	'u'},
+        {NULL,			0,					NULL,	0}
+    };
 
     // Look for command line arguments.
     if (argc<=1) return -1;
 
     opterr = 1;
-    while((opt = getopt(argc, argv, OPTLIST)) != -1)
+    port = 0;
+    while((opt = getopt_long(argc, argv, OPTLIST, long_options, NULL)) != -1)
     {
 		switch (opt) {
 			case 'b':	// Baud Rate
 				if (atoi(optarg)==1) sp_baud_rate = B9600;
 				else sp_baud_rate = B19200;
 				break;
-			case 's':	// Serial Port
-				sp_dev_name = strdup(optarg);
+			case 'u':	// Switch to the fastest baud rate
+				sp_auto_baud = 1;
+				break;
+			case 's':	// Serial Port(each one adds a port, and the addresses after it are on that port)
+				port = add_serial_port(strdup(optarg));
+				if (port < 0) opterr = -1;
 				break;
-			case 'a':	// Inverter Address
-				inv_address = atoi(optarg);
+			case 'a':	// Inverter Address(es), comma separated
+				for (addr = strtok(optarg, ","); addr != NULL; addr = strtok(NULL, ",")) {
+					if ((port < 0) || (add_inverter(port, atoi(addr)) != 1)) opterr = -1;
+				}
+				if (inv_count > 0) inv_address = inv_devices[0].address;
+				break;
+			case 'm':	// Largest register block per read
+				inv_max_registers = atoi(optarg);
+				if ((inv_max_registers < 1) || (inv_max_registers > FRAME_MAX_DATA/2)) opterr = -1;
 				break;
 			case 'l':	// Look for Inverter Address
 				inv_look_for_addr = 1;
 				break;
+			case 'n':	// Stop looking after this many inverters are found
+				inv_look_for_count = atoi(optarg);
+				break;
 			case 'g':	// Get data from inverter.
 				inv_get_data = 1;
 				break;
+			case 'd':	// Run as a long-running poller
+				dmn_flag = 1;
+				break;
+			case 't':	// Polling interval in daemon mode
+				dmn_interval = atoi(optarg);
+				if (dmn_interval < 1) opterr = -1;
+				break;
 			case 'p':	// Publish to PVOutput
 				pvo_send_to = 1;
 				break;
@@ -128,6 +337,33 @@ int process_options(int argc, char *argv[]) {
 			case 'k':	// PVOutput API Key
 				pvo_api_key = strdup(optarg);
 				break;
+			case 'q':	// PVOutput Spool File
+				pvo_spool_file = strdup(optarg);
+				break;
+			case 'w':	// Upload queue overflow
+				if (atoi(optarg) == UPLOAD_DROP_OLDEST) pvo_overflow = UPLOAD_DROP_OLDEST;
+				else pvo_overflow = UPLOAD_SPILL;
+				break;
+			case 'o':	// PVOutput Host(and port)
+				pvo_conn.host = strdup(optarg);
+				addr = strchr(pvo_conn.host, ':');
+				if (addr != NULL) {
+					*addr = 0;
+					pvo_conn.port = atoi(addr + 1);
+				}
+				break;
+			case 'M':	// MQTT broker
+				if (publisher_add_sink(SINK_MQTT, optarg) != 1) opterr = -1;
+				break;
+			case 'I':	// InfluxDB server
+				if (publisher_add_sink(SINK_INFLUXDB, optarg) != 1) opterr = -1;
+				break;
+			case 'U':	// UDP listener
+				if (publisher_add_sink(SINK_UDP, optarg) != 1) opterr = -1;
+				break;
+			case 'x':	// Metrics address and port
+				met_listen = optarg;
+				break;
 			case 'r':	// Restart on Failure Flag
 				rof_flag = 1;
 				break;
@@ -155,17 +391,35 @@ int process_options(int argc, char *argv[]) {
 void print_options(char *strApp) {
 	printf("Serial Port Arguments\n");
 	printf("\t-b x\t\tBaud Rate(1=9600(Default), 2=19200)\n");
-	printf("\t-s dev_name\tSerial Port Device Name(/dev/ttyUSB0 (Default))\n\n");
+	printf("\t-u, --auto-baud\tSwitch the Inverters and Serial Port to the fastest Baud Rate (0=Off(Default), 1=On)\n");
+	printf("\t-s dev_name\tSerial Port Device Name(/dev/ttyUSB0 (Default)), repeat for more ports\n\n");
 
 	printf("Inverter Arguments\n");
-	printf("\t-a x\t\tInverter Address(45 (Default))\n");
+	printf("\t-a x[,y,...]\tInverter Address(es) on the preceding serial port(45 (Default))\n");
+	printf("\t-m x\t\tMax Registers per Read(32 (Default))\n");
 	printf("\t-l\t\tLook/Scan for Inverter Address (0=Off(Default), 1=On)\n");
+	printf("\t-n x\t\tStop Scanning after x Inverters are found(0=Scan all (Default))\n");
 	printf("\t-g\t\tGet Inverter Data (0=Off(Default), 1=On)\n\n");
 
+	printf("Daemon Arguments\n");
+	printf("\t-d, --daemon\tKeep polling the inverter at the interval(requires -g)\n");
+	printf("\t-t, --interval x\tPolling Interval in seconds(10 (Default))\n\n");
+
 	printf("PVOutput Arguments\n");
 	printf("\t-p\t\tPublish Data to PVOutput (0=Off(Default), 1=On)\n");
 	printf("\t-i sys_id\tPVOutput System ID\n");
-	printf("\t-k api_key\tPVOutput API Key\n\n");
+	printf("\t-k api_key\tPVOutput API Key\n");
+	printf("\t-o host[:port]\tPVOutput Host(www.pvoutput.org:80 (Default))\n");
+	printf("\t-q file\t\tPVOutput Spool File, for statuses not yet uploaded(/tmp/motech_spool.txt (Default))\n");
+	printf("\t-w x\t\tUpload Queue Overflow(1=Drop oldest, 2=Spill to disk (Default))\n\n");
+
+	printf("Publishing Arguments(each may be repeated, up to %d sinks)\n", PUBLISH_MAX_SINKS);
+	printf("\t-M host[:port][/topic]\tPublish to an MQTT broker(port 1883, topic motech (Default))\n");
+	printf("\t-I host[:port][/db]\tPublish to InfluxDB(port 8086, database motech (Default))\n");
+	printf("\t-U host[:port]\tPublish to a UDP listener, as InfluxDB lines(port 8089 (Default))\n\n");
+
+	printf("Metrics Arguments\n");
+	printf("\t-x [addr:]port\tServe Prometheus metrics at /metrics in daemon mode(eg -x %d, on all addresses)\n\n", METRICS_PORT);
 
 	printf("Restart-On-Failure Arguments\n");
 	printf("\t-c\t\tRestart on Failure Flag (0=Off(Default), 1=On)\n");
@@ -182,8 +436,10 @@ void print_options(char *strApp) {
 */
 int main(int argc, char *argv[])
 {
-	int sp;
+	int found[INV_MAX_DEVICES];
+	int found_count;
 	int err;
+	int i, j;
 
 	printf("-----------------------------------------\n");
 	printf("Motech Monitor v0.8\n");
@@ -192,22 +448,66 @@ int main(int argc, char *argv[])
 
 	err = 1;
 	if (process_options(argc, argv) == 1) {
-		// Open the serial port, and check whether it was successful.
-		sp = open_port();
-		if (sp < 0) {
-			check_for_failures();
-			perror("Cannot connect on serial port. Something went seriously wrong.\n");
-			exit(EXIT_FAILURE);
+		// Open the serial ports, and check whether it was successful.
+		for (i=0; i<sp_count; i++) {
+			sp_ports[i].fd = open_port(sp_ports[i].dev_name);
+			if (sp_ports[i].fd < 0) {
+				check_for_failures();
+				perror("Cannot connect on serial port. Something went seriously wrong.\n");
+				exit(EXIT_FAILURE);
+			}
 		}
 
-		// Scan for Inverter Address.
-		if (inv_look_for_addr) perform_scan_request(sp);
+		for (i=0; i<sp_count; i++) {
+			// Scan for Inverter Address.
+			if (inv_look_for_addr) perform_scan_request(i);
+
+			// Poll the addresses found by the last scan, or the default address, unless addresses were given.
+			if (count_port_inverters(i) == 0) {
+				found_count = read_scan_cache(sp_ports[i].dev_name, found, INV_MAX_DEVICES);
+				for (j=0; j<found_count; j++) add_inverter(i, found[j]);
+			}
+			if (count_port_inverters(i) == 0) add_inverter(i, inv_address);
 
-		// Perform the requests.
-		if (inv_get_data) perform_main_requests(sp);
+			// Find the rate the inverters answer at, and switch them to the fastest.
+			if (sp_auto_baud) negotiate_port_baud(i);
+		}
+
+		// Perform the requests, on all serial ports at once.
+		if (inv_get_data) {
+			if ((engine_init() != 1) || (engine_add_ports() != 1)) exit(EXIT_FAILURE);
+			srand(time(NULL) ^ getpid());
+
+			// Look up PVOutput while the inverters are polled, and upload from a thread of its own.
+			if (pvo_send_to != 0) {
+				resolver_prefetch(pvo_conn.host, pvo_conn.port);
+				if (uploader_start() != 1) exit(EXIT_FAILURE);
+			}
+			if (publisher_start() != 1) exit(EXIT_FAILURE);
+
+			// Serve the metrics from the engine, between the serial port events.
+			if ((met_listen != NULL) && (dmn_flag)) {
+				if (metrics_start(met_listen) != 1) exit(EXIT_FAILURE);
+			} else if (met_listen != NULL) {
+				fprintf(stderr, "The metrics are only served in daemon mode(-d).\n");
+			}
+
+			// Reuse the settings and names read by an earlier run.
+			for (i=0; i<inv_count; i++) read_static_cache(&inv_devices[i]);
+
+			if (dmn_flag) perform_daemon_requests();
+			else perform_main_requests();
+
+			// A single poll waits for its status to be uploaded, a daemon leaves the spool for the next run.
+			uploader_stop(!dmn_flag);
+			publisher_stop();
+			metrics_stop();
+		}
 
-		// Close the serial port.
-		close_port(sp);
+		// Close the serial ports.
+		for (i=0; i<sp_count; i++) {
+			if (sp_ports[i].fd >= 0) close_port(sp_ports[i].fd);
+		}
 	} else {
 		err = 0;
 		print_options(argv[0]);